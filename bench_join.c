@@ -0,0 +1,823 @@
+/*
+ * Standalone join benchmark
+ *
+ * Reproduces the memory access patterns of PostgreSQL's HashJoin and NestLoop
+ * executor nodes without PostgreSQL, so layouts, prefetching and batching can
+ * be tried in minutes instead of rebuilding the server:
+ *
+ *   hash_build    scan the inner side into a chained bucket array
+ *                 (ExecHashTableInsert); tuples are dense-packed in 32 KiB
+ *                 chunks, tuples of later batches go to temp files
+ *                 (ExecHashJoinSaveTuple)
+ *   hash_probe    walk a bucket chain comparing hash values, then keys
+ *                 (ExecScanHashBucket); outer tuples of later batches go to
+ *                 temp files
+ *   batch_reload  read an inner batch file back into the emptied table
+ *                 (ExecHashJoinNewBatch)
+ *   nl_rescan     rescan the whole inner side for every outer tuple
+ *   nl_index      look every outer key up in a sorted index, then fetch the
+ *                 inner row it points to
+ *
+ * Each phase is a perfmon region; tuples and bucket-chain steps are user
+ * counters.  The join result is checked against the generated data.
+ *
+ * Usage: bench_join [options]
+ *   -b rows    inner (build) rows                            (1000000)
+ *   -p rows    outer (probe) rows                            (4000000)
+ *   -s theta   Zipf skew of matching outer keys, 0 = uniform (0)
+ *   -m frac    fraction of outer rows that find a match      (1.0)
+ *   -w kib     work_mem; a larger inner side is multi-batched (65536)
+ *   -t bytes   payload bytes per tuple                       (32)
+ *   -f n       probe in groups of n with prefetch, 0 = off   (0)
+ *   -n rows    nested-loop outer rows                        (2000)
+ *   -i rows    nested-loop inner rows                        (50000)
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include "perfmon.h"
+
+#define HASH_CHUNK_SIZE     (32 * 1024)
+#define MIN_BUCKETS         1024
+#define MAX_PAYLOAD         1024
+#define MAX_PREFETCH_GROUP  64
+
+PERFMON_REGION(hash_build);
+PERFMON_REGION(hash_probe);
+PERFMON_REGION(batch_reload);
+PERFMON_REGION(nl_rescan);
+PERFMON_REGION(nl_index);
+
+/* Benchmark parameters */
+typedef struct {
+    size_t build_rows;
+    size_t probe_rows;
+    double skew;
+    double match_fraction;
+    size_t work_mem_kib;
+    size_t payload;
+    int prefetch;
+    size_t nl_outer_rows;
+    size_t nl_inner_rows;
+} join_params_t;
+
+/* Hash table tuple (HashJoinTupleData + MinimalTuple) */
+typedef struct join_tuple {
+    struct join_tuple *next;
+    uint32_t hashvalue;
+    uint64_t key;
+    unsigned char payload[];
+} join_tuple_t;
+
+/* Dense tuple storage (HashMemoryChunkData) */
+typedef struct hash_chunk {
+    struct hash_chunk *next;
+    size_t used;
+    unsigned char data[];
+} hash_chunk_t;
+
+/* Temp file record header; the payload follows */
+typedef struct {
+    uint32_t hashvalue;
+    uint64_t key;
+} spill_header_t;
+
+typedef struct {
+    join_tuple_t **buckets;
+    uint32_t nbuckets;
+    int log2_nbuckets;
+    uint32_t nbatch;
+    uint32_t curbatch;
+    size_t tuple_size;
+    size_t payload;
+    hash_chunk_t *chunks;
+    FILE **inner_files;
+    FILE **outer_files;
+} hash_table_t;
+
+/* What one phase did, folded into user counters */
+typedef struct {
+    uint64_t outer;
+    uint64_t inner;
+    uint64_t emitted;
+    uint64_t steps;
+    uint64_t spilled;
+    uint64_t checksum;
+} join_counts_t;
+
+static int outer_id, inner_id, emitted_id, steps_id, spilled_id;
+
+static uint64_t xorshift(uint64_t *state) {
+    uint64_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+/* Uniform double in [0, 1) */
+static double uniform(uint64_t *state) {
+    return (double)(xorshift(state) >> 11) / 9007199254740992.0;
+}
+
+/* 64-bit finalizer mix, truncated like hash_uint32() output */
+static inline uint32_t hash_key(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return (uint32_t)key;
+}
+
+/* ExecHashGetBucketAndBatch */
+static inline void get_bucket_and_batch(const hash_table_t *ht, uint32_t hashvalue,
+                                        uint32_t *bucketno, uint32_t *batchno) {
+    *bucketno = hashvalue & (ht->nbuckets - 1);
+    if (ht->nbatch > 1) {
+        *batchno = ((hashvalue >> ht->log2_nbuckets) |
+                    (hashvalue << (32 - ht->log2_nbuckets))) & (ht->nbatch - 1);
+    } else {
+        *batchno = 0;
+    }
+}
+
+/* Deterministic payload whose first 8 bytes are derived from the key */
+static void fill_payload(unsigned char *payload, size_t size, uint64_t key) {
+    uint64_t value = key * 3 + 1;
+
+    memset(payload, (int)(key & 0xff), size);
+    memcpy(payload, &value, size < sizeof(value) ? size : sizeof(value));
+}
+
+static uint64_t payload_value(const unsigned char *payload, size_t size) {
+    uint64_t value = 0;
+
+    memcpy(&value, payload, size < sizeof(value) ? size : sizeof(value));
+    return value;
+}
+
+/*
+ * Keys
+ *
+ * Inner keys are the even numbers 0, 2, ..., 2 * (rows - 1) in random order.
+ * A matching outer key is 2 * rank with rank drawn from a Zipf(theta)
+ * distribution, so rank 0 is the hottest key; a non-matching one is odd.
+ */
+static uint64_t *make_inner_keys(size_t rows, uint64_t seed) {
+    uint64_t *keys = (uint64_t *)malloc(rows * sizeof(uint64_t));
+    uint64_t tmp;
+    size_t i, j;
+
+    if (!keys) {
+        return NULL;
+    }
+    for (i = 0; i < rows; i++) {
+        keys[i] = 2 * (uint64_t)i;
+    }
+    for (i = rows - 1; i > 0; i--) {
+        j = xorshift(&seed) % (i + 1);
+        tmp = keys[i];
+        keys[i] = keys[j];
+        keys[j] = tmp;
+    }
+    return keys;
+}
+
+static uint64_t *make_outer_keys(size_t rows, size_t inner_rows, double skew, double match_fraction,
+                                 uint64_t seed, uint64_t *expected_matches) {
+    uint64_t *keys = (uint64_t *)malloc(rows * sizeof(uint64_t));
+    double *cdf = NULL;
+    double u, sum = 0.0;
+    size_t i, lo, hi, mid, rank;
+
+    if (!keys) {
+        return NULL;
+    }
+
+    if (skew > 0.0) {
+        cdf = (double *)malloc(inner_rows * sizeof(double));
+        if (!cdf) {
+            free(keys);
+            return NULL;
+        }
+        for (i = 0; i < inner_rows; i++) {
+            sum += 1.0 / pow((double)(i + 1), skew);
+            cdf[i] = sum;
+        }
+        for (i = 0; i < inner_rows; i++) {
+            cdf[i] /= sum;
+        }
+    }
+
+    *expected_matches = 0;
+    for (i = 0; i < rows; i++) {
+        if (uniform(&seed) >= match_fraction) {
+            keys[i] = 2 * (xorshift(&seed) % inner_rows) + 1;
+            continue;
+        }
+
+        if (cdf) {
+            u = uniform(&seed);
+            lo = 0;
+            hi = inner_rows - 1;
+            while (lo < hi) {
+                mid = lo + (hi - lo) / 2;
+                if (cdf[mid] < u) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+            rank = lo;
+        } else {
+            rank = xorshift(&seed) % inner_rows;
+        }
+        keys[i] = 2 * (uint64_t)rank;
+        (*expected_matches)++;
+    }
+
+    free(cdf);
+    return keys;
+}
+
+/* ExecChooseHashTableSize, with NTUP_PER_BUCKET = 1 */
+static bool hash_table_create(hash_table_t *ht, const join_params_t *params) {
+    size_t inner_bytes, per_batch;
+    uint32_t i;
+
+    memset(ht, 0, sizeof(hash_table_t));
+    ht->payload = params->payload;
+    ht->tuple_size = (sizeof(join_tuple_t) + params->payload + 7) & ~(size_t)7;
+
+    inner_bytes = params->build_rows * ht->tuple_size;
+    ht->nbatch = 1;
+    while (inner_bytes / ht->nbatch > params->work_mem_kib * 1024) {
+        ht->nbatch <<= 1;
+    }
+
+    per_batch = params->build_rows / ht->nbatch;
+    ht->nbuckets = MIN_BUCKETS;
+    ht->log2_nbuckets = 10;
+    while (ht->nbuckets < per_batch) {
+        ht->nbuckets <<= 1;
+        ht->log2_nbuckets++;
+    }
+
+    ht->buckets = (join_tuple_t **)calloc(ht->nbuckets, sizeof(join_tuple_t *));
+    ht->inner_files = (FILE **)calloc(ht->nbatch, sizeof(FILE *));
+    ht->outer_files = (FILE **)calloc(ht->nbatch, sizeof(FILE *));
+    if (!ht->buckets || !ht->inner_files || !ht->outer_files) {
+        return false;
+    }
+    for (i = 1; i < ht->nbatch; i++) {
+        ht->inner_files[i] = tmpfile();
+        ht->outer_files[i] = tmpfile();
+        if (!ht->inner_files[i] || !ht->outer_files[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Drop all tuples, keep the bucket array (ExecHashTableReset) */
+static void hash_table_reset(hash_table_t *ht) {
+    hash_chunk_t *chunk, *next;
+
+    for (chunk = ht->chunks; chunk; chunk = next) {
+        next = chunk->next;
+        free(chunk);
+    }
+    ht->chunks = NULL;
+    memset(ht->buckets, 0, ht->nbuckets * sizeof(join_tuple_t *));
+}
+
+static void hash_table_free(hash_table_t *ht) {
+    uint32_t i;
+
+    hash_table_reset(ht);
+    for (i = 1; i < ht->nbatch; i++) {
+        if (ht->inner_files && ht->inner_files[i]) {
+            fclose(ht->inner_files[i]);
+        }
+        if (ht->outer_files && ht->outer_files[i]) {
+            fclose(ht->outer_files[i]);
+        }
+    }
+    free(ht->inner_files);
+    free(ht->outer_files);
+    free(ht->buckets);
+}
+
+/* Allocate a tuple from the current chunk (dense_alloc) */
+static join_tuple_t *dense_alloc(hash_table_t *ht) {
+    hash_chunk_t *chunk = ht->chunks;
+    join_tuple_t *tuple;
+
+    if (!chunk || chunk->used + ht->tuple_size > HASH_CHUNK_SIZE) {
+        chunk = (hash_chunk_t *)malloc(sizeof(hash_chunk_t) + HASH_CHUNK_SIZE);
+        if (!chunk) {
+            return NULL;
+        }
+        chunk->used = 0;
+        chunk->next = ht->chunks;
+        ht->chunks = chunk;
+    }
+    tuple = (join_tuple_t *)(chunk->data + chunk->used);
+    chunk->used += ht->tuple_size;
+    return tuple;
+}
+
+/* ExecHashTableInsert into the current batch */
+static bool hash_table_insert(hash_table_t *ht, uint32_t bucketno, uint32_t hashvalue,
+                              uint64_t key, const unsigned char *payload) {
+    join_tuple_t *tuple = dense_alloc(ht);
+
+    if (!tuple) {
+        return false;
+    }
+    tuple->hashvalue = hashvalue;
+    tuple->key = key;
+    memcpy(tuple->payload, payload, ht->payload);
+    tuple->next = ht->buckets[bucketno];
+    ht->buckets[bucketno] = tuple;
+    return true;
+}
+
+/* ExecHashJoinSaveTuple */
+static void save_tuple(FILE *file, uint32_t hashvalue, uint64_t key,
+                       const unsigned char *payload, size_t size) {
+    spill_header_t header;
+
+    header.hashvalue = hashvalue;
+    header.key = key;
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(payload, 1, size, file);
+}
+
+/* ExecHashJoinGetSavedTuple */
+static bool load_tuple(FILE *file, uint32_t *hashvalue, uint64_t *key,
+                       unsigned char *payload, size_t size) {
+    spill_header_t header;
+
+    if (fread(&header, sizeof(header), 1, file) != 1 || fread(payload, 1, size, file) != size) {
+        return false;
+    }
+    *hashvalue = header.hashvalue;
+    *key = header.key;
+    return true;
+}
+
+/* ExecScanHashBucket: every tuple in the chain is visited */
+static inline void scan_bucket(const hash_table_t *ht, join_tuple_t *tuple, uint32_t hashvalue,
+                               uint64_t key, join_counts_t *counts) {
+    for (; tuple; tuple = tuple->next) {
+        counts->steps++;
+        if (tuple->hashvalue == hashvalue && tuple->key == key) {
+            counts->emitted++;
+            counts->checksum += payload_value(tuple->payload, ht->payload);
+        }
+    }
+}
+
+/*
+ * Probe a group of outer tuples.  With prefetching the bucket headers of the
+ * whole group are requested first, then the first tuple of every chain, so
+ * the cache misses of the group overlap instead of being taken one by one.
+ */
+static void probe_group(const hash_table_t *ht, const uint32_t *hashes, const uint64_t *keys,
+                        int n, bool prefetch, join_counts_t *counts) {
+    join_tuple_t *heads[MAX_PREFETCH_GROUP];
+    int i;
+
+    if (!prefetch) {
+        for (i = 0; i < n; i++) {
+            scan_bucket(ht, ht->buckets[hashes[i] & (ht->nbuckets - 1)], hashes[i], keys[i], counts);
+        }
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        __builtin_prefetch(&ht->buckets[hashes[i] & (ht->nbuckets - 1)]);
+    }
+    for (i = 0; i < n; i++) {
+        heads[i] = ht->buckets[hashes[i] & (ht->nbuckets - 1)];
+        if (heads[i]) {
+            __builtin_prefetch(heads[i]);
+        }
+    }
+    for (i = 0; i < n; i++) {
+        scan_bucket(ht, heads[i], hashes[i], keys[i], counts);
+    }
+}
+
+/* Fold a phase's counts into the context's user counters */
+static void add_counts(perfmon_context_t *ctx, const join_counts_t *counts) {
+    perfmon_user_counter_add(ctx, outer_id, counts->outer);
+    perfmon_user_counter_add(ctx, inner_id, counts->inner);
+    perfmon_user_counter_add(ctx, emitted_id, counts->emitted);
+    perfmon_user_counter_add(ctx, steps_id, counts->steps);
+    perfmon_user_counter_add(ctx, spilled_id, counts->spilled);
+}
+
+/* One line per measured phase */
+static void report(const char *phase, uint32_t batch, const perfmon_stats_t *stats, uint64_t tuples) {
+    perfmon_normalized_t per;
+
+    perfmon_normalize(stats, tuples, &per);
+    printf("%-13s %5u %12lu %10.2f %10.1f %10.1f %9.3f %9.3f\n",
+           phase, batch, tuples, stats->elapsed_time_sec * 1e3,
+           tuples ? stats->elapsed_time_sec * 1e9 / (double)tuples : 0.0,
+           per.cycles_per_unit, per.insn_per_unit, per.cache_misses_per_unit);
+}
+
+/* Build phase: batch 0 into the table, later batches to inner temp files */
+static bool run_build(perfmon_context_t *ctx, perfmon_region_table_t *table, hash_table_t *ht,
+                      const uint64_t *keys, size_t rows) {
+    perfmon_stats_t stats;
+    join_counts_t counts;
+    unsigned char payload[MAX_PAYLOAD];
+    uint32_t hashvalue, bucketno, batchno;
+    size_t i;
+
+    memset(&counts, 0, sizeof(counts));
+    perfmon_start(ctx);
+    for (i = 0; i < rows; i++) {
+        hashvalue = hash_key(keys[i]);
+        get_bucket_and_batch(ht, hashvalue, &bucketno, &batchno);
+        fill_payload(payload, ht->payload, keys[i]);
+        if (batchno == 0) {
+            if (!hash_table_insert(ht, bucketno, hashvalue, keys[i], payload)) {
+                return false;
+            }
+            counts.inner++;
+        } else {
+            save_tuple(ht->inner_files[batchno], hashvalue, keys[i], payload, ht->payload);
+            counts.spilled++;
+        }
+    }
+    add_counts(ctx, &counts);
+    perfmon_stop(ctx, &stats);
+
+    perfmon_region_record(table, &hash_build, &stats);
+    report("hash_build", 0, &stats, rows);
+    return true;
+}
+
+/* Probe batch 0 from the outer keys, spilling tuples of later batches */
+static void run_probe_first(perfmon_context_t *ctx, perfmon_region_table_t *table,
+                            hash_table_t *ht, const join_params_t *params,
+                            const uint64_t *keys, join_counts_t *total) {
+    perfmon_stats_t stats;
+    join_counts_t counts;
+    unsigned char payload[MAX_PAYLOAD];
+    uint32_t hashes[MAX_PREFETCH_GROUP];
+    uint64_t group[MAX_PREFETCH_GROUP];
+    uint32_t hashvalue, bucketno, batchno;
+    int group_size = params->prefetch > 0 ? params->prefetch : 1;
+    int n = 0;
+    size_t i;
+
+    memset(&counts, 0, sizeof(counts));
+    perfmon_start(ctx);
+    for (i = 0; i < params->probe_rows; i++) {
+        hashvalue = hash_key(keys[i]);
+        get_bucket_and_batch(ht, hashvalue, &bucketno, &batchno);
+        if (batchno != 0) {
+            fill_payload(payload, ht->payload, keys[i]);
+            save_tuple(ht->outer_files[batchno], hashvalue, keys[i], payload, ht->payload);
+            counts.spilled++;
+            continue;
+        }
+
+        counts.outer++;
+        hashes[n] = hashvalue;
+        group[n] = keys[i];
+        if (++n == group_size) {
+            probe_group(ht, hashes, group, n, params->prefetch > 0, &counts);
+            n = 0;
+        }
+    }
+    probe_group(ht, hashes, group, n, params->prefetch > 0, &counts);
+    add_counts(ctx, &counts);
+    perfmon_stop(ctx, &stats);
+
+    perfmon_region_record(table, &hash_probe, &stats);
+    report("hash_probe", 0, &stats, params->probe_rows);
+
+    total->emitted += counts.emitted;
+    total->checksum += counts.checksum;
+}
+
+/* ExecHashJoinNewBatch: reload inner batch, then probe its outer file */
+static bool run_batch(perfmon_context_t *ctx, perfmon_region_table_t *table, hash_table_t *ht,
+                      const join_params_t *params, uint32_t batch, join_counts_t *total) {
+    perfmon_stats_t stats;
+    join_counts_t counts;
+    unsigned char payload[MAX_PAYLOAD];
+    uint32_t hashes[MAX_PREFETCH_GROUP];
+    uint64_t group[MAX_PREFETCH_GROUP];
+    uint32_t hashvalue, bucketno, batchno;
+    uint64_t key;
+    int group_size = params->prefetch > 0 ? params->prefetch : 1;
+    int n = 0;
+
+    hash_table_reset(ht);
+    ht->curbatch = batch;
+
+    memset(&counts, 0, sizeof(counts));
+    perfmon_start(ctx);
+    rewind(ht->inner_files[batch]);
+    while (load_tuple(ht->inner_files[batch], &hashvalue, &key, payload, ht->payload)) {
+        get_bucket_and_batch(ht, hashvalue, &bucketno, &batchno);
+        if (!hash_table_insert(ht, bucketno, hashvalue, key, payload)) {
+            return false;
+        }
+        counts.inner++;
+    }
+    add_counts(ctx, &counts);
+    perfmon_stop(ctx, &stats);
+
+    perfmon_region_record(table, &batch_reload, &stats);
+    report("batch_reload", batch, &stats, counts.inner);
+
+    memset(&counts, 0, sizeof(counts));
+    perfmon_start(ctx);
+    rewind(ht->outer_files[batch]);
+    while (load_tuple(ht->outer_files[batch], &hashvalue, &key, payload, ht->payload)) {
+        counts.outer++;
+        hashes[n] = hashvalue;
+        group[n] = key;
+        if (++n == group_size) {
+            probe_group(ht, hashes, group, n, params->prefetch > 0, &counts);
+            n = 0;
+        }
+    }
+    probe_group(ht, hashes, group, n, params->prefetch > 0, &counts);
+    add_counts(ctx, &counts);
+    perfmon_stop(ctx, &stats);
+
+    perfmon_region_record(table, &hash_probe, &stats);
+    report("hash_probe", batch, &stats, counts.outer);
+
+    total->emitted += counts.emitted;
+    total->checksum += counts.checksum;
+    return true;
+}
+
+/* Inner row of the nested-loop benchmark */
+typedef struct {
+    uint64_t key;
+    unsigned char payload[];
+} nl_row_t;
+
+/* Sorted index entry: key and position of its row */
+typedef struct {
+    uint64_t key;
+    size_t row;
+} nl_index_entry_t;
+
+static int compare_index_entries(const void *a, const void *b) {
+    uint64_t x = ((const nl_index_entry_t *)a)->key, y = ((const nl_index_entry_t *)b)->key;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Nested loop: full inner rescans, then index lookups */
+static bool run_nested_loop(perfmon_context_t *ctx, perfmon_region_table_t *table,
+                            const join_params_t *params) {
+    perfmon_stats_t stats;
+    join_counts_t counts;
+    uint64_t *inner_keys, *outer_keys, expected, checksum;
+    nl_index_entry_t *index;
+    unsigned char *rows;
+    const nl_row_t *row;
+    size_t row_size = (sizeof(nl_row_t) + params->payload + 7) & ~(size_t)7;
+    size_t i, j, lo, hi, mid;
+    bool ok = false;
+
+    inner_keys = make_inner_keys(params->nl_inner_rows, 0x5851f42d4c957f2dULL);
+    outer_keys = make_outer_keys(params->nl_outer_rows, params->nl_inner_rows, params->skew,
+                                 params->match_fraction, 0x14057b7ef767814fULL, &expected);
+    rows = (unsigned char *)malloc(params->nl_inner_rows * row_size);
+    index = (nl_index_entry_t *)malloc(params->nl_inner_rows * sizeof(nl_index_entry_t));
+    if (!inner_keys || !outer_keys || !rows || !index) {
+        goto out;
+    }
+
+    for (i = 0; i < params->nl_inner_rows; i++) {
+        nl_row_t *r = (nl_row_t *)(rows + i * row_size);
+
+        r->key = inner_keys[i];
+        fill_payload(r->payload, params->payload, inner_keys[i]);
+        index[i].key = inner_keys[i];
+        index[i].row = i;
+    }
+    qsort(index, params->nl_inner_rows, sizeof(nl_index_entry_t), compare_index_entries);
+
+    /* ExecReScan of a sequential scan for every outer tuple */
+    memset(&counts, 0, sizeof(counts));
+    perfmon_start(ctx);
+    for (i = 0; i < params->nl_outer_rows; i++) {
+        counts.outer++;
+        for (j = 0; j < params->nl_inner_rows; j++) {
+            row = (const nl_row_t *)(rows + j * row_size);
+            counts.inner++;
+            if (row->key == outer_keys[i]) {
+                counts.emitted++;
+                counts.checksum += payload_value(row->payload, params->payload);
+            }
+        }
+    }
+    add_counts(ctx, &counts);
+    perfmon_stop(ctx, &stats);
+    checksum = counts.checksum;
+
+    perfmon_region_record(table, &nl_rescan, &stats);
+    report("nl_rescan", 0, &stats, counts.outer);
+    if (counts.emitted != expected) {
+        fprintf(stderr, "nl_rescan: %lu rows emitted, expected %lu\n", counts.emitted, expected);
+        goto out;
+    }
+
+    /* Index scan: descend the sorted index, then fetch the heap row */
+    memset(&counts, 0, sizeof(counts));
+    perfmon_start(ctx);
+    for (i = 0; i < params->nl_outer_rows; i++) {
+        counts.outer++;
+        lo = 0;
+        hi = params->nl_inner_rows;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            counts.steps++;
+            if (index[mid].key < outer_keys[i]) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        for (; lo < params->nl_inner_rows && index[lo].key == outer_keys[i]; lo++) {
+            row = (const nl_row_t *)(rows + index[lo].row * row_size);
+            counts.inner++;
+            counts.emitted++;
+            counts.checksum += payload_value(row->payload, params->payload);
+        }
+    }
+    add_counts(ctx, &counts);
+    perfmon_stop(ctx, &stats);
+
+    perfmon_region_record(table, &nl_index, &stats);
+    report("nl_index", 0, &stats, counts.outer);
+    if (counts.emitted != expected || counts.checksum != checksum) {
+        fprintf(stderr, "nl_index: %lu rows emitted, expected %lu\n", counts.emitted, expected);
+        goto out;
+    }
+    ok = true;
+
+out:
+    free(index);
+    free(rows);
+    free(outer_keys);
+    free(inner_keys);
+    return ok;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-b rows] [-p rows] [-s theta] [-m frac] [-w kib] [-t bytes] [-f n]\n"
+            "          [-n rows] [-i rows]\n"
+            "  -b  inner (build) rows                            (1000000)\n"
+            "  -p  outer (probe) rows                            (4000000)\n"
+            "  -s  Zipf skew of matching outer keys, 0 = uniform (0)\n"
+            "  -m  fraction of outer rows that find a match      (1.0)\n"
+            "  -w  work_mem in KiB                               (65536)\n"
+            "  -t  payload bytes per tuple                       (32)\n"
+            "  -f  probe in groups of n with prefetch, 0 = off   (0)\n"
+            "  -n  nested-loop outer rows                        (2000)\n"
+            "  -i  nested-loop inner rows                        (50000)\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    join_params_t params;
+    perfmon_context_t *ctx;
+    perfmon_region_table_t *table;
+    perfmon_host_t host;
+    hash_table_t ht;
+    join_counts_t total;
+    uint64_t *inner_keys, *outer_keys, expected;
+    uint32_t batch;
+    int opt, status = 1;
+
+    params.build_rows = 1000000;
+    params.probe_rows = 4000000;
+    params.skew = 0.0;
+    params.match_fraction = 1.0;
+    params.work_mem_kib = 65536;
+    params.payload = 32;
+    params.prefetch = 0;
+    params.nl_outer_rows = 2000;
+    params.nl_inner_rows = 50000;
+
+    while ((opt = getopt(argc, argv, "b:p:s:m:w:t:f:n:i:h")) != -1) {
+        switch (opt) {
+        case 'b': params.build_rows = strtoul(optarg, NULL, 10); break;
+        case 'p': params.probe_rows = strtoul(optarg, NULL, 10); break;
+        case 's': params.skew = atof(optarg); break;
+        case 'm': params.match_fraction = atof(optarg); break;
+        case 'w': params.work_mem_kib = strtoul(optarg, NULL, 10); break;
+        case 't': params.payload = strtoul(optarg, NULL, 10); break;
+        case 'f': params.prefetch = atoi(optarg); break;
+        case 'n': params.nl_outer_rows = strtoul(optarg, NULL, 10); break;
+        case 'i': params.nl_inner_rows = strtoul(optarg, NULL, 10); break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (params.build_rows == 0 || params.nl_inner_rows == 0 || params.work_mem_kib == 0 ||
+        params.payload > MAX_PAYLOAD || params.prefetch < 0 ||
+        params.prefetch > MAX_PREFETCH_GROUP) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    printf("libperfmon - Join Benchmark\n");
+    printf("===========================\n");
+
+    /* Which machine produced the numbers below */
+    perfmon_host_info(&host);
+    fflush(stdout);
+    perfmon_print_host(&host, STDOUT_FILENO);
+    printf("\n");
+
+    outer_id = perfmon_user_counter_register("outer_tuples");
+    inner_id = perfmon_user_counter_register("inner_tuples");
+    emitted_id = perfmon_user_counter_register("emitted_tuples");
+    steps_id = perfmon_user_counter_register("chain_steps");
+    spilled_id = perfmon_user_counter_register("spilled_tuples");
+
+    ctx = perfmon_init();
+    table = perfmon_region_table_create();
+    if (!ctx || !table) {
+        fprintf(stderr, "Failed to initialize perfmon: %s\n", perfmon_get_error());
+        return 1;
+    }
+
+    inner_keys = make_inner_keys(params.build_rows, 0x9e3779b97f4a7c15ULL);
+    outer_keys = make_outer_keys(params.probe_rows, params.build_rows, params.skew,
+                                 params.match_fraction, 0x2545f4914f6cdd1dULL, &expected);
+    if (!inner_keys || !outer_keys || !hash_table_create(&ht, &params)) {
+        fprintf(stderr, "Failed to allocate join data\n");
+        return 1;
+    }
+
+    printf("inner %zu rows, outer %zu rows, skew %.2f, match fraction %.2f, payload %zu bytes\n",
+           params.build_rows, params.probe_rows, params.skew, params.match_fraction, params.payload);
+    printf("work_mem %zu KiB: %u batches, %u buckets, prefetch group %d\n\n",
+           params.work_mem_kib, ht.nbatch, ht.nbuckets, params.prefetch);
+
+    printf("%-13s %5s %12s %10s %10s %10s %9s %9s\n",
+           "Phase", "Batch", "Tuples", "Time(ms)", "ns/tuple", "cyc/tuple", "ins/tuple", "LLC/tuple");
+    printf("%-13s %5s %12s %10s %10s %10s %9s %9s\n",
+           "-----", "-----", "------", "--------", "--------", "---------", "---------", "---------");
+
+    memset(&total, 0, sizeof(total));
+    if (!run_build(ctx, table, &ht, inner_keys, params.build_rows)) {
+        fprintf(stderr, "Out of memory building the hash table\n");
+        goto out;
+    }
+    run_probe_first(ctx, table, &ht, &params, outer_keys, &total);
+    for (batch = 1; batch < ht.nbatch; batch++) {
+        if (!run_batch(ctx, table, &ht, &params, batch, &total)) {
+            fprintf(stderr, "Out of memory reloading batch %u\n", batch);
+            goto out;
+        }
+    }
+    if (total.emitted != expected) {
+        fprintf(stderr, "Hash join emitted %lu rows, expected %lu\n", total.emitted, expected);
+        goto out;
+    }
+
+    if (params.nl_outer_rows > 0 && !run_nested_loop(ctx, table, &params)) {
+        goto out;
+    }
+
+    printf("\nHash join emitted %lu rows (checksum %016lx)\n", total.emitted, total.checksum);
+    fflush(stdout);
+    perfmon_region_table_print(table, STDOUT_FILENO);
+    status = 0;
+
+out:
+    hash_table_free(&ht);
+    free(outer_keys);
+    free(inner_keys);
+    perfmon_region_table_free(table);
+    perfmon_cleanup(ctx);
+    return status;
+}
@@ -0,0 +1,97 @@
+/*
+ * Instrumentation level benchmark
+ *
+ * Runs the same hash-probe kernel uninstrumented, instrumented with
+ * PERFMON_LEVEL=0 and instrumented with fine regions enabled, and compares
+ * instruction counts.  The level-0 build must retire the same instructions as
+ * the uninstrumented one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "perfmon.h"
+
+#define TABLE_SIZE   (1UL << 22)
+#define PROBES       (1UL << 24)
+#define BATCH        1024
+
+/* Allowed instruction count difference between plain and level 0 runs (%) */
+#define MAX_DIFF_PCT 0.1
+
+typedef uint64_t (*kernel_fn)(perfmon_context_t *ctx, const uint64_t *table, size_t table_size,
+                              size_t probes, size_t batch, uint64_t *region_cycles);
+
+uint64_t kernel_plain(perfmon_context_t *, const uint64_t *, size_t, size_t, size_t, uint64_t *);
+uint64_t kernel_off(perfmon_context_t *, const uint64_t *, size_t, size_t, size_t, uint64_t *);
+uint64_t kernel_on(perfmon_context_t *, const uint64_t *, size_t, size_t, size_t, uint64_t *);
+
+/* Run one kernel variant under an outer measurement */
+static void run_variant(const char *name, kernel_fn fn, perfmon_context_t *outer,
+                        perfmon_context_t *inner, const uint64_t *table,
+                        perfmon_stats_t *stats) {
+    uint64_t region_cycles = 0;
+    volatile uint64_t sink;
+
+    perfmon_start(outer);
+    sink = fn(inner, table, TABLE_SIZE, PROBES, BATCH, &region_cycles);
+    perfmon_stop(outer, stats);
+    (void)sink;
+
+    printf("%-14s %15lu  %15lu  %10.6f\n",
+           name, stats->instructions, stats->cycles, stats->elapsed_time_sec);
+}
+
+int main(void) {
+    perfmon_context_t *outer, *inner;
+    perfmon_stats_t plain, off, on;
+    uint64_t *table;
+    size_t i;
+    double diff_pct;
+
+    printf("libperfmon - Instrumentation Level Benchmark\n");
+    printf("=============================================\n\n");
+
+    outer = perfmon_init();
+    inner = perfmon_init();
+    if (!outer || !inner) {
+        fprintf(stderr, "Failed to initialize perfmon: %s\n", perfmon_get_error());
+        return 1;
+    }
+
+    table = malloc(TABLE_SIZE * sizeof(uint64_t));
+    if (!table) {
+        fprintf(stderr, "Failed to allocate table\n");
+        return 1;
+    }
+    for (i = 0; i < TABLE_SIZE; i++) {
+        table[i] = i;
+    }
+
+    printf("Variant           Instructions           Cycles     Time(s)\n");
+    printf("-------           ------------           ------     -------\n");
+    run_variant("uninstrumented", kernel_plain, outer, inner, table, &plain);
+    run_variant("level 0", kernel_off, outer, inner, table, &off);
+    run_variant("level 3", kernel_on, outer, inner, table, &on);
+
+    free(table);
+    perfmon_cleanup(inner);
+    perfmon_cleanup(outer);
+
+    if (plain.instructions == 0) {
+        printf("\nInstruction counter unavailable; run 'make check-levels' for the "
+               "static comparison.\n");
+        return 0;
+    }
+
+    diff_pct = ((double)off.instructions - (double)plain.instructions) /
+               (double)plain.instructions * 100.0;
+    printf("\nlevel 0 vs uninstrumented: %+.4f%% instructions\n", diff_pct);
+    if (diff_pct > MAX_DIFF_PCT || diff_pct < -MAX_DIFF_PCT) {
+        printf("FAIL: disabled instrumentation changes the instruction count\n");
+        return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,54 @@
+/*
+ * Kernel for the instrumentation level benchmark
+ *
+ * Compiled several times by the Makefile:
+ *   bench_levels_on.o     instrumented, PERFMON_LEVEL=3 (default)
+ *   bench_levels_off.o    instrumented, PERFMON_LEVEL=0
+ *   bench_levels_plain.o  no instrumentation at all (BENCH_UNINSTRUMENTED)
+ *
+ * BENCH_KERNEL names the function so all variants can be linked together.
+ * 'make check-levels' compares the off and plain disassembly instruction by
+ * instruction.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "perfmon.h"
+
+uint64_t BENCH_KERNEL(perfmon_context_t *ctx, const uint64_t *table, size_t table_size,
+                      size_t probes, size_t batch, uint64_t *region_cycles);
+
+/* Hash-probe loop with a fine-grained region around every batch */
+uint64_t BENCH_KERNEL(perfmon_context_t *ctx, const uint64_t *table, size_t table_size,
+                      size_t probes, size_t batch, uint64_t *region_cycles) {
+    uint64_t sum = 0;
+    uint64_t x = 88172645463325252ULL;
+    size_t i, j;
+#ifndef BENCH_UNINSTRUMENTED
+    PERFMON_AT_FINE(perfmon_stats_t stats;)
+#endif
+
+    (void)ctx;
+    (void)region_cycles;
+
+    for (i = 0; i < probes; i += batch) {
+#ifndef BENCH_UNINSTRUMENTED
+        perfmon_level_start(PERFMON_LEVEL_FINE, ctx);
+#endif
+        for (j = 0; j < batch; j++) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            sum += table[x & (table_size - 1)];
+        }
+#ifndef BENCH_UNINSTRUMENTED
+        PERFMON_AT_FINE(
+            if (perfmon_level_stop(PERFMON_LEVEL_FINE, ctx, &stats)) {
+                *region_cycles += stats.cycles;
+            }
+        )
+#endif
+    }
+
+    return sum;
+}
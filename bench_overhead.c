@@ -0,0 +1,368 @@
+/*
+ * Measurement overhead benchmark
+ *
+ * Times every operation of every measurement mode and reports the latency
+ * distribution in nanoseconds per operation:
+ *
+ *   per-fd   perfmon_init/start/stop/read/reset (one syscall per counter)
+ *   grouped  perfmon_fast_* group ioctls and one PERF_FORMAT_GROUP read()
+ *   rdpmc    perfmon_fast_sample() (rdpmc, read() fallback per event)
+ *   tsc      perfmon_fast_rdtsc() only
+ *
+ * across counter counts and thread counts.  Each operation is timed
+ * individually with CLOCK_MONOTONIC; the median cost of an empty timing
+ * pair is subtracted.
+ *
+ * Usage: bench_overhead [iterations]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "perfmon.h"
+#include "perfmon_fast.h"
+
+#define DEFAULT_ITERATIONS  10000
+#define INIT_ITERATIONS     200
+#define MAX_THREADS         4
+
+typedef enum {
+    MODE_PER_FD = 0,
+    MODE_GROUPED,
+    MODE_RDPMC,
+    MODE_TSC,
+    NR_MODES
+} bench_mode_t;
+
+typedef enum {
+    OP_INIT = 0,
+    OP_START,
+    OP_STOP,
+    OP_READ,
+    OP_RESET,
+    NR_OPS
+} bench_op_t;
+
+static const char *mode_names[NR_MODES] = {"per-fd", "grouped", "rdpmc", "tsc"};
+static const char *op_names[NR_OPS] = {"init", "start", "stop", "read", "reset"};
+
+/* Counters that can be opened here, in perfmon_counter_type_t order */
+static perfmon_counter_type_t available[PERFMON_MAX_COUNTERS];
+static int nr_available = 0;
+
+/* Whether the first counter can be read with rdpmc */
+static bool rdpmc_usable = false;
+
+/* Median cost of an empty timing pair */
+static uint64_t timer_overhead_ns = 0;
+
+/* One thread's share of a run */
+typedef struct {
+    bench_mode_t mode;
+    int nr_counters;
+    int iterations;
+    uint64_t *samples[NR_OPS];
+    int nr_samples[NR_OPS];
+    pthread_barrier_t *barrier;
+} bench_job_t;
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Record one timed operation */
+static inline void record(bench_job_t *job, bench_op_t op, uint64_t start, uint64_t end) {
+    uint64_t ns = end - start;
+
+    job->samples[op][job->nr_samples[op]++] = ns > timer_overhead_ns ? ns - timer_overhead_ns : 0;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Find the counters this machine lets us open */
+static void detect_counters(void) {
+    perfmon_fast_t fast;
+    perfmon_counter_type_t type;
+    int i;
+
+    for (i = 0; i < PERFMON_MAX_COUNTERS; i++) {
+        type = (perfmon_counter_type_t)i;
+        if (perfmon_fast_open(&fast, &type, 1)) {
+            if (nr_available == 0) {
+                rdpmc_usable = fast.pages[0] && fast.pages[0]->cap_user_rdpmc;
+            }
+            available[nr_available++] = type;
+            perfmon_fast_close(&fast);
+        }
+    }
+}
+
+/* Measure the timer itself */
+static void calibrate_timer(void) {
+    uint64_t samples[1001], start;
+    int i;
+
+    for (i = 0; i < 1001; i++) {
+        start = now_ns();
+        samples[i] = now_ns() - start;
+    }
+    qsort(samples, 1001, sizeof(uint64_t), compare_u64);
+    timer_overhead_ns = samples[500];
+}
+
+/* per-fd mode: the regular context API with nr_counters enabled */
+static void run_per_fd(bench_job_t *job) {
+    perfmon_context_t *ctx;
+    perfmon_stats_t stats;
+    uint64_t t0, t1;
+    bool keep;
+    int i, j;
+
+    for (i = 0; i < INIT_ITERATIONS; i++) {
+        t0 = now_ns();
+        ctx = perfmon_init();
+        t1 = now_ns();
+        record(job, OP_INIT, t0, t1);
+        perfmon_cleanup(ctx);
+    }
+
+    ctx = perfmon_init();
+    if (!ctx) {
+        return;
+    }
+    for (i = 0; i < PERFMON_MAX_COUNTERS; i++) {
+        keep = false;
+        for (j = 0; j < job->nr_counters; j++) {
+            keep = keep || available[j] == (perfmon_counter_type_t)i;
+        }
+        if (!keep) {
+            perfmon_disable_counter(ctx, (perfmon_counter_type_t)i);
+        }
+    }
+
+    for (i = 0; i < job->iterations; i++) {
+        t0 = now_ns();
+        perfmon_start(ctx);
+        t1 = now_ns();
+        record(job, OP_START, t0, t1);
+
+        t0 = now_ns();
+        perfmon_read(ctx, &stats);
+        t1 = now_ns();
+        record(job, OP_READ, t0, t1);
+
+        t0 = now_ns();
+        perfmon_reset(ctx);
+        t1 = now_ns();
+        record(job, OP_RESET, t0, t1);
+
+        t0 = now_ns();
+        perfmon_stop(ctx, &stats);
+        t1 = now_ns();
+        record(job, OP_STOP, t0, t1);
+    }
+
+    perfmon_cleanup(ctx);
+}
+
+/* grouped and rdpmc modes: the inline fast path */
+static void run_fast(bench_job_t *job) {
+    perfmon_fast_t fast;
+    perfmon_fast_sample_t sample;
+    uint64_t t0, t1;
+    int i;
+
+    for (i = 0; i < INIT_ITERATIONS; i++) {
+        t0 = now_ns();
+        if (!perfmon_fast_open(&fast, available, job->nr_counters)) {
+            return;
+        }
+        t1 = now_ns();
+        record(job, OP_INIT, t0, t1);
+        perfmon_fast_close(&fast);
+    }
+
+    if (!perfmon_fast_open(&fast, available, job->nr_counters)) {
+        return;
+    }
+
+    for (i = 0; i < job->iterations; i++) {
+        t0 = now_ns();
+        perfmon_fast_enable(&fast);
+        t1 = now_ns();
+        record(job, OP_START, t0, t1);
+
+        if (job->mode == MODE_GROUPED) {
+            t0 = now_ns();
+            perfmon_fast_read_group(&fast, &sample);
+            t1 = now_ns();
+        } else {
+            t0 = now_ns();
+            perfmon_fast_sample(&fast, &sample);
+            t1 = now_ns();
+        }
+        record(job, OP_READ, t0, t1);
+
+        t0 = now_ns();
+        perfmon_fast_reset(&fast);
+        t1 = now_ns();
+        record(job, OP_RESET, t0, t1);
+
+        t0 = now_ns();
+        perfmon_fast_disable(&fast);
+        t1 = now_ns();
+        record(job, OP_STOP, t0, t1);
+    }
+
+    perfmon_fast_close(&fast);
+}
+
+/* tsc mode: a timestamp is the only operation */
+static void run_tsc(bench_job_t *job) {
+    volatile uint64_t sink;
+    uint64_t t0, t1;
+    int i;
+
+    for (i = 0; i < job->iterations; i++) {
+        t0 = now_ns();
+        sink = perfmon_fast_rdtsc();
+        t1 = now_ns();
+        record(job, OP_READ, t0, t1);
+    }
+    (void)sink;
+}
+
+static void *bench_thread(void *arg) {
+    bench_job_t *job = (bench_job_t *)arg;
+
+    pthread_barrier_wait(job->barrier);
+
+    switch (job->mode) {
+    case MODE_PER_FD:
+        run_per_fd(job);
+        break;
+    case MODE_GROUPED:
+    case MODE_RDPMC:
+        run_fast(job);
+        break;
+    case MODE_TSC:
+        run_tsc(job);
+        break;
+    default:
+        break;
+    }
+    return NULL;
+}
+
+/* Run one configuration on nr_threads threads and print its distribution */
+static void run_config(bench_mode_t mode, int nr_counters, int nr_threads, int iterations) {
+    bench_job_t jobs[MAX_THREADS];
+    pthread_t threads[MAX_THREADS];
+    pthread_barrier_t barrier;
+    uint64_t *merged;
+    size_t n;
+    int t, op;
+
+    pthread_barrier_init(&barrier, NULL, (unsigned)nr_threads);
+
+    for (t = 0; t < nr_threads; t++) {
+        memset(&jobs[t], 0, sizeof(bench_job_t));
+        jobs[t].mode = mode;
+        jobs[t].nr_counters = nr_counters;
+        jobs[t].iterations = iterations;
+        jobs[t].barrier = &barrier;
+        for (op = 0; op < NR_OPS; op++) {
+            jobs[t].samples[op] = (uint64_t *)malloc((size_t)iterations * sizeof(uint64_t));
+        }
+        pthread_create(&threads[t], NULL, bench_thread, &jobs[t]);
+    }
+    for (t = 0; t < nr_threads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    pthread_barrier_destroy(&barrier);
+
+    merged = (uint64_t *)malloc((size_t)nr_threads * iterations * sizeof(uint64_t));
+    for (op = 0; op < NR_OPS; op++) {
+        n = 0;
+        for (t = 0; t < nr_threads; t++) {
+            memcpy(merged + n, jobs[t].samples[op], (size_t)jobs[t].nr_samples[op] * sizeof(uint64_t));
+            n += (size_t)jobs[t].nr_samples[op];
+        }
+        if (n == 0) {
+            continue;
+        }
+
+        qsort(merged, n, sizeof(uint64_t), compare_u64);
+        printf("%-8s  %8d  %7d  %-6s  %9lu  %9lu  %9lu  %9lu  %9lu\n",
+               mode_names[mode], nr_counters, nr_threads, op_names[op],
+               merged[n / 2], merged[(n - 1) * 90 / 100], merged[(n - 1) * 99 / 100],
+               merged[(n - 1) * 999 / 1000], merged[n - 1]);
+    }
+
+    free(merged);
+    for (t = 0; t < nr_threads; t++) {
+        for (op = 0; op < NR_OPS; op++) {
+            free(jobs[t].samples[op]);
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const int counter_counts[] = {1, 4, PERFMON_FAST_MAX_EVENTS};
+    const int thread_counts[] = {1, 2, MAX_THREADS};
+    int iterations = DEFAULT_ITERATIONS;
+    int mode, c, t, nr_counters, last;
+
+    if (argc > 1) {
+        iterations = atoi(argv[1]);
+        if (iterations < INIT_ITERATIONS) {
+            iterations = INIT_ITERATIONS;
+        }
+    }
+
+    printf("libperfmon - Measurement Overhead Benchmark\n");
+    printf("============================================\n\n");
+
+    detect_counters();
+    if (nr_available == 0) {
+        fprintf(stderr, "No counters can be opened: %s\n", perfmon_get_error());
+        return 1;
+    }
+    calibrate_timer();
+
+    printf("%d counters available, %d iterations per configuration, "
+           "timer overhead %lu ns subtracted\n", nr_available, iterations, timer_overhead_ns);
+    printf("rdpmc %s\n\n", rdpmc_usable ? "available" : "unavailable (rdpmc mode falls back to read())");
+    printf("Mode      Counters  Threads  Op            p50        p90        p99      p99.9        max  (ns)\n");
+    printf("--------  --------  -------  ------  ---------  ---------  ---------  ---------  ---------\n");
+
+    for (mode = 0; mode < NR_MODES; mode++) {
+        last = 0;
+        for (c = 0; c < (int)(sizeof(counter_counts) / sizeof(counter_counts[0])); c++) {
+            nr_counters = counter_counts[c] < nr_available ? counter_counts[c] : nr_available;
+            if (mode == MODE_TSC) {
+                nr_counters = 0;
+            }
+            if (c > 0 && nr_counters == last) {
+                continue;
+            }
+            last = nr_counters;
+
+            for (t = 0; t < (int)(sizeof(thread_counts) / sizeof(thread_counts[0])); t++) {
+                run_config((bench_mode_t)mode, nr_counters, thread_counts[t], iterations);
+            }
+        }
+    }
+
+    return 0;
+}
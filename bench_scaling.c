@@ -0,0 +1,308 @@
+/*
+ * Thread-scaling and fd-limit stress benchmark
+ *
+ * Part 1 runs 1, 2, 4, ... up to all online CPUs threads; every thread owns a
+ * context and runs start/stop cycles back to back.  Reported per thread
+ * count: aggregate cycles per second, mean latency of one start+stop pair,
+ * the share of thread CPU time spent in the kernel, and file descriptors
+ * held by the process while all contexts are open.
+ *
+ * Part 2 raises RLIMIT_NOFILE to its hard limit and keeps creating contexts
+ * on one thread until the limit is hit (or the requested number is reached),
+ * timing init and a start+stop pair at every power of two.  A context created
+ * while descriptors run out is silently missing counters, so the run stops at
+ * the first context after which no descriptor is left.
+ *
+ * Usage: bench_scaling [-t max_threads] [-c cycles_per_thread] [-n max_contexts]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "perfmon.h"
+
+#define DEFAULT_CYCLES      1000000
+#define DEFAULT_CONTEXTS    65536
+#define MAX_TIMED_CONTEXTS  64
+
+/* One thread of a scaling run */
+typedef struct {
+    int cycles;
+    pthread_barrier_t *ready;
+    pthread_barrier_t *opened;
+    pthread_barrier_t *measured;
+    double elapsed_sec;
+    double user_sec;
+    double sys_sec;
+    bool ok;
+} scaling_job_t;
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static double timeval_sec(const struct timeval *tv) {
+    return (double)tv->tv_sec + (double)tv->tv_usec / 1e6;
+}
+
+/* Number of open descriptors of this process */
+static int count_fds(void) {
+    DIR *dir = opendir("/proc/self/fd");
+    struct dirent *entry;
+    int n = 0;
+
+    if (!dir) {
+        return -1;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            n++;
+        }
+    }
+    closedir(dir);
+    return n - 1;   /* the directory stream itself */
+}
+
+/* True if at least one more descriptor can be opened */
+static bool fd_available(void) {
+    int fd = open("/dev/null", O_RDONLY);
+
+    if (fd == -1) {
+        return false;
+    }
+    close(fd);
+    return true;
+}
+
+static void *scaling_thread(void *arg) {
+    scaling_job_t *job = (scaling_job_t *)arg;
+    perfmon_context_t *ctx;
+    perfmon_stats_t stats;
+    struct rusage before, after;
+    uint64_t t0;
+    int i;
+
+    pthread_barrier_wait(job->ready);
+    ctx = perfmon_init();
+    job->ok = ctx != NULL;
+
+    /* Every thread holds its context while descriptors are counted */
+    pthread_barrier_wait(job->opened);
+    pthread_barrier_wait(job->measured);
+
+    if (ctx) {
+        getrusage(RUSAGE_THREAD, &before);
+        t0 = now_ns();
+        for (i = 0; i < job->cycles; i++) {
+            perfmon_start(ctx);
+            perfmon_stop(ctx, &stats);
+        }
+        job->elapsed_sec = (double)(now_ns() - t0) / 1e9;
+        getrusage(RUSAGE_THREAD, &after);
+
+        job->user_sec = timeval_sec(&after.ru_utime) - timeval_sec(&before.ru_utime);
+        job->sys_sec = timeval_sec(&after.ru_stime) - timeval_sec(&before.ru_stime);
+        perfmon_cleanup(ctx);
+    }
+    return NULL;
+}
+
+/* Run one thread count and print a row */
+static void run_scaling(int nr_threads, int cycles, int base_fds) {
+    scaling_job_t *jobs = (scaling_job_t *)calloc((size_t)nr_threads, sizeof(scaling_job_t));
+    pthread_t *threads = (pthread_t *)calloc((size_t)nr_threads, sizeof(pthread_t));
+    pthread_barrier_t ready, opened, measured;
+    double wall, busy = 0.0, user = 0.0, sys = 0.0;
+    uint64_t t0;
+    int t, fds, ok = 0;
+
+    if (!jobs || !threads) {
+        free(jobs);
+        free(threads);
+        return;
+    }
+
+    pthread_barrier_init(&ready, NULL, (unsigned)nr_threads + 1);
+    pthread_barrier_init(&opened, NULL, (unsigned)nr_threads + 1);
+    pthread_barrier_init(&measured, NULL, (unsigned)nr_threads + 1);
+    for (t = 0; t < nr_threads; t++) {
+        jobs[t].cycles = cycles;
+        jobs[t].ready = &ready;
+        jobs[t].opened = &opened;
+        jobs[t].measured = &measured;
+        pthread_create(&threads[t], NULL, scaling_thread, &jobs[t]);
+    }
+
+    pthread_barrier_wait(&ready);
+    pthread_barrier_wait(&opened);
+    fds = count_fds() - base_fds;
+    t0 = now_ns();
+    pthread_barrier_wait(&measured);
+    for (t = 0; t < nr_threads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    wall = (double)(now_ns() - t0) / 1e9;
+
+    pthread_barrier_destroy(&ready);
+    pthread_barrier_destroy(&opened);
+    pthread_barrier_destroy(&measured);
+
+    for (t = 0; t < nr_threads; t++) {
+        if (jobs[t].ok) {
+            ok++;
+            busy += jobs[t].elapsed_sec;
+            user += jobs[t].user_sec;
+            sys += jobs[t].sys_sec;
+        }
+    }
+    if (ok == 0) {
+        printf("%7d  perfmon_init failed: %s\n", nr_threads, perfmon_get_error());
+    } else {
+        printf("%7d  %10d  %9.3f  %14.0f  %10.1f  %6.1f%%  %6d  %7.1f\n",
+               nr_threads, cycles, wall, (double)ok * cycles / wall,
+               busy * 1e9 / ((double)ok * cycles),
+               user + sys > 0.0 ? sys / (user + sys) * 100.0 : 0.0,
+               fds, (double)fds / ok);
+    }
+
+    free(jobs);
+    free(threads);
+}
+
+/* Mean start+stop latency over up to MAX_TIMED_CONTEXTS live contexts, spread evenly */
+static double round_robin_ns(perfmon_context_t **contexts, int n) {
+    perfmon_stats_t stats;
+    uint64_t t0;
+    int i, step = n > MAX_TIMED_CONTEXTS ? n / MAX_TIMED_CONTEXTS : 1, timed = 0;
+
+    t0 = now_ns();
+    for (i = 0; i < n; i += step) {
+        perfmon_start(contexts[i]);
+        perfmon_stop(contexts[i], &stats);
+        timed++;
+    }
+    return (double)(now_ns() - t0) / timed;
+}
+
+/* Open contexts until the descriptor limit or max_contexts */
+static void run_fd_limit(int max_contexts) {
+    perfmon_context_t **contexts;
+    struct rlimit limit;
+    uint64_t t0, init_ns = 0;
+    int n = 0, last = 0, base_fds, fds, checkpoint = 1;
+    bool exhausted = false;
+
+    getrlimit(RLIMIT_NOFILE, &limit);
+    printf("RLIMIT_NOFILE soft %llu, hard %llu", (unsigned long long)limit.rlim_cur,
+           (unsigned long long)limit.rlim_max);
+    if (limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &limit) == 0) {
+            printf(" (soft raised to %llu)", (unsigned long long)limit.rlim_cur);
+        }
+    }
+    printf("\n\n");
+
+    contexts = (perfmon_context_t **)calloc((size_t)max_contexts, sizeof(perfmon_context_t *));
+    if (!contexts) {
+        return;
+    }
+
+    printf("%9s  %8s  %7s  %10s  %14s\n", "Contexts", "fds", "fds/ctx", "init(us)", "start+stop(ns)");
+    printf("%9s  %8s  %7s  %10s  %14s\n", "--------", "---", "-------", "--------", "--------------");
+
+    base_fds = count_fds();
+    while (n < max_contexts && !exhausted) {
+        t0 = now_ns();
+        contexts[n] = perfmon_init();
+        init_ns += now_ns() - t0;
+        if (!contexts[n]) {
+            break;
+        }
+        n++;
+        exhausted = !fd_available();
+
+        if (n == checkpoint || n == max_contexts || exhausted) {
+            /* With the table full every slot below the limit is open */
+            fds = (exhausted ? (int)limit.rlim_cur : count_fds()) - base_fds;
+            printf("%9d  %8d  %7.1f  %10.1f  %14.1f\n", n, fds, (double)fds / n,
+                   (double)init_ns / (n - last) / 1e3, round_robin_ns(contexts, n));
+            fflush(stdout);
+            init_ns = 0;
+            last = n;
+            checkpoint *= 2;
+        }
+    }
+
+    printf("\n");
+    if (exhausted) {
+        printf("Descriptor limit reached after %d contexts; the last one may be missing counters\n", n);
+    } else if (n < max_contexts) {
+        printf("perfmon_init failed after %d contexts: %s\n", n, perfmon_get_error());
+    } else {
+        printf("Opened %d contexts without reaching the descriptor limit\n", n);
+    }
+
+    while (n > 0) {
+        perfmon_cleanup(contexts[--n]);
+    }
+    free(contexts);
+}
+
+int main(int argc, char *argv[]) {
+    int max_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int cycles = DEFAULT_CYCLES;
+    int max_contexts = DEFAULT_CONTEXTS;
+    int opt, t, base_fds;
+
+    while ((opt = getopt(argc, argv, "t:c:n:h")) != -1) {
+        switch (opt) {
+        case 't': max_threads = atoi(optarg); break;
+        case 'c': cycles = atoi(optarg); break;
+        case 'n': max_contexts = atoi(optarg); break;
+        default:
+            fprintf(stderr, "Usage: %s [-t max_threads] [-c cycles_per_thread] [-n max_contexts]\n",
+                    argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (max_threads < 1) {
+        max_threads = 1;
+    }
+    if (cycles < 1 || max_contexts < 1) {
+        fprintf(stderr, "cycles and contexts must be positive\n");
+        return 1;
+    }
+
+    printf("libperfmon - Thread Scaling and Descriptor Limit Benchmark\n");
+    printf("==========================================================\n\n");
+
+    printf("Thread scaling: one context per thread, %d start/stop cycles each\n\n", cycles);
+    printf("%7s  %10s  %9s  %14s  %10s  %7s  %6s  %7s\n",
+           "Threads", "Cycles", "Wall(s)", "Cycles/s", "ns/cycle", "Kernel", "fds", "fds/ctx");
+    printf("%7s  %10s  %9s  %14s  %10s  %7s  %6s  %7s\n",
+           "-------", "------", "-------", "--------", "--------", "------", "---", "-------");
+
+    base_fds = count_fds();
+    for (t = 1; t < max_threads; t *= 2) {
+        run_scaling(t, cycles, base_fds);
+        fflush(stdout);
+    }
+    run_scaling(max_threads, cycles, base_fds);
+
+    printf("\nDescriptor limit: contexts opened on one thread\n");
+    run_fd_limit(max_contexts);
+
+    return 0;
+}
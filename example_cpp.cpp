@@ -0,0 +1,101 @@
+/*
+ * C++ example demonstrating perfmon.hpp (RAII scopes and compile-time counter sets)
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "perfmon.hpp"
+
+/* Example workload - random-ish probes into a table larger than cache */
+static uint64_t probe_table(const std::vector<uint64_t> &table, size_t probes) {
+    uint64_t sum = 0;
+    uint64_t x = 88172645463325252ULL;
+
+    for (size_t i = 0; i < probes; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        sum += table[x % table.size()];
+    }
+    return sum;
+}
+
+/* Example: only the counters the hot path names are opened */
+static void example_counter_set(const std::vector<uint64_t> &table) {
+    using Counters = perfmon::CounterSet<perfmon::Cycles, perfmon::Instructions,
+                                         perfmon::LLCMisses>;
+    Counters counters;
+    Counters::Sample sample;
+    volatile uint64_t sink;
+
+    printf("=== CounterSet Example ===\n\n");
+
+    if (!counters) {
+        fprintf(stderr, "Failed to open counter set: %s\n", counters.error());
+        return;
+    }
+
+    {
+        perfmon::Scope scope(counters, sample);
+        sink = probe_table(table, 1 << 22);
+    }
+    (void)sink;
+
+    for (size_t i = 0; i < Counters::size; i++) {
+        printf("%20lu      %s\n", sample.values[i], Counters::events[i].name);
+    }
+    printf("%20.2f      insn per cycle\n",
+           sample.ratio<perfmon::Instructions, perfmon::Cycles>());
+    printf("%20.2f      LLC misses per 1k instructions\n",
+           1000.0 * sample.ratio<perfmon::LLCMisses, perfmon::Instructions>());
+    printf("\n%20.9f seconds time elapsed\n", sample.elapsed_time_sec);
+}
+
+/* Example: full statistics through the C API context */
+static void example_context(const std::vector<uint64_t> &table) {
+    perfmon::Context ctx;
+    perfmon_stats_t stats;
+    volatile uint64_t sink;
+
+    printf("\n=== Context Example ===\n");
+
+    if (!ctx) {
+        fprintf(stderr, "Failed to initialize perfmon: %s\n", perfmon::Context::error());
+        return;
+    }
+
+    /* Handles are move-only */
+    perfmon::Context owner = std::move(ctx);
+    {
+        perfmon::Scope scope(owner, stats);
+        sink = probe_table(table, 1 << 22);
+    }
+    (void)sink;
+
+    perfmon_print_stats(&stats, STDOUT_FILENO);
+}
+
+int main() {
+    std::vector<uint64_t> table(1 << 24);
+
+    printf("libperfmon - C++ Interface Example\n");
+    printf("==================================\n\n");
+
+    if (!perfmon_is_supported()) {
+        fprintf(stderr, "Error: Performance monitoring is not supported on this system.\n");
+        fprintf(stderr, "Run ./example_simple --check-support for more information.\n");
+        return 1;
+    }
+
+    for (size_t i = 0; i < table.size(); i++) {
+        table[i] = i;
+    }
+
+    example_counter_set(table);
+    example_context(table);
+
+    printf("\nExamples completed successfully!\n");
+    return 0;
+}
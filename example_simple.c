@@ -2,11 +2,16 @@
  * Simple example demonstrating basic usage of libperfmon
  */
 
+#define _GNU_SOURCE
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include "perfmon.h"
+#include "perfmon_advisor.h"
+#include "perfmon_bench.h"
+#include "perfmon_roofline.h"
 
 /* Example workload function - matrix multiplication */
 void matrix_multiply(int size) {
@@ -97,6 +102,62 @@ void example_basic_monitoring(void) {
     perfmon_cleanup(ctx);
 }
 
+/* Workload adapter for the repetition runner */
+static void matrix_multiply_fn(void *arg) {
+    matrix_multiply(*(int *)arg);
+}
+
+/* Example: Repeated runs with warmup and outlier rejection */
+void example_repetitions(void) {
+    perfmon_bench_options_t opts;
+    perfmon_bench_result_t result;
+    int size = 200;
+
+    printf("\n=== Repetition Example ===\n");
+
+    perfmon_bench_options_init(&opts);
+    opts.warmup = 2;
+    opts.repetitions = 20;
+    opts.cpu = sched_getcpu();
+
+    printf("Running matrix multiplication (200x200) %d times on CPU %d...\n",
+           opts.repetitions, opts.cpu);
+    if (!perfmon_bench_run(matrix_multiply_fn, &size, &opts, &result)) {
+        fprintf(stderr, "Repetition run failed: %s\n", perfmon_get_error());
+        return;
+    }
+
+    perfmon_bench_print(&result, STDOUT_FILENO);
+}
+
+/* Example: Ranked bottleneck findings */
+void example_advisor(void) {
+    perfmon_context_t *ctx;
+    perfmon_advisor_t *advisor;
+    perfmon_stats_t stats;
+
+    printf("\n=== Advisor Example ===\n");
+
+    ctx = perfmon_init();
+    advisor = perfmon_advisor_create_default();
+    if (!ctx || !advisor) {
+        fprintf(stderr, "Failed to initialize: %s\n", perfmon_get_error());
+        perfmon_advisor_free(advisor);
+        perfmon_cleanup(ctx);
+        return;
+    }
+
+    /* A large multiplication walks B column-wise and misses the cache */
+    perfmon_start(ctx);
+    matrix_multiply(500);
+    perfmon_stop(ctx, &stats);
+
+    perfmon_advisor_print(advisor, &stats, "matrix_multiply(500)", STDOUT_FILENO);
+
+    perfmon_advisor_free(advisor);
+    perfmon_cleanup(ctx);
+}
+
 /* Example: Multiple measurements */
 void example_multiple_measurements(void) {
     perfmon_context_t *ctx;
@@ -142,6 +203,120 @@ void example_multiple_measurements(void) {
     perfmon_cleanup(ctx);
 }
 
+/* Example: User-defined software counters */
+void example_user_counters(void) {
+    perfmon_context_t *ctx;
+    perfmon_stats_t stats;
+    int madds_id;
+    int size = 300;
+
+    printf("\n=== User Counters Example ===\n");
+
+    ctx = perfmon_init();
+    madds_id = perfmon_user_counter_register("multiply_adds");
+    if (!ctx || madds_id < 0) {
+        fprintf(stderr, "Failed to initialize: %s\n", perfmon_get_error());
+        perfmon_cleanup(ctx);
+        return;
+    }
+
+    perfmon_start(ctx);
+    matrix_multiply(size);
+    perfmon_user_counter_add(ctx, madds_id, (uint64_t)size * size * size);
+    perfmon_stop(ctx, &stats);
+
+    /* Reported with the hardware counters, including cycles per unit */
+    perfmon_print_stats(&stats, STDOUT_FILENO);
+
+    perfmon_cleanup(ctx);
+}
+
+/* Example: Static region registry */
+PERFMON_REGION(matrix_small);
+PERFMON_REGION(matrix_large);
+
+void example_region_registry(void) {
+    perfmon_context_t *ctx;
+    perfmon_region_table_t *table;
+    perfmon_stats_t stats;
+    int i;
+
+    printf("\n=== Region Registry Example ===\n");
+    printf("%u regions registered\n", perfmon_region_count());
+
+    ctx = perfmon_init();
+    table = perfmon_region_table_create();
+    if (!ctx || !table) {
+        fprintf(stderr, "Failed to initialize: %s\n", perfmon_get_error());
+        perfmon_region_table_free(table);
+        perfmon_cleanup(ctx);
+        return;
+    }
+
+    /* Recording indexes the table by region id, no lookups */
+    for (i = 0; i < 5; i++) {
+        perfmon_start(ctx);
+        matrix_multiply(100);
+        perfmon_stop(ctx, &stats);
+        perfmon_region_record(table, &matrix_small, &stats);
+    }
+    perfmon_start(ctx);
+    matrix_multiply(300);
+    perfmon_stop(ctx, &stats);
+    perfmon_region_record(table, &matrix_large, &stats);
+
+    perfmon_region_table_print(table, STDOUT_FILENO);
+
+    perfmon_region_table_free(table);
+    perfmon_cleanup(ctx);
+}
+
+/* Example: Roofline placement of matrix_multiply */
+void example_roofline(void) {
+    perfmon_context_t *ctx;
+    perfmon_roofline_events_t *events;
+    perfmon_roofline_counts_t counts;
+    perfmon_roofline_point_t point;
+    perfmon_roofline_t roof;
+    perfmon_stats_t stats;
+    int flops_id;
+    int size = 500;
+
+    printf("\n=== Roofline Example ===\n");
+
+    /* Fallback FLOP count where the PMU has no FP events: 2 per multiply-add */
+    flops_id = perfmon_user_counter_register("flops");
+    ctx = perfmon_init();
+    events = perfmon_roofline_events_open();
+    if (!ctx || !events || flops_id < 0) {
+        fprintf(stderr, "Failed to initialize: %s\n", perfmon_get_error());
+        perfmon_roofline_events_close(events);
+        perfmon_cleanup(ctx);
+        return;
+    }
+
+    printf("Calibrating machine roofline...\n");
+    if (!perfmon_roofline_calibrate(&roof)) {
+        fprintf(stderr, "Calibration failed: %s\n", perfmon_get_error());
+        perfmon_roofline_events_close(events);
+        perfmon_cleanup(ctx);
+        return;
+    }
+
+    perfmon_start(ctx);
+    perfmon_roofline_events_start(events);
+    matrix_multiply(size);
+    perfmon_roofline_events_stop(events, &counts);
+    perfmon_user_counter_add(ctx, flops_id, 2ULL * size * size * size);
+    perfmon_stop(ctx, &stats);
+
+    perfmon_roofline_analyze(&roof, &stats, &counts, &point);
+    perfmon_roofline_print(&roof, &point, "matrix_multiply(500)", STDOUT_FILENO);
+
+    perfmon_roofline_events_close(events);
+    perfmon_cleanup(ctx);
+}
+
 /* Check if performance monitoring is supported */
 void check_support(void) {
     if (perfmon_is_supported()) {
@@ -177,6 +352,11 @@ int main(int argc, char *argv[]) {
     /* Run examples */
     example_basic_monitoring();
     example_multiple_measurements();
+    example_user_counters();
+    example_region_registry();
+    example_repetitions();
+    example_advisor();
+    example_roofline();
     
     printf("\nExamples completed successfully!\n");
     return 0;
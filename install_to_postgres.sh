@@ -39,10 +39,10 @@ echo "Step 2/4: Copying library files to PostgreSQL source..."
 cp -v libperfmon.a "$PG_SRC_DIR/src/backend/"
 echo "✓ Copied libperfmon.a"
 
-# Copy header file
+# Copy header files
 mkdir -p "$PG_SRC_DIR/src/include/utils"
-cp -v perfmon.h "$PG_SRC_DIR/src/include/utils/"
-echo "✓ Copied perfmon.h"
+cp -v perfmon.h perfmon_expr.h perfmon_advisor.h "$PG_SRC_DIR/src/include/utils/"
+echo "✓ Copied perfmon.h, perfmon_expr.h, perfmon_advisor.h"
 echo ""
 
 echo "Step 3/4: Backing up and modifying PostgreSQL Makefile..."
@@ -4,6 +4,9 @@
 
 #define _GNU_SOURCE
 #include "perfmon.h"
+#include "perfmon_fast.h"
+#include "perfmon_expr.h"
+#include "perfmon_internal.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,29 +15,119 @@
 #include <stdarg.h>
 #include <sys/syscall.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <linux/perf_event.h>
 #include <errno.h>
 #include <time.h>
+#include <pthread.h>
 
 /* Thread-local error message */
 static __thread char error_msg[256] = {0};
 
-/* Performance counter file descriptor */
-typedef struct {
-    int fd;
-    bool enabled;
-} perf_counter_t;
+/* Cache line size used to keep per-thread slots apart */
+#define CACHE_LINE_SIZE 64
+
+/* Process-wide user counter names (registered at setup time) */
+#define USER_COUNTER_NAME_LEN 32
+static char user_counter_names[PERFMON_MAX_USER_COUNTERS][USER_COUNTER_NAME_LEN];
+static int user_counter_count = 0;
+static pthread_mutex_t user_counter_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Region statistics table */
+struct perfmon_region_table {
+    const perfmon_region_t *regions;
+    uint32_t nr_regions;
+    perfmon_region_stats_t stats[];
+};
 
 /* Performance monitor context structure */
 struct perfmon_context {
-    perf_counter_t counters[PERFMON_MAX_COUNTERS];
-    struct timespec start_time;
-    struct timespec end_time;
+    /* User counters get their own cache line at the start of the context */
+    uint64_t user_counters[PERFMON_MAX_USER_COUNTERS] __attribute__((aligned(CACHE_LINE_SIZE)));
+    const perfmon_backend_ops_t *backend;
+    void *backend_state;
+    uint32_t available;     /* counters the backend opened, bit per counter type */
+    uint32_t enabled;       /* subset counted by start/stop */
+    uint64_t start_ns;
+    uint64_t end_ns;
     bool is_running;
+
+    /* RAPL energy at start (CPU-wide counters shared by the process) */
+    bool energy;
+    double energy_start[PERFMON_MAX_ENERGY_DOMAINS];
+
+    /* OS counters at start, from the creating thread's /proc files */
+    bool os_counters;
+    perfmon_os_files_t os_files;
+    uint64_t os_start[PERFMON_OS_NR];
+    bool os_start_owned;    /* start ran on the creating thread */
+
+    /* PSI sample at start (0: sampler not running) */
+    uint64_t psi_mark;
+
+    /* Stamped on every measurement */
+    uint64_t host_hash;
+
+    /* CPU and NUMA node at start */
+    bool numa;
+    int start_cpu;
+    int start_node;
+
+    /* Cost of an empty start/stop region; the last slot is elapsed ns */
+    bool calibrated;
+    bool subtract_bias;
+    int calibration_runs;
+    uint64_t bias[PERFMON_MAX_COUNTERS + 1];
+    uint64_t spread[PERFMON_MAX_COUNTERS + 1];
 };
 
-/* Set error message */
-static void set_error(const char *fmt, ...) {
+/* Slot of the elapsed time in the calibration arrays */
+#define CALIBRATION_TIME PERFMON_MAX_COUNTERS
+
+/* Default number of empty regions measured by the calibration pass */
+#define DEFAULT_CALIBRATION_RUNS 51
+
+/*
+ * Calibrations of this process, reused by every later context with the same
+ * measurement path: backend, enabled counters, the optional samplers that run
+ * inside start/stop, and the number of runs.  A handful of distinct paths is
+ * all a process uses; beyond that contexts calibrate themselves.
+ */
+#define CALIBRATION_CACHE_SIZE 8
+
+typedef struct {
+    const perfmon_backend_ops_t *backend;
+    uint32_t enabled;
+    bool energy;
+    bool os_counters;
+    bool numa;
+    int runs;
+    uint64_t bias[PERFMON_MAX_COUNTERS + 1];
+    uint64_t spread[PERFMON_MAX_COUNTERS + 1];
+} calibration_entry_t;
+
+static calibration_entry_t calibration_cache[CALIBRATION_CACHE_SIZE];
+static int nr_calibrations = 0;
+static pthread_mutex_t calibration_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * A region is flagged as throttled when its cores ran below this fraction of
+ * its turbo_reference: the highest turbo ratio measured by perfmon_stop() or
+ * perfmon_read() in this process up to and including the region, or nominal
+ * if that is higher.  A CPU pulled from turbo down to a clock still above
+ * nominal is thereby caught too.  The reference is fixed when the region is
+ * measured, so deriving metrics again (region totals, means) gives the same
+ * flag.  Shorter regions than THROTTLE_MIN_REF_CYCLES are too noisy to flag
+ * or to raise the peak.
+ */
+#define THROTTLE_RATIO          0.95
+#define THROTTLE_MIN_REF_CYCLES 100000
+
+/* Highest turbo ratio measured in this process, as the bits of a double */
+static uint64_t peak_turbo_bits;
+
+/* Set error message (shared with the other library modules) */
+void perfmon_set_error(const char *fmt, ...) {
     va_list args;
     va_start(args, fmt);
     vsnprintf(error_msg, sizeof(error_msg), fmt, args);
@@ -47,8 +140,61 @@ static long perf_event_open(struct perf_event_attr *hw_event, pid_t pid,
     return syscall(__NR_perf_event_open, hw_event, pid, cpu, group_fd, flags);
 }
 
-/* Setup a single performance counter */
-static int setup_counter(uint32_t type, uint64_t config) {
+/* Event encoding for each counter type */
+typedef struct {
+    uint32_t type;
+    uint64_t config;
+} perf_event_desc_t;
+
+#define CACHE_EVENT(cache, op, result) \
+    ((cache) | ((op) << 8) | ((result) << 16))
+
+static const perf_event_desc_t counter_events[PERFMON_MAX_COUNTERS] = {
+    [PERFMON_CYCLES]           = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    [PERFMON_INSTRUCTIONS]     = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    [PERFMON_BRANCHES]         = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS},
+    [PERFMON_BRANCH_MISSES]    = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    [PERFMON_CACHE_REFERENCES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES},
+    [PERFMON_CACHE_MISSES]     = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    /* Cache counters (may not be supported on all systems) */
+    [PERFMON_DTLB_LOAD_MISSES] = {PERF_TYPE_HW_CACHE,
+                                  CACHE_EVENT(PERF_COUNT_HW_CACHE_DTLB,
+                                              PERF_COUNT_HW_CACHE_OP_READ,
+                                              PERF_COUNT_HW_CACHE_RESULT_MISS)},
+    [PERFMON_ITLB_MISSES]      = {PERF_TYPE_HW_CACHE,
+                                  CACHE_EVENT(PERF_COUNT_HW_CACHE_ITLB,
+                                              PERF_COUNT_HW_CACHE_OP_READ,
+                                              PERF_COUNT_HW_CACHE_RESULT_MISS)},
+    /* Software counters */
+    [PERFMON_PAGE_FAULTS]      = {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+    [PERFMON_MINOR_FAULTS]     = {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MIN},
+    [PERFMON_MAJOR_FAULTS]     = {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MAJ},
+    [PERFMON_CONTEXT_SWITCHES] = {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+    [PERFMON_CPU_MIGRATIONS]   = {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS},
+    /* Frequency: ref-cycles tick at the nominal rate whatever the core clock */
+    [PERFMON_REF_CYCLES]       = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_REF_CPU_CYCLES},
+    [PERFMON_TASK_CLOCK]       = {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+    /* NUMA: loads that left the core's caches, and those served by a remote node */
+    [PERFMON_NODE_LOADS]       = {PERF_TYPE_HW_CACHE,
+                                  CACHE_EVENT(PERF_COUNT_HW_CACHE_NODE,
+                                              PERF_COUNT_HW_CACHE_OP_READ,
+                                              PERF_COUNT_HW_CACHE_RESULT_ACCESS)},
+    [PERFMON_NODE_LOAD_MISSES] = {PERF_TYPE_HW_CACHE,
+                                  CACHE_EVENT(PERF_COUNT_HW_CACHE_NODE,
+                                              PERF_COUNT_HW_CACHE_OP_READ,
+                                              PERF_COUNT_HW_CACHE_RESULT_MISS)},
+};
+
+/* Extended PMU type in config of hardware events (Linux 5.13+, hybrid CPUs) */
+#ifdef PERF_PMU_TYPE_SHIFT
+#define PMU_TYPE_SHIFT PERF_PMU_TYPE_SHIFT
+#else
+#define PMU_TYPE_SHIFT 32
+#endif
+
+/* Open one event (shared with the other library modules) */
+int perfmon_open_event(uint32_t type, uint64_t config, int pid, int cpu, int group_fd,
+                       uint64_t read_format) {
     struct perf_event_attr pe;
     int fd;
 
@@ -56,253 +202,843 @@ static int setup_counter(uint32_t type, uint64_t config) {
     pe.type = type;
     pe.size = sizeof(struct perf_event_attr);
     pe.config = config;
-    pe.disabled = 1;
+    pe.read_format = read_format;
+    pe.disabled = (group_fd == -1);  /* group members follow the leader */
     pe.exclude_kernel = 0;
     pe.exclude_hv = 0;
-    pe.inherit = 1;  /* Inherit to child processes */
+    /* Inherit to child processes (standalone per-thread counters only) */
+    pe.inherit = (pid == 0 && group_fd == -1 && read_format == 0);
 
-    fd = perf_event_open(&pe, 0, -1, -1, 0);
+    fd = perf_event_open(&pe, pid, cpu, group_fd, 0);
     if (fd == -1) {
-        set_error("Failed to open perf event (type=%u, config=%lu): %s",
-                  type, config, strerror(errno));
+        perfmon_set_error("Failed to open perf event (type=%u, config=%llu): %s",
+                  pe.type, (unsigned long long)pe.config, strerror(errno));
     }
 
     return fd;
 }
 
+/* First line of a file without the newline (shared with the other library modules) */
+bool perfmon_read_line(const char *path, char *buf, size_t size) {
+    FILE *f = fopen(path, "r");
+    bool ok;
+
+    if (!f) {
+        return false;
+    }
+    ok = fgets(buf, (int)size, f) != NULL;
+    fclose(f);
+    if (ok) {
+        buf[strcspn(buf, "\n")] = '\0';
+    }
+    return ok;
+}
+
+/* Parse a sysfs CPU list such as "0,28" or "0-3,8-11" */
+int perfmon_parse_cpu_list(const char *list, int *cpus, int max) {
+    const char *p = list;
+    char *end;
+    long first, last;
+    int n = 0;
+
+    while (*p && n < max) {
+        first = strtol(p, &end, 10);
+        if (end == p) {
+            break;
+        }
+        last = *end == '-' ? strtol(end + 1, &end, 10) : first;
+        while (first <= last && n < max) {
+            cpus[n++] = (int)first++;
+        }
+        if (*end != ',') {
+            break;
+        }
+        p = end + 1;
+    }
+    return n;
+}
+
+/*
+ * Setup a single performance counter (shared with the backends)
+ * group_fd: -1 for a standalone counter, or the group leader
+ * read_format: PERF_FORMAT_* flags (0 for a plain 64-bit count)
+ */
+int perfmon_open_counter(perfmon_counter_type_t counter, int group_fd, uint64_t read_format) {
+    return perfmon_open_event(counter_events[counter].type, counter_events[counter].config,
+                              0, -1, group_fd, read_format);
+}
+
+/* Hardware counter on one core PMU of a hybrid CPU */
+int perfmon_open_counter_on_pmu(perfmon_counter_type_t counter, uint32_t pmu_type) {
+    const perf_event_desc_t *event = &counter_events[counter];
+
+    if (event->type != PERF_TYPE_HARDWARE && event->type != PERF_TYPE_HW_CACHE) {
+        perfmon_set_error("Counter %d is not a hardware event", (int)counter);
+        errno = EINVAL;
+        return -1;
+    }
+    return perfmon_open_event(event->type, event->config | ((uint64_t)pmu_type << PMU_TYPE_SHIFT),
+                              0, -1, -1, 0);
+}
+
+static bool calibrate(perfmon_context_t *ctx, int runs);
+
+/* Fill options with the defaults used by perfmon_init() */
+void perfmon_options_init(perfmon_options_t *opts) {
+    if (!opts) {
+        return;
+    }
+
+    memset(opts, 0, sizeof(perfmon_options_t));
+    opts->calibration_runs = DEFAULT_CALIBRATION_RUNS;
+    opts->backend = PERFMON_BACKEND_AUTO;
+}
+
+/* Backend for an explicit choice, or from PERFMON_BACKEND for AUTO */
+static const perfmon_backend_ops_t *select_backend(perfmon_backend_t backend) {
+    const char *env;
+
+    if (backend == PERFMON_BACKEND_AUTO) {
+        env = getenv("PERFMON_BACKEND");
+        if (env && strcmp(env, "perf_event") == 0) {
+            backend = PERFMON_BACKEND_PERF_EVENT;
+        } else if (env && strcmp(env, "rusage") == 0) {
+            backend = PERFMON_BACKEND_RUSAGE;
+        } else if (env && strcmp(env, "mock") == 0) {
+            backend = PERFMON_BACKEND_MOCK;
+        }
+    }
+
+    switch (backend) {
+    case PERFMON_BACKEND_RUSAGE:
+        return &perfmon_backend_rusage;
+    case PERFMON_BACKEND_MOCK:
+        return &perfmon_backend_mock;
+    default:
+        return &perfmon_backend_perf_event;
+    }
+}
+
+/* Open the context's backend; AUTO falls back to rusage when no perf event opens */
+static bool open_backend(perfmon_context_t *ctx, const perfmon_options_t *opts) {
+    ctx->backend = select_backend(opts->backend);
+    ctx->backend_state = ctx->backend->open(opts, &ctx->available);
+    if (!ctx->backend_state) {
+        return false;
+    }
+
+    if (ctx->available == 0 && opts->backend == PERFMON_BACKEND_AUTO &&
+        ctx->backend == &perfmon_backend_perf_event) {
+        ctx->backend->close(ctx->backend_state);
+        ctx->backend = &perfmon_backend_rusage;
+        ctx->backend_state = ctx->backend->open(opts, &ctx->available);
+        if (!ctx->backend_state) {
+            return false;
+        }
+    }
+
+    /* Unavailable counters stay disabled */
+    ctx->enabled = ctx->available;
+    return true;
+}
+
 /* Initialize performance monitoring context */
 perfmon_context_t *perfmon_init(void) {
+    return perfmon_init_with_options(NULL);
+}
+
+/* Initialize a context with options */
+perfmon_context_t *perfmon_init_with_options(const perfmon_options_t *opts) {
+    perfmon_options_t defaults;
     perfmon_context_t *ctx;
-    int i;
 
-    ctx = (perfmon_context_t *)calloc(1, sizeof(perfmon_context_t));
-    if (!ctx) {
-        set_error("Failed to allocate context: %s", strerror(errno));
+    if (!opts) {
+        perfmon_options_init(&defaults);
+        opts = &defaults;
+    }
+
+    if (posix_memalign((void **)&ctx, CACHE_LINE_SIZE, sizeof(perfmon_context_t)) != 0) {
+        perfmon_set_error("Failed to allocate context: %s", strerror(ENOMEM));
         return NULL;
     }
+    memset(ctx, 0, sizeof(perfmon_context_t));
 
-    /* Initialize all counters as disabled */
-    for (i = 0; i < PERFMON_MAX_COUNTERS; i++) {
-        ctx->counters[i].fd = -1;
-        ctx->counters[i].enabled = false;
-    }
-
-    /* Setup hardware counters */
-    ctx->counters[PERFMON_CYCLES].fd = 
-        setup_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
-    ctx->counters[PERFMON_CYCLES].enabled = (ctx->counters[PERFMON_CYCLES].fd != -1);
-
-    ctx->counters[PERFMON_INSTRUCTIONS].fd = 
-        setup_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
-    ctx->counters[PERFMON_INSTRUCTIONS].enabled = (ctx->counters[PERFMON_INSTRUCTIONS].fd != -1);
-
-    ctx->counters[PERFMON_BRANCHES].fd = 
-        setup_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS);
-    ctx->counters[PERFMON_BRANCHES].enabled = (ctx->counters[PERFMON_BRANCHES].fd != -1);
-
-    ctx->counters[PERFMON_BRANCH_MISSES].fd = 
-        setup_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
-    ctx->counters[PERFMON_BRANCH_MISSES].enabled = (ctx->counters[PERFMON_BRANCH_MISSES].fd != -1);
-
-    ctx->counters[PERFMON_CACHE_REFERENCES].fd = 
-        setup_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES);
-    ctx->counters[PERFMON_CACHE_REFERENCES].enabled = (ctx->counters[PERFMON_CACHE_REFERENCES].fd != -1);
-
-    ctx->counters[PERFMON_CACHE_MISSES].fd = 
-        setup_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
-    ctx->counters[PERFMON_CACHE_MISSES].enabled = (ctx->counters[PERFMON_CACHE_MISSES].fd != -1);
-
-    /* Setup software counters */
-    ctx->counters[PERFMON_PAGE_FAULTS].fd = 
-        setup_counter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS);
-    ctx->counters[PERFMON_PAGE_FAULTS].enabled = (ctx->counters[PERFMON_PAGE_FAULTS].fd != -1);
-
-    ctx->counters[PERFMON_MINOR_FAULTS].fd = 
-        setup_counter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MIN);
-    ctx->counters[PERFMON_MINOR_FAULTS].enabled = (ctx->counters[PERFMON_MINOR_FAULTS].fd != -1);
-
-    ctx->counters[PERFMON_MAJOR_FAULTS].fd = 
-        setup_counter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MAJ);
-    ctx->counters[PERFMON_MAJOR_FAULTS].enabled = (ctx->counters[PERFMON_MAJOR_FAULTS].fd != -1);
-
-    ctx->counters[PERFMON_CONTEXT_SWITCHES].fd = 
-        setup_counter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES);
-    ctx->counters[PERFMON_CONTEXT_SWITCHES].enabled = (ctx->counters[PERFMON_CONTEXT_SWITCHES].fd != -1);
-
-    ctx->counters[PERFMON_CPU_MIGRATIONS].fd = 
-        setup_counter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS);
-    ctx->counters[PERFMON_CPU_MIGRATIONS].enabled = (ctx->counters[PERFMON_CPU_MIGRATIONS].fd != -1);
-
-    /* Setup cache counters (may not be supported on all systems) */
-    uint64_t dtlb_config = (PERF_COUNT_HW_CACHE_DTLB) | 
-                           (PERF_COUNT_HW_CACHE_OP_READ << 8) |
-                           (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
-    ctx->counters[PERFMON_DTLB_LOAD_MISSES].fd = 
-        setup_counter(PERF_TYPE_HW_CACHE, dtlb_config);
-    ctx->counters[PERFMON_DTLB_LOAD_MISSES].enabled = (ctx->counters[PERFMON_DTLB_LOAD_MISSES].fd != -1);
-
-    uint64_t itlb_config = (PERF_COUNT_HW_CACHE_ITLB) | 
-                           (PERF_COUNT_HW_CACHE_OP_READ << 8) |
-                           (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
-    ctx->counters[PERFMON_ITLB_MISSES].fd = 
-        setup_counter(PERF_TYPE_HW_CACHE, itlb_config);
-    ctx->counters[PERFMON_ITLB_MISSES].enabled = (ctx->counters[PERFMON_ITLB_MISSES].fd != -1);
+    /* Pick up metric formulas and the PSI sampler from the environment on first use */
+    perfmon_metrics_load_env();
+    perfmon_psi_load_env();
+
+    if (!open_backend(ctx, opts)) {
+        free(ctx);
+        return NULL;
+    }
 
     ctx->is_running = false;
+    ctx->energy = opts->energy && perfmon_energy_domains() != 0;
+    ctx->os_counters = opts->os_counters;
+    ctx->numa = opts->numa;
+    ctx->host_hash = perfmon_host_hash();
+    ctx->os_files.io_fd = ctx->os_files.schedstat_fd = -1;
+    if (ctx->os_counters) {
+        perfmon_os_open(&ctx->os_files);
+    }
+
+    if (opts->calibrate || opts->subtract_bias) {
+        if (!calibrate(ctx, opts->calibration_runs > 0 ? opts->calibration_runs
+                                                       : DEFAULT_CALIBRATION_RUNS)) {
+            perfmon_cleanup(ctx);
+            return NULL;
+        }
+        ctx->subtract_bias = opts->subtract_bias;
+    }
 
     return ctx;
 }
 
 /* Start performance monitoring */
 bool perfmon_start(perfmon_context_t *ctx) {
-    int i;
-
     if (!ctx) {
-        set_error("Invalid context");
+        perfmon_set_error("Invalid context");
         return false;
     }
 
     if (ctx->is_running) {
-        set_error("Monitoring already running");
+        perfmon_set_error("Monitoring already running");
         return false;
     }
 
     /* Reset and enable all counters */
-    for (i = 0; i < PERFMON_MAX_COUNTERS; i++) {
-        if (ctx->counters[i].enabled && ctx->counters[i].fd != -1) {
-            ioctl(ctx->counters[i].fd, PERF_EVENT_IOC_RESET, 0);
-            ioctl(ctx->counters[i].fd, PERF_EVENT_IOC_ENABLE, 0);
-        }
+    ctx->backend->start(ctx->backend_state, ctx->enabled);
+
+    memset(ctx->user_counters, 0, sizeof(ctx->user_counters));
+
+    if (ctx->energy) {
+        perfmon_energy_read(ctx->energy_start);
+    }
+    if (ctx->os_counters) {
+        ctx->os_start_owned = perfmon_os_sample(&ctx->os_files, ctx->os_start);
+    }
+    ctx->psi_mark = perfmon_psi_mark();
+    if (ctx->numa) {
+        perfmon_numa_place(&ctx->start_cpu, &ctx->start_node);
     }
 
     /* Record start time */
-    clock_gettime(CLOCK_MONOTONIC, &ctx->start_time);
+    ctx->start_ns = ctx->backend->now_ns(ctx->backend_state);
     ctx->is_running = true;
 
     return true;
 }
 
-/* Read a single counter value */
-static uint64_t read_counter(int fd) {
-    uint64_t count = 0;
-    if (fd != -1) {
-        if (read(fd, &count, sizeof(count)) != sizeof(count)) {
-            return 0;
+/* Read all counter values into an array indexed by counter type */
+static void read_values(perfmon_context_t *ctx, uint64_t values[PERFMON_MAX_COUNTERS]) {
+    ctx->backend->read(ctx->backend_state, values);
+}
+
+/* Raise the process-wide peak turbo ratio to ratio; returns the new peak */
+static double observe_turbo_ratio(double ratio) {
+    uint64_t old = __atomic_load_n(&peak_turbo_bits, __ATOMIC_RELAXED);
+    uint64_t bits;
+    double peak;
+
+    memcpy(&peak, &old, sizeof(peak));
+    memcpy(&bits, &ratio, sizeof(bits));
+    while (ratio > peak) {
+        if (__atomic_compare_exchange_n(&peak_turbo_bits, &old, bits, false,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            return ratio;
+        }
+        memcpy(&peak, &old, sizeof(peak));
+    }
+    return peak;
+}
+
+/* Highest turbo ratio measured so far, without raising it */
+static double peak_turbo_ratio(void) {
+    uint64_t bits = __atomic_load_n(&peak_turbo_bits, __ATOMIC_RELAXED);
+    double peak;
+
+    memcpy(&peak, &bits, sizeof(peak));
+    return peak;
+}
+
+/* Fix the throttle reference of a region measured by stop or read */
+static void set_turbo_reference(perfmon_stats_t *stats) {
+    if (stats->ref_cycles >= THROTTLE_MIN_REF_CYCLES && stats->cycles > 0) {
+        stats->turbo_reference = observe_turbo_ratio((double)stats->cycles /
+                                                     (double)stats->ref_cycles);
+    }
+}
+
+/* Calculate derived metrics from raw counts */
+void perfmon_compute_derived(perfmon_stats_t *stats) {
+    if (stats->cycles > 0) {
+        stats->insn_per_cycle = (double)stats->instructions / (double)stats->cycles;
+    } else {
+        stats->insn_per_cycle = 0.0;
+    }
+
+    if (stats->branches > 0) {
+        stats->branch_miss_rate = (double)stats->branch_misses / (double)stats->branches * 100.0;
+    } else {
+        stats->branch_miss_rate = 0.0;
+    }
+
+    if (stats->cache_references > 0) {
+        stats->cache_miss_rate = (double)stats->cache_misses / (double)stats->cache_references * 100.0;
+    } else {
+        stats->cache_miss_rate = 0.0;
+    }
+
+    stats->effective_ghz = stats->task_clock_ns > 0 ?
+                           (double)stats->cycles / (double)stats->task_clock_ns : 0.0;
+    stats->turbo_ratio = stats->ref_cycles > 0 ?
+                         (double)stats->cycles / (double)stats->ref_cycles : 0.0;
+    if (stats->ref_cycles >= THROTTLE_MIN_REF_CYCLES && stats->cycles > 0) {
+        /* The reference was fixed at measurement time; unset means nominal */
+        if (stats->turbo_reference < 1.0) {
+            stats->turbo_reference = 1.0;
         }
+        stats->throttled = stats->turbo_ratio < THROTTLE_RATIO * stats->turbo_reference;
+    } else {
+        stats->throttled = false;
     }
-    return count;
+    stats->remote_load_rate = stats->node_loads > 0 ?
+                              (double)stats->node_load_misses / (double)stats->node_loads * 100.0 : 0.0;
+
+    perfmon_metrics_evaluate(stats);
+}
+
+/* Fill a stats structure from counter values and elapsed time */
+static void fill_stats(perfmon_stats_t *stats, const uint64_t values[PERFMON_MAX_COUNTERS],
+                       double elapsed_time_sec) {
+    memset(stats, 0, sizeof(perfmon_stats_t));
+
+    stats->cycles = values[PERFMON_CYCLES];
+    stats->instructions = values[PERFMON_INSTRUCTIONS];
+    stats->branches = values[PERFMON_BRANCHES];
+    stats->branch_misses = values[PERFMON_BRANCH_MISSES];
+    stats->cache_references = values[PERFMON_CACHE_REFERENCES];
+    stats->cache_misses = values[PERFMON_CACHE_MISSES];
+    stats->dtlb_load_misses = values[PERFMON_DTLB_LOAD_MISSES];
+    stats->itlb_misses = values[PERFMON_ITLB_MISSES];
+    stats->page_faults = values[PERFMON_PAGE_FAULTS];
+    stats->minor_faults = values[PERFMON_MINOR_FAULTS];
+    stats->major_faults = values[PERFMON_MAJOR_FAULTS];
+    stats->context_switches = values[PERFMON_CONTEXT_SWITCHES];
+    stats->cpu_migrations = values[PERFMON_CPU_MIGRATIONS];
+    stats->ref_cycles = values[PERFMON_REF_CYCLES];
+    stats->task_clock_ns = values[PERFMON_TASK_CLOCK];
+    stats->node_loads = values[PERFMON_NODE_LOADS];
+    stats->node_load_misses = values[PERFMON_NODE_LOAD_MISSES];
+    stats->elapsed_time_sec = elapsed_time_sec;
+    stats->start_cpu = stats->start_node = stats->stop_cpu = stats->stop_node = -1;
+}
+
+/* Placement at start and now; a change of node counts as one cross-node migration */
+static void fill_placement(const perfmon_context_t *ctx, perfmon_stats_t *stats) {
+    stats->start_cpu = ctx->start_cpu;
+    stats->start_node = ctx->start_node;
+    perfmon_numa_place(&stats->stop_cpu, &stats->stop_node);
+    stats->node_migrations = stats->start_node != -1 && stats->stop_node != -1 &&
+                             stats->start_node != stats->stop_node;
 }
 
-/* Calculate time difference in seconds */
-static double timespec_diff_sec(struct timespec *start, struct timespec *end) {
-    double sec = (double)(end->tv_sec - start->tv_sec);
-    double nsec = (double)(end->tv_nsec - start->tv_nsec) / 1e9;
-    return sec + nsec;
+/* Energy used since perfmon_start(), by wall time */
+static void energy_since_start(const perfmon_context_t *ctx, double joules[PERFMON_MAX_ENERGY_DOMAINS]) {
+    int i;
+
+    perfmon_energy_read(joules);
+    for (i = 0; i < PERFMON_MAX_ENERGY_DOMAINS; i++) {
+        joules[i] = joules[i] > ctx->energy_start[i] ? joules[i] - ctx->energy_start[i] : 0.0;
+    }
+}
+
+/* Remove the calibrated start/stop cost, clamping at zero */
+static void subtract_bias(const perfmon_context_t *ctx, uint64_t values[PERFMON_MAX_COUNTERS],
+                          uint64_t *elapsed_ns) {
+    int i;
+
+    for (i = 0; i < PERFMON_MAX_COUNTERS; i++) {
+        values[i] = values[i] > ctx->bias[i] ? values[i] - ctx->bias[i] : 0;
+    }
+    *elapsed_ns = *elapsed_ns > ctx->bias[CALIBRATION_TIME] ?
+                  *elapsed_ns - ctx->bias[CALIBRATION_TIME] : 0;
 }
 
 /* Stop performance monitoring and collect results */
 bool perfmon_stop(perfmon_context_t *ctx, perfmon_stats_t *stats) {
-    int i;
+    uint64_t values[PERFMON_MAX_COUNTERS];
+    double joules[PERFMON_MAX_ENERGY_DOMAINS];
+    uint64_t os_now[PERFMON_OS_NR];
+    uint64_t elapsed_ns;
+    bool os_owned = false;
 
     if (!ctx) {
-        set_error("Invalid context");
+        perfmon_set_error("Invalid context");
         return false;
     }
 
     if (!ctx->is_running) {
-        set_error("Monitoring not running");
+        perfmon_set_error("Monitoring not running");
         return false;
     }
 
     /* Record end time */
-    clock_gettime(CLOCK_MONOTONIC, &ctx->end_time);
+    ctx->end_ns = ctx->backend->now_ns(ctx->backend_state);
+    if (ctx->energy) {
+        energy_since_start(ctx, joules);
+    }
+    if (ctx->os_counters) {
+        os_owned = perfmon_os_sample(&ctx->os_files, os_now);
+    }
 
     /* Disable all counters */
-    for (i = 0; i < PERFMON_MAX_COUNTERS; i++) {
-        if (ctx->counters[i].enabled && ctx->counters[i].fd != -1) {
-            ioctl(ctx->counters[i].fd, PERF_EVENT_IOC_DISABLE, 0);
+    ctx->backend->stop(ctx->backend_state, ctx->enabled);
+
+    if (stats) {
+        read_values(ctx, values);
+        elapsed_ns = ctx->end_ns - ctx->start_ns;
+        if (ctx->subtract_bias) {
+            subtract_bias(ctx, values, &elapsed_ns);
+        }
+        fill_stats(stats, values, (double)elapsed_ns / 1e9);
+        stats->host_hash = ctx->host_hash;
+        memcpy(stats->user_counters, ctx->user_counters, sizeof(stats->user_counters));
+        if (ctx->energy) {
+            memcpy(stats->energy_joules, joules, sizeof(stats->energy_joules));
         }
+        if (ctx->os_counters) {
+            perfmon_os_fill(stats, ctx->os_start, os_now, ctx->os_start_owned && os_owned);
+        }
+        perfmon_psi_fill(stats, ctx->psi_mark);
+        if (ctx->numa) {
+            fill_placement(ctx, stats);
+        }
+        set_turbo_reference(stats);
+        perfmon_compute_derived(stats);
     }
 
-    if (stats) {
-        /* Read all counter values */
-        memset(stats, 0, sizeof(perfmon_stats_t));
-        
-        stats->cycles = read_counter(ctx->counters[PERFMON_CYCLES].fd);
-        stats->instructions = read_counter(ctx->counters[PERFMON_INSTRUCTIONS].fd);
-        stats->branches = read_counter(ctx->counters[PERFMON_BRANCHES].fd);
-        stats->branch_misses = read_counter(ctx->counters[PERFMON_BRANCH_MISSES].fd);
-        stats->cache_references = read_counter(ctx->counters[PERFMON_CACHE_REFERENCES].fd);
-        stats->cache_misses = read_counter(ctx->counters[PERFMON_CACHE_MISSES].fd);
-        stats->dtlb_load_misses = read_counter(ctx->counters[PERFMON_DTLB_LOAD_MISSES].fd);
-        stats->itlb_misses = read_counter(ctx->counters[PERFMON_ITLB_MISSES].fd);
-        stats->page_faults = read_counter(ctx->counters[PERFMON_PAGE_FAULTS].fd);
-        stats->minor_faults = read_counter(ctx->counters[PERFMON_MINOR_FAULTS].fd);
-        stats->major_faults = read_counter(ctx->counters[PERFMON_MAJOR_FAULTS].fd);
-        stats->context_switches = read_counter(ctx->counters[PERFMON_CONTEXT_SWITCHES].fd);
-        stats->cpu_migrations = read_counter(ctx->counters[PERFMON_CPU_MIGRATIONS].fd);
-
-        /* Calculate elapsed time */
-        stats->elapsed_time_sec = timespec_diff_sec(&ctx->start_time, &ctx->end_time);
-
-        /* Calculate derived metrics */
-        if (stats->cycles > 0) {
-            stats->insn_per_cycle = (double)stats->instructions / (double)stats->cycles;
-        } else {
-            stats->insn_per_cycle = 0.0;
+    ctx->is_running = false;
+    return true;
+}
+
+/* Read counters of a running context without stopping it */
+bool perfmon_read(perfmon_context_t *ctx, perfmon_stats_t *stats) {
+    uint64_t values[PERFMON_MAX_COUNTERS];
+    uint64_t os_now[PERFMON_OS_NR];
+    uint64_t now_ns, elapsed_ns;
+
+    if (!ctx || !stats) {
+        perfmon_set_error("Invalid context or stats");
+        return false;
+    }
+
+    if (!ctx->is_running) {
+        perfmon_set_error("Monitoring not running");
+        return false;
+    }
+
+    now_ns = ctx->backend->now_ns(ctx->backend_state);
+    read_values(ctx, values);
+    elapsed_ns = now_ns - ctx->start_ns;
+    if (ctx->subtract_bias) {
+        subtract_bias(ctx, values, &elapsed_ns);
+    }
+    fill_stats(stats, values, (double)elapsed_ns / 1e9);
+    stats->host_hash = ctx->host_hash;
+    memcpy(stats->user_counters, ctx->user_counters, sizeof(stats->user_counters));
+    if (ctx->energy) {
+        energy_since_start(ctx, stats->energy_joules);
+    }
+    if (ctx->os_counters) {
+        perfmon_os_fill(stats, ctx->os_start, os_now,
+                        perfmon_os_sample(&ctx->os_files, os_now) && ctx->os_start_owned);
+    }
+    perfmon_psi_fill(stats, ctx->psi_mark);
+    if (ctx->numa) {
+        fill_placement(ctx, stats);
+    }
+    set_turbo_reference(stats);
+    perfmon_compute_derived(stats);
+    return true;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Median of n values (sorts them) */
+static uint64_t median_u64(uint64_t *v, int n) {
+    qsort(v, (size_t)n, sizeof(uint64_t), compare_u64);
+    return v[n / 2];
+}
+
+/* Whether a cached calibration was measured on the context's path */
+static bool same_path(const calibration_entry_t *entry, const perfmon_context_t *ctx, int runs) {
+    return entry->backend == ctx->backend && entry->enabled == ctx->enabled &&
+           entry->energy == ctx->energy && entry->os_counters == ctx->os_counters &&
+           entry->numa == ctx->numa && entry->runs == runs;
+}
+
+/* Copy a calibration of this process with the same path; false if none */
+static bool lookup_calibration(perfmon_context_t *ctx, int runs) {
+    bool found = false;
+    int i;
+
+    pthread_mutex_lock(&calibration_lock);
+    for (i = 0; i < nr_calibrations; i++) {
+        if (same_path(&calibration_cache[i], ctx, runs)) {
+            memcpy(ctx->bias, calibration_cache[i].bias, sizeof(ctx->bias));
+            memcpy(ctx->spread, calibration_cache[i].spread, sizeof(ctx->spread));
+            found = true;
+            break;
         }
+    }
+    pthread_mutex_unlock(&calibration_lock);
+    return found;
+}
+
+/* Remember the context's calibration for later contexts */
+static void store_calibration(const perfmon_context_t *ctx, int runs) {
+    calibration_entry_t *entry;
+    int i;
+
+    pthread_mutex_lock(&calibration_lock);
+    for (i = 0; i < nr_calibrations; i++) {
+        if (same_path(&calibration_cache[i], ctx, runs)) {
+            break;      /* another thread calibrated the same path meanwhile */
+        }
+    }
+    if (i == nr_calibrations && nr_calibrations < CALIBRATION_CACHE_SIZE) {
+        entry = &calibration_cache[nr_calibrations++];
+        entry->backend = ctx->backend;
+        entry->enabled = ctx->enabled;
+        entry->energy = ctx->energy;
+        entry->os_counters = ctx->os_counters;
+        entry->numa = ctx->numa;
+        entry->runs = runs;
+        memcpy(entry->bias, ctx->bias, sizeof(entry->bias));
+        memcpy(entry->spread, ctx->spread, sizeof(entry->spread));
+    }
+    pthread_mutex_unlock(&calibration_lock);
+}
+
+/*
+ * Measure empty start/stop regions: the bias of each counter is the median,
+ * its spread the median absolute deviation from it.  The result is cached per
+ * process.  Mock counts are scripted, so the mock backend's bias is scripted
+ * too and no start/stop pair (which would use up script steps) is run.
+ */
+static bool calibrate(perfmon_context_t *ctx, int runs) {
+    uint64_t values[PERFMON_MAX_COUNTERS];
+    uint64_t *samples, *column;
+    int r, i, n = PERFMON_MAX_COUNTERS + 1;
+
+    if (ctx->backend == &perfmon_backend_mock) {
+        perfmon_mock_bias(ctx->backend_state, ctx->bias, &ctx->bias[CALIBRATION_TIME]);
+        memset(ctx->spread, 0, sizeof(ctx->spread));
+        ctx->calibration_runs = runs;
+        ctx->calibrated = true;
+        return true;
+    }
+
+    if (lookup_calibration(ctx, runs)) {
+        ctx->calibration_runs = runs;
+        ctx->calibrated = true;
+        return true;
+    }
 
-        if (stats->branches > 0) {
-            stats->branch_miss_rate = (double)stats->branch_misses / (double)stats->branches * 100.0;
-        } else {
-            stats->branch_miss_rate = 0.0;
+    samples = (uint64_t *)malloc((size_t)runs * n * sizeof(uint64_t));
+    column = (uint64_t *)malloc((size_t)runs * sizeof(uint64_t));
+    if (!samples || !column) {
+        free(samples);
+        free(column);
+        perfmon_set_error("Failed to allocate calibration buffer: %s", strerror(ENOMEM));
+        return false;
+    }
+
+    /* Same code path as a real region, with nothing inside */
+    for (r = 0; r < runs; r++) {
+        perfmon_start(ctx);
+        perfmon_stop(ctx, NULL);
+        read_values(ctx, values);
+        for (i = 0; i < PERFMON_MAX_COUNTERS; i++) {
+            samples[r * n + i] = values[i];
         }
+        samples[r * n + CALIBRATION_TIME] = ctx->end_ns - ctx->start_ns;
+    }
 
-        if (stats->cache_references > 0) {
-            stats->cache_miss_rate = (double)stats->cache_misses / (double)stats->cache_references * 100.0;
-        } else {
-            stats->cache_miss_rate = 0.0;
+    for (i = 0; i < n; i++) {
+        for (r = 0; r < runs; r++) {
+            column[r] = samples[r * n + i];
+        }
+        ctx->bias[i] = median_u64(column, runs);
+        for (r = 0; r < runs; r++) {
+            column[r] = column[r] > ctx->bias[i] ? column[r] - ctx->bias[i]
+                                                 : ctx->bias[i] - column[r];
         }
+        ctx->spread[i] = median_u64(column, runs);
     }
 
-    ctx->is_running = false;
+    free(samples);
+    free(column);
+    store_calibration(ctx, runs);
+    ctx->calibration_runs = runs;
+    ctx->calibrated = true;
     return true;
 }
 
-/* Reset all counters */
-bool perfmon_reset(perfmon_context_t *ctx) {
+/* Get the calibrated bias and its spread */
+bool perfmon_get_calibration(const perfmon_context_t *ctx, perfmon_stats_t *bias,
+                             perfmon_stats_t *spread) {
+    if (!ctx || !ctx->calibrated) {
+        perfmon_set_error("Context not calibrated");
+        return false;
+    }
+
+    if (bias) {
+        fill_stats(bias, ctx->bias, (double)ctx->bias[CALIBRATION_TIME] / 1e9);
+        perfmon_compute_derived(bias);
+    }
+    if (spread) {
+        fill_stats(spread, ctx->spread, (double)ctx->spread[CALIBRATION_TIME] / 1e9);
+    }
+    return true;
+}
+
+/* Print the calibrated bias with its spread */
+void perfmon_print_calibration(const perfmon_context_t *ctx, int fd) {
+    static const char *names[PERFMON_MAX_COUNTERS] = {
+        "cycles", "instructions", "branches", "branch-misses", "cache-references",
+        "cache-misses", "dTLB-load-misses", "iTLB-misses", "page-faults",
+        "minor-faults", "major-faults", "cs", "migrations", "ref-cycles", "task-clock",
+        "node-loads", "node-load-misses"
+    };
     int i;
 
-    if (!ctx) {
-        set_error("Invalid context");
-        return false;
+    if (!ctx || !ctx->calibrated) {
+        return;
     }
 
+    dprintf(fd, "\nMeasurement Bias (%d empty regions, %s):\n", ctx->calibration_runs,
+            ctx->subtract_bias ? "subtracted" : "not subtracted");
     for (i = 0; i < PERFMON_MAX_COUNTERS; i++) {
-        if (ctx->counters[i].enabled && ctx->counters[i].fd != -1) {
-            ioctl(ctx->counters[i].fd, PERF_EVENT_IOC_RESET, 0);
+        if (ctx->enabled & (1u << i)) {
+            dprintf(fd, "%20lu      %-25s # +/- %lu\n", ctx->bias[i], names[i], ctx->spread[i]);
         }
     }
+    dprintf(fd, "%20lu      %-25s # +/- %lu\n", ctx->bias[CALIBRATION_TIME], "ns elapsed",
+            ctx->spread[CALIBRATION_TIME]);
+}
+
+/* Initialize a task accumulator */
+void perfmon_task_init(perfmon_task_t *task) {
+    if (task) {
+        memset(task, 0, sizeof(perfmon_task_t));
+    }
+}
+
+/* Snapshot counters as a task is resumed on this thread */
+bool perfmon_task_switch_in(perfmon_context_t *ctx, perfmon_task_t *task) {
+    if (!ctx || !task) {
+        perfmon_set_error("Invalid context or task");
+        return false;
+    }
+
+    if (!ctx->is_running) {
+        perfmon_set_error("Monitoring not running");
+        return false;
+    }
+
+    if (task->running) {
+        perfmon_set_error("Task already switched in");
+        return false;
+    }
 
+    read_values(ctx, task->snapshot);
+    task->snapshot_ns = ctx->backend->now_ns(ctx->backend_state);
+    task->running = true;
     return true;
 }
 
-/* Cleanup and free resources */
-void perfmon_cleanup(perfmon_context_t *ctx) {
+/* Charge counter deltas since switch-in to the task as it is suspended */
+bool perfmon_task_switch_out(perfmon_context_t *ctx, perfmon_task_t *task) {
+    uint64_t values[PERFMON_MAX_COUNTERS];
+    uint64_t now_ns;
     int i;
 
+    if (!ctx || !task) {
+        perfmon_set_error("Invalid context or task");
+        return false;
+    }
+
+    if (!task->running) {
+        perfmon_set_error("Task not switched in");
+        return false;
+    }
+
+    read_values(ctx, values);
+    now_ns = ctx->backend->now_ns(ctx->backend_state);
+
+    /* A reset or restart since switch-in leaves counts below the snapshot */
+    for (i = 0; i < PERFMON_MAX_COUNTERS; i++) {
+        task->accum[i] += values[i] > task->snapshot[i] ? values[i] - task->snapshot[i] : 0;
+    }
+    task->running_ns += now_ns - task->snapshot_ns;
+    task->slices++;
+    task->running = false;
+    return true;
+}
+
+/* Get accumulated statistics of a task */
+void perfmon_task_get_stats(const perfmon_task_t *task, perfmon_stats_t *stats) {
+    if (!task || !stats) {
+        return;
+    }
+
+    fill_stats(stats, task->accum, (double)task->running_ns / 1e9);
+    stats->host_hash = perfmon_host_hash();
+    stats->turbo_reference = peak_turbo_ratio();
+    perfmon_compute_derived(stats);
+}
+
+/* Reset all counters */
+bool perfmon_reset(perfmon_context_t *ctx) {
+    if (!ctx) {
+        perfmon_set_error("Invalid context");
+        return false;
+    }
+
+    ctx->backend->reset(ctx->backend_state, ctx->enabled);
+    memset(ctx->user_counters, 0, sizeof(ctx->user_counters));
+
+    return true;
+}
+
+/* Cleanup and free resources */
+void perfmon_cleanup(perfmon_context_t *ctx) {
     if (!ctx) {
         return;
     }
 
-    /* Close all file descriptors */
-    for (i = 0; i < PERFMON_MAX_COUNTERS; i++) {
-        if (ctx->counters[i].fd != -1) {
-            close(ctx->counters[i].fd);
+    /* Close all counters */
+    ctx->backend->close(ctx->backend_state);
+    perfmon_os_close(&ctx->os_files);
+
+    free(ctx);
+}
+
+/* Normalize counters by a unit count */
+void perfmon_normalize(const perfmon_stats_t *stats, uint64_t units, perfmon_normalized_t *out) {
+    double n = (double)units;
+
+    if (!stats || !out) {
+        return;
+    }
+
+    memset(out, 0, sizeof(perfmon_normalized_t));
+    out->units = units;
+    if (units == 0) {
+        return;
+    }
+
+    out->cycles_per_unit = (double)stats->cycles / n;
+    out->insn_per_unit = (double)stats->instructions / n;
+    out->cache_misses_per_unit = (double)stats->cache_misses / n;
+    out->branch_misses_per_unit = (double)stats->branch_misses / n;
+}
+
+/* Print user counters with cycles and cache misses per unit */
+static void print_user_counters(const perfmon_stats_t *stats, int fd) {
+    int i, count = perfmon_user_counter_count();
+    perfmon_normalized_t per;
+
+    for (i = 0; i < count; i++) {
+        if (stats->user_counters[i] == 0) {
+            continue;
         }
+        perfmon_normalize(stats, stats->user_counters[i], &per);
+        dprintf(fd, "%20lu      %-25s #    %.2f cycles/%s, %.4f cache-misses/%s\n",
+                stats->user_counters[i], user_counter_names[i],
+                per.cycles_per_unit, user_counter_names[i],
+                per.cache_misses_per_unit, user_counter_names[i]);
     }
+}
 
-    free(ctx);
+/* Print formula-defined metrics */
+static void print_metrics(const perfmon_stats_t *stats, int fd) {
+    int i, count = perfmon_metric_count();
+
+    for (i = 0; i < count; i++) {
+        dprintf(fd, "%20.4f      %s\n", stats->metrics[i], perfmon_metric_name(i));
+    }
+}
+
+/* Print energy domains that counted, with average power */
+static void print_energy(const perfmon_stats_t *stats, int fd) {
+    int i;
+
+    for (i = 0; i < PERFMON_MAX_ENERGY_DOMAINS; i++) {
+        if (stats->energy_joules[i] <= 0.0) {
+            continue;
+        }
+        dprintf(fd, "%20.3f      Joules %-18s #    %.2f W\n", stats->energy_joules[i],
+                perfmon_energy_domain_name((perfmon_energy_domain_t)i),
+                stats->elapsed_time_sec > 0.0 ? stats->energy_joules[i] / stats->elapsed_time_sec : 0.0);
+    }
+}
+
+/* Print pressure if the PSI sampler saw any */
+static void print_pressure(const perfmon_stats_t *stats, int fd) {
+    if (stats->psi_cpu_some + stats->psi_memory_some + stats->psi_io_some <= 0.0) {
+        return;
+    }
+
+    dprintf(fd, "%19.2f%%      cpu pressure (some)\n", stats->psi_cpu_some);
+    dprintf(fd, "%19.2f%%      memory pressure (some)    #    %.2f%% full\n",
+            stats->psi_memory_some, stats->psi_memory_full);
+    dprintf(fd, "%19.2f%%      io pressure (some)        #    %.2f%% full\n",
+            stats->psi_io_some, stats->psi_io_full);
+}
+
+/* Print NUMA placement and node loads if placement was recorded */
+static void print_numa(const perfmon_stats_t *stats, int fd) {
+    if (stats->start_cpu < 0 && stats->stop_cpu < 0) {
+        return;
+    }
+
+    dprintf(fd, "%20lu      node-loads\n", stats->node_loads);
+    dprintf(fd, "%20lu      node-load-misses          #    %.2f%% of node loads remote\n",
+            stats->node_load_misses, stats->remote_load_rate);
+    dprintf(fd, "%20lu      node-migrations           #    cpu %d (node %d) -> cpu %d (node %d)\n",
+            stats->node_migrations, stats->start_cpu, stats->start_node,
+            stats->stop_cpu, stats->stop_node);
+}
+
+/* Print OS counters if they were sampled */
+static void print_os_counters(const perfmon_stats_t *stats, int fd) {
+    if (stats->process_max_rss_kb == 0) {
+        return;
+    }
+
+    dprintf(fd, "%20lu      io-read-bytes             #    %lu read syscalls\n",
+            stats->io_read_bytes, stats->io_syscr);
+    dprintf(fd, "%20lu      io-write-bytes            #    %lu write syscalls\n",
+            stats->io_write_bytes, stats->io_syscw);
+    dprintf(fd, "%20.3f      run-delay (msec)          #    %.1f%% of elapsed waiting for a CPU\n",
+            (double)stats->run_delay_ns / 1e6,
+            stats->elapsed_time_sec > 0.0 ?
+            (double)stats->run_delay_ns / 1e9 / stats->elapsed_time_sec * 100.0 : 0.0);
+    dprintf(fd, "%20lu      voluntary-cs\n", stats->voluntary_switches);
+    dprintf(fd, "%20lu      involuntary-cs\n", stats->involuntary_switches);
+    dprintf(fd, "%20lu      process-max-rss (KB)      #    high-water mark, not a delta\n",
+            stats->process_max_rss_kb);
+    if (stats->os_other_thread) {
+        dprintf(fd, "%20s      (thread counters not attributed: started or stopped on another thread)\n",
+                "");
+    }
 }
 
 /* Print statistics to a file descriptor */
@@ -329,7 +1065,21 @@ void perfmon_print_stats(const perfmon_stats_t *stats, int fd) {
     dprintf(fd, "%20lu      major-faults\n", stats->major_faults);
     dprintf(fd, "%20lu      cs\n", stats->context_switches);
     dprintf(fd, "%20lu      migrations\n", stats->cpu_migrations);
+    dprintf(fd, "%20lu      ref-cycles                #    %.2f  turbo ratio%s\n",
+            stats->ref_cycles, stats->turbo_ratio,
+            stats->throttled ? " (THROTTLED: below the peak clock of this process)" : "");
+    dprintf(fd, "%20.3f      task-clock (msec)         #    %.3f GHz effective\n",
+            (double)stats->task_clock_ns / 1e6, stats->effective_ghz);
+    print_energy(stats, fd);
+    print_os_counters(stats, fd);
+    print_pressure(stats, fd);
+    print_numa(stats, fd);
+    print_user_counters(stats, fd);
+    print_metrics(stats, fd);
     dprintf(fd, "\n%20.9f seconds time elapsed\n", stats->elapsed_time_sec);
+    if (stats->host_hash != 0) {
+        dprintf(fd, "    %016lx      host\n", stats->host_hash);
+    }
 }
 
 /* Get last error message */
@@ -360,12 +1110,12 @@ bool perfmon_is_supported(void) {
 /* Enable specific counter */
 bool perfmon_enable_counter(perfmon_context_t *ctx, perfmon_counter_type_t type) {
     if (!ctx || type >= PERFMON_MAX_COUNTERS) {
-        set_error("Invalid context or counter type");
+        perfmon_set_error("Invalid context or counter type");
         return false;
     }
 
-    if (ctx->counters[type].fd != -1) {
-        ctx->counters[type].enabled = true;
+    if (ctx->available & (1u << type)) {
+        ctx->enabled |= 1u << type;
         return true;
     }
 
@@ -375,11 +1125,402 @@ bool perfmon_enable_counter(perfmon_context_t *ctx, perfmon_counter_type_t type)
 /* Disable specific counter */
 bool perfmon_disable_counter(perfmon_context_t *ctx, perfmon_counter_type_t type) {
     if (!ctx || type >= PERFMON_MAX_COUNTERS) {
-        set_error("Invalid context or counter type");
+        perfmon_set_error("Invalid context or counter type");
+        return false;
+    }
+
+    ctx->enabled &= ~(1u << type);
+    return true;
+}
+
+/* Whether a counter is measured by the context */
+bool perfmon_counter_enabled(const perfmon_context_t *ctx, perfmon_counter_type_t type) {
+    return ctx && type < PERFMON_MAX_COUNTERS && (ctx->enabled & (1u << type)) != 0;
+}
+
+/* Name of the context's backend */
+const char *perfmon_backend_name(const perfmon_context_t *ctx) {
+    return ctx ? ctx->backend->name : NULL;
+}
+
+/* Per-core-type counts of the last interval */
+int perfmon_core_breakdown(const perfmon_context_t *ctx, perfmon_core_type_stats_t *out, int max) {
+    const perfmon_core_pmu_t *pmus;
+    uint64_t values[PERFMON_MAX_COUNTERS];
+    uint64_t total_cycles = 0;
+    int i, n = 0;
+
+    if (!ctx || !out || !ctx->backend->read_pmu || !(ctx->available & PERFMON_HW_COUNTERS)) {
+        return 0;
+    }
+
+    perfmon_core_pmus(&pmus);
+    while (n < max && ctx->backend->read_pmu(ctx->backend_state, n, values)) {
+        memset(&out[n], 0, sizeof(perfmon_core_type_stats_t));
+        strcpy(out[n].pmu, pmus[n].name);
+        out[n].cycles = values[PERFMON_CYCLES];
+        out[n].instructions = values[PERFMON_INSTRUCTIONS];
+        out[n].branch_misses = values[PERFMON_BRANCH_MISSES];
+        out[n].cache_misses = values[PERFMON_CACHE_MISSES];
+        if (out[n].cycles > 0) {
+            out[n].insn_per_cycle = (double)out[n].instructions / (double)out[n].cycles;
+        }
+        total_cycles += out[n].cycles;
+        n++;
+    }
+    for (i = 0; i < n && total_cycles > 0; i++) {
+        out[i].cycle_share = (double)out[i].cycles / (double)total_cycles;
+    }
+    return n;
+}
+
+/* Print the per-core-type breakdown */
+void perfmon_print_core_breakdown(const perfmon_context_t *ctx, int fd) {
+    perfmon_core_type_stats_t types[PERFMON_MAX_CORE_PMUS];
+    int i, n = perfmon_core_breakdown(ctx, types, PERFMON_MAX_CORE_PMUS);
+
+    if (n == 0) {
+        return;
+    }
+
+    dprintf(fd, "\nPer Core Type:\n");
+    dprintf(fd, "%-12s %16s %16s %8s %8s %14s %14s\n", "PMU", "cycles", "instructions", "IPC",
+            "cycles%", "branch-misses", "cache-misses");
+    for (i = 0; i < n; i++) {
+        dprintf(fd, "%-12s %16lu %16lu %8.2f %7.1f%% %14lu %14lu\n", types[i].pmu, types[i].cycles,
+                types[i].instructions, types[i].insn_per_cycle, types[i].cycle_share * 100.0,
+                types[i].branch_misses, types[i].cache_misses);
+    }
+}
+
+/* Advance a mock-backend context */
+bool perfmon_mock_advance(perfmon_context_t *ctx, const perfmon_stats_t *delta) {
+    if (!ctx || !delta || ctx->backend != &perfmon_backend_mock) {
+        perfmon_set_error("Not a mock backend context");
+        return false;
+    }
+
+    perfmon_mock_apply(ctx->backend_state, delta);
+    return true;
+}
+
+
+/* Open a fast-path event group and map user pages for rdpmc */
+bool perfmon_fast_open(perfmon_fast_t *fast, const perfmon_counter_type_t *types, int nr_events) {
+    long page_size = sysconf(_SC_PAGESIZE);
+    void *page;
+    int i;
+
+    if (!fast || !types || nr_events <= 0 || nr_events > PERFMON_FAST_MAX_EVENTS) {
+        perfmon_set_error("Invalid fast-path arguments");
+        return false;
+    }
+
+    memset(fast, 0, sizeof(perfmon_fast_t));
+    fast->group_fd = -1;
+    for (i = 0; i < PERFMON_FAST_MAX_EVENTS; i++) {
+        fast->fds[i] = -1;
+    }
+
+    for (i = 0; i < nr_events; i++) {
+        if (types[i] >= PERFMON_MAX_COUNTERS) {
+            perfmon_set_error("Invalid counter type: %d", (int)types[i]);
+            perfmon_fast_close(fast);
+            return false;
+        }
+
+        fast->fds[i] = perfmon_open_counter(types[i], fast->group_fd, PERF_FORMAT_GROUP);
+        if (fast->fds[i] == -1) {
+            perfmon_fast_close(fast);
+            return false;
+        }
+        if (i == 0) {
+            fast->group_fd = fast->fds[0];
+        }
+        fast->types[i] = types[i];
+        fast->nr_events = i + 1;
+
+        /* A missing user page only costs the rdpmc shortcut */
+        page = mmap(NULL, (size_t)page_size, PROT_READ, MAP_SHARED, fast->fds[i], 0);
+        fast->pages[i] = (page == MAP_FAILED) ? NULL : (struct perf_event_mmap_page *)page;
+    }
+
+    return true;
+}
+
+/* Close a fast-path event group */
+void perfmon_fast_close(perfmon_fast_t *fast) {
+    long page_size = sysconf(_SC_PAGESIZE);
+    int i;
+
+    if (!fast) {
+        return;
+    }
+
+    /* Members first, leader last */
+    for (i = PERFMON_FAST_MAX_EVENTS - 1; i >= 0; i--) {
+        if (fast->pages[i]) {
+            munmap(fast->pages[i], (size_t)page_size);
+            fast->pages[i] = NULL;
+        }
+        if (fast->fds[i] != -1) {
+            close(fast->fds[i]);
+            fast->fds[i] = -1;
+        }
+    }
+    fast->group_fd = -1;
+    fast->nr_events = 0;
+}
+
+/* Pressure is a share of time: average weighted by elapsed time (before total's is updated) */
+static void add_pressure(perfmon_stats_t *total, const perfmon_stats_t *stats) {
+    double t0 = total->elapsed_time_sec, t1 = stats->elapsed_time_sec;
+
+    if (t0 + t1 <= 0.0) {
+        return;
+    }
+    total->psi_cpu_some = (total->psi_cpu_some * t0 + stats->psi_cpu_some * t1) / (t0 + t1);
+    total->psi_memory_some = (total->psi_memory_some * t0 + stats->psi_memory_some * t1) / (t0 + t1);
+    total->psi_memory_full = (total->psi_memory_full * t0 + stats->psi_memory_full * t1) / (t0 + t1);
+    total->psi_io_some = (total->psi_io_some * t0 + stats->psi_io_some * t1) / (t0 + t1);
+    total->psi_io_full = (total->psi_io_full * t0 + stats->psi_io_full * t1) / (t0 + t1);
+}
+
+/* Add the counters of one measurement to a running total */
+static void add_stats(perfmon_stats_t *total, const perfmon_stats_t *stats) {
+    int i;
+
+    total->cycles += stats->cycles;
+    total->instructions += stats->instructions;
+    total->branches += stats->branches;
+    total->branch_misses += stats->branch_misses;
+    total->cache_references += stats->cache_references;
+    total->cache_misses += stats->cache_misses;
+    total->dtlb_load_misses += stats->dtlb_load_misses;
+    total->itlb_misses += stats->itlb_misses;
+    total->page_faults += stats->page_faults;
+    total->minor_faults += stats->minor_faults;
+    total->major_faults += stats->major_faults;
+    total->context_switches += stats->context_switches;
+    total->cpu_migrations += stats->cpu_migrations;
+    total->ref_cycles += stats->ref_cycles;
+    total->task_clock_ns += stats->task_clock_ns;
+    total->node_loads += stats->node_loads;
+    total->node_load_misses += stats->node_load_misses;
+    add_pressure(total, stats);
+    total->elapsed_time_sec += stats->elapsed_time_sec;
+    for (i = 0; i < PERFMON_MAX_USER_COUNTERS; i++) {
+        total->user_counters[i] += stats->user_counters[i];
+    }
+    for (i = 0; i < PERFMON_MAX_ENERGY_DOMAINS; i++) {
+        total->energy_joules[i] += stats->energy_joules[i];
+    }
+    total->io_read_bytes += stats->io_read_bytes;
+    total->io_write_bytes += stats->io_write_bytes;
+    total->io_syscr += stats->io_syscr;
+    total->io_syscw += stats->io_syscw;
+    total->run_delay_ns += stats->run_delay_ns;
+    total->voluntary_switches += stats->voluntary_switches;
+    total->involuntary_switches += stats->involuntary_switches;
+    if (stats->process_max_rss_kb > total->process_max_rss_kb) {
+        total->process_max_rss_kb = stats->process_max_rss_kb;
+    }
+    total->os_other_thread |= stats->os_other_thread;
+    if (stats->turbo_reference > total->turbo_reference) {
+        total->turbo_reference = stats->turbo_reference;
+    }
+    total->start_cpu = stats->start_cpu;
+    total->start_node = stats->start_node;
+    total->stop_cpu = stats->stop_cpu;
+    total->stop_node = stats->stop_node;
+    total->node_migrations += stats->node_migrations;
+    total->host_hash = stats->host_hash;
+
+    perfmon_compute_derived(total);
+}
+
+/* Create a region statistics table */
+perfmon_region_table_t *perfmon_region_table_create_for(const perfmon_region_t *regions,
+                                                        uint32_t nr_regions) {
+    perfmon_region_table_t *table;
+
+    table = (perfmon_region_table_t *)calloc(1, sizeof(perfmon_region_table_t) +
+                                                nr_regions * sizeof(perfmon_region_stats_t));
+    if (!table) {
+        perfmon_set_error("Failed to allocate region table: %s", strerror(errno));
+        return NULL;
+    }
+
+    table->regions = regions;
+    table->nr_regions = nr_regions;
+    return table;
+}
+
+/* Index of a region in a table, or nr_regions if it is not there */
+static uint32_t region_index(const perfmon_region_table_t *table, const perfmon_region_t *region) {
+    if (!table || !region || region < table->regions ||
+        region >= table->regions + table->nr_regions) {
+        return table ? table->nr_regions : 0;
+    }
+    return (uint32_t)(region - table->regions);
+}
+
+/* Add one measurement to the breakdown slot of the node it started on */
+static void add_node_stats(perfmon_node_stats_t *node, const perfmon_stats_t *stats) {
+    node->calls++;
+    node->cycles += stats->cycles;
+    node->instructions += stats->instructions;
+    node->node_loads += stats->node_loads;
+    node->node_load_misses += stats->node_load_misses;
+    node->node_migrations += stats->node_migrations;
+    node->elapsed_time_sec += stats->elapsed_time_sec;
+}
+
+/* Add one measurement to a region */
+bool perfmon_region_record(perfmon_region_table_t *table, const perfmon_region_t *region,
+                           const perfmon_stats_t *stats) {
+    uint32_t id = region_index(table, region);
+
+    if (!table || !stats || id == table->nr_regions) {
+        perfmon_set_error("Invalid region table, region or stats");
         return false;
     }
 
-    ctx->counters[type].enabled = false;
+    table->stats[id].calls++;
+    add_stats(&table->stats[id].total, stats);
+    if (stats->start_node >= 0 && stats->start_node < PERFMON_MAX_NUMA_NODES) {
+        add_node_stats(&table->stats[id].nodes[stats->start_node], stats);
+    }
     return true;
 }
 
+/* Get accumulated statistics of a region */
+const perfmon_region_stats_t *perfmon_region_table_get(const perfmon_region_table_t *table,
+                                                       const perfmon_region_t *region) {
+    uint32_t id = region_index(table, region);
+
+    if (!table || id == table->nr_regions) {
+        return NULL;
+    }
+    return &table->stats[id];
+}
+
+/* Print all regions with at least one call */
+void perfmon_region_table_print(const perfmon_region_table_t *table, int fd) {
+    const perfmon_region_stats_t *rs;
+    uint32_t i;
+
+    if (!table) {
+        return;
+    }
+
+    dprintf(fd, "\nRegion Statistics:\n");
+    dprintf(fd, "==================\n");
+    dprintf(fd, "host %016lx\n", perfmon_host_hash());
+    dprintf(fd, "%-24s %10s %18s %18s %6s %10s %7s %14s\n",
+            "region", "calls", "cycles", "instructions", "IPC", "cache-miss", "GHz", "time(s)");
+    for (i = 0; i < table->nr_regions; i++) {
+        rs = &table->stats[i];
+        if (rs->calls == 0) {
+            continue;
+        }
+        dprintf(fd, "%-24s %10lu %18lu %18lu %6.2f %9.2f%% %6.2f%c %14.9f\n",
+                table->regions[i].name, rs->calls, rs->total.cycles,
+                rs->total.instructions, rs->total.insn_per_cycle,
+                rs->total.cache_miss_rate, rs->total.effective_ghz,
+                rs->total.throttled ? '!' : ' ', rs->total.elapsed_time_sec);
+    }
+}
+
+/* Print the per-node breakdown of regions measured with opts.numa */
+void perfmon_region_table_print_nodes(const perfmon_region_table_t *table, int fd) {
+    const perfmon_node_stats_t *ns;
+    uint32_t i;
+    int n;
+
+    if (!table) {
+        return;
+    }
+
+    dprintf(fd, "\nRegion Statistics by NUMA Node (start node):\n");
+    dprintf(fd, "============================================\n");
+    dprintf(fd, "%-24s %4s %10s %6s %12s %8s %10s %14s\n",
+            "region", "node", "calls", "IPC", "node-loads", "remote", "migrated", "time(s)");
+    for (i = 0; i < table->nr_regions; i++) {
+        for (n = 0; n < PERFMON_MAX_NUMA_NODES; n++) {
+            ns = &table->stats[i].nodes[n];
+            if (ns->calls == 0) {
+                continue;
+            }
+            dprintf(fd, "%-24s %4d %10lu %6.2f %12lu %7.2f%% %10lu %14.9f\n",
+                    table->regions[i].name, n, ns->calls,
+                    ns->cycles > 0 ? (double)ns->instructions / (double)ns->cycles : 0.0,
+                    ns->node_loads,
+                    ns->node_loads > 0 ?
+                    (double)ns->node_load_misses / (double)ns->node_loads * 100.0 : 0.0,
+                    ns->node_migrations, ns->elapsed_time_sec);
+        }
+    }
+}
+
+/* Free a region table */
+void perfmon_region_table_free(perfmon_region_table_t *table) {
+    free(table);
+}
+
+/* Register a user counter name (idempotent) */
+int perfmon_user_counter_register(const char *name) {
+    int i, id = -1;
+
+    if (!name || !name[0] || strlen(name) >= USER_COUNTER_NAME_LEN) {
+        perfmon_set_error("Invalid user counter name");
+        return -1;
+    }
+
+    pthread_mutex_lock(&user_counter_lock);
+    for (i = 0; i < user_counter_count; i++) {
+        if (strcmp(user_counter_names[i], name) == 0) {
+            id = i;
+            break;
+        }
+    }
+    if (id == -1 && user_counter_count < PERFMON_MAX_USER_COUNTERS) {
+        id = user_counter_count;
+        strcpy(user_counter_names[id], name);
+        __atomic_store_n(&user_counter_count, id + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&user_counter_lock);
+
+    if (id == -1) {
+        perfmon_set_error("Too many user counters (max %d)", PERFMON_MAX_USER_COUNTERS);
+    }
+    return id;
+}
+
+/* Number of registered user counters */
+int perfmon_user_counter_count(void) {
+    return __atomic_load_n(&user_counter_count, __ATOMIC_ACQUIRE);
+}
+
+/* Name of a registered user counter */
+const char *perfmon_user_counter_name(int id) {
+    if (id < 0 || id >= perfmon_user_counter_count()) {
+        return NULL;
+    }
+    return user_counter_names[id];
+}
+
+/* Value of a user counter in a stats snapshot */
+uint64_t perfmon_user_counter_get(const perfmon_stats_t *stats, int id) {
+    if (!stats || (unsigned int)id >= PERFMON_MAX_USER_COUNTERS) {
+        return 0;
+    }
+    return stats->user_counters[id];
+}
+
+/* Add to a user counter of this context */
+void perfmon_user_counter_add(perfmon_context_t *ctx, int id, uint64_t delta) {
+    if (ctx && (unsigned int)id < PERFMON_MAX_USER_COUNTERS) {
+        ctx->user_counters[id] += delta;
+    }
+}
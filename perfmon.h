@@ -11,6 +11,7 @@
 #ifndef PERFMON_H
 #define PERFMON_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -33,9 +34,32 @@ typedef enum {
     PERFMON_MAJOR_FAULTS,
     PERFMON_CONTEXT_SWITCHES,
     PERFMON_CPU_MIGRATIONS,
+    PERFMON_REF_CYCLES,         /* unhalted cycles at the nominal (TSC) frequency */
+    PERFMON_TASK_CLOCK,         /* on-CPU time in ns */
+    PERFMON_NODE_LOADS,         /* loads served by a memory node (opts.numa) */
+    PERFMON_NODE_LOAD_MISSES,   /* ... by a remote node (opts.numa) */
     PERFMON_MAX_COUNTERS
 } perfmon_counter_type_t;
 
+/* Maximum number of user-defined software counters */
+#define PERFMON_MAX_USER_COUNTERS 8
+
+/* Maximum number of formula-defined metrics (see perfmon_expr.h) */
+#define PERFMON_MAX_METRICS 8
+
+/* NUMA nodes with their own slot in the per-node region breakdown */
+#define PERFMON_MAX_NUMA_NODES 8
+
+/* RAPL energy domains of the power PMU */
+typedef enum {
+    PERFMON_ENERGY_PKG = 0,     /* whole package */
+    PERFMON_ENERGY_CORES,       /* cores only */
+    PERFMON_ENERGY_RAM,         /* DRAM */
+    PERFMON_ENERGY_GPU,         /* integrated graphics */
+    PERFMON_ENERGY_PSYS,        /* platform (SoC) */
+    PERFMON_MAX_ENERGY_DOMAINS
+} perfmon_energy_domain_t;
+
 /* Performance statistics structure */
 typedef struct {
     uint64_t cycles;
@@ -51,12 +75,69 @@ typedef struct {
     uint64_t major_faults;
     uint64_t context_switches;
     uint64_t cpu_migrations;
+    uint64_t ref_cycles;
+    uint64_t task_clock_ns;
+    uint64_t node_loads;
+    uint64_t node_load_misses;
     double elapsed_time_sec;  /* elapsed time in seconds */
     
     /* Derived metrics */
     double insn_per_cycle;
     double branch_miss_rate;
     double cache_miss_rate;
+    double effective_ghz;     /* cycles per on-CPU nanosecond */
+    double turbo_ratio;       /* cycles / ref_cycles: > 1 turbo, < 1 below nominal */
+    double turbo_reference;   /* max(1, peak turbo_ratio of the process when measured) */
+    bool throttled;           /* turbo_ratio < 0.95 * turbo_reference: cycles not comparable */
+    double remote_load_rate;  /* % of node loads served by a remote node */
+
+    /*
+     * Energy in joules used by all packages while the region ran (by wall
+     * time, CPU-wide: concurrent regions see the same joules); 0 unless
+     * opts.energy is set and the domain is readable
+     */
+    double energy_joules[PERFMON_MAX_ENERGY_DOMAINS];
+
+    /*
+     * OS resource counters of the thread that created the context
+     * (opts.os_counters), deltas of the region.  A start or stop on another
+     * thread cannot be attributed: os_other_thread is set and the deltas are 0.
+     */
+    uint64_t io_read_bytes;         /* bytes fetched from storage */
+    uint64_t io_write_bytes;        /* bytes sent to storage */
+    uint64_t io_syscr;              /* read-type syscalls */
+    uint64_t io_syscw;              /* write-type syscalls */
+    uint64_t run_delay_ns;          /* runnable but waiting for a CPU */
+    uint64_t voluntary_switches;    /* blocked: I/O, locks, sleeps */
+    uint64_t involuntary_switches;  /* preempted */
+    uint64_t process_max_rss_kb;    /* RSS high-water mark of the whole process, at stop; not a delta */
+    bool os_other_thread;           /* started or stopped off the creating thread */
+
+    /* Share of time stalled on a resource during the region, % (perfmon_psi.h) */
+    double psi_cpu_some;
+    double psi_memory_some;
+    double psi_memory_full;
+    double psi_io_some;
+    double psi_io_full;
+
+    /*
+     * NUMA placement (opts.numa): CPU and node at start and stop, -1 if not
+     * recorded; region totals keep the last measurement's
+     */
+    int start_cpu;
+    int start_node;
+    int stop_cpu;
+    int stop_node;
+    uint64_t node_migrations;       /* regions that stopped on another node than they started */
+
+    /* Host that measured the region (perfmon_host_hash()) */
+    uint64_t host_hash;
+
+    /* User-defined software counters, indexed by registered id */
+    uint64_t user_counters[PERFMON_MAX_USER_COUNTERS];
+
+    /* Formula-defined metrics, indexed by defined id */
+    double metrics[PERFMON_MAX_METRICS];
 } perfmon_stats_t;
 
 /* Performance monitor context (opaque handle) */
@@ -68,6 +149,51 @@ typedef struct perfmon_context perfmon_context_t;
  */
 perfmon_context_t *perfmon_init(void);
 
+/*
+ * Counter backends
+ *
+ * AUTO uses perf_event, or rusage when no perf event can be opened; the
+ * PERFMON_BACKEND environment variable ("perf_event", "rusage", "mock")
+ * overrides AUTO.
+ */
+typedef enum {
+    PERFMON_BACKEND_AUTO = 0,
+    PERFMON_BACKEND_PERF_EVENT,     /* perf_event_open(2) counters */
+    PERFMON_BACKEND_RUSAGE,         /* getrusage(2) faults and context switches, clock time */
+    PERFMON_BACKEND_MOCK            /* deterministic counters for tests */
+} perfmon_backend_t;
+
+/* Context options (fill with perfmon_options_init, then override) */
+typedef struct {
+    bool calibrate;         /* measure the cost of an empty region at init */
+    bool subtract_bias;     /* subtract it in perfmon_stop() (implies calibrate) */
+    int calibration_runs;   /* empty regions measured (default 51) */
+    perfmon_backend_t backend;
+    bool energy;            /* also read RAPL energy counters, if available */
+    bool os_counters;       /* also sample /proc I/O, schedstat and getrusage */
+    bool numa;              /* also record CPU/node placement and count node loads */
+
+    /*
+     * Mock backend: step i (counters and elapsed_time_sec) is what the i-th
+     * start/stop interval measures, cycling; copied at init
+     */
+    const perfmon_stats_t *mock_script;
+    int mock_script_len;
+    /* Mock backend: the calibrated bias (NULL: none), copied; uses no script step */
+    const perfmon_stats_t *mock_bias;
+} perfmon_options_t;
+
+/*
+ * Fill options with the defaults used by perfmon_init()
+ */
+void perfmon_options_init(perfmon_options_t *opts);
+
+/*
+ * Initialize a context with options (NULL: defaults)
+ * Returns: context handle on success, NULL on failure
+ */
+perfmon_context_t *perfmon_init_with_options(const perfmon_options_t *opts);
+
 /*
  * Start performance monitoring
  * Returns: true on success, false on failure
@@ -80,6 +206,12 @@ bool perfmon_start(perfmon_context_t *ctx);
  */
 bool perfmon_stop(perfmon_context_t *ctx, perfmon_stats_t *stats);
 
+/*
+ * Read counters of a running context without stopping it
+ * Returns: true on success, false on failure
+ */
+bool perfmon_read(perfmon_context_t *ctx, perfmon_stats_t *stats);
+
 /*
  * Reset all counters (without stopping)
  * Returns: true on success, false on failure
@@ -108,6 +240,129 @@ const char *perfmon_get_error(void);
  */
 bool perfmon_is_supported(void);
 
+/*
+ * Capability probing
+ *
+ * perfmon_probe() checks what this process can measure and why not,
+ * once per process (later calls return the cached result):
+ *
+ *   perfmon_caps_t caps;
+ *   perfmon_probe(&caps);
+ *   if (caps.cheapest_mode == PERFMON_MODE_RDPMC) ...
+ *   perfmon_print_caps(&caps, STDERR_FILENO);
+ */
+
+/* Measurement modes, cheapest first */
+typedef enum {
+    PERFMON_MODE_RDPMC = 0,     /* perfmon_fast_sample() without syscalls */
+    PERFMON_MODE_GROUPED,       /* perfmon_fast_* group, one read() per sample */
+    PERFMON_MODE_PER_FD,        /* perfmon_start/stop, one syscall per counter */
+    PERFMON_MODE_RUSAGE         /* no perf events: rusage backend only */
+} perfmon_mode_t;
+
+#define PERFMON_MAX_CORE_PMUS 4
+#define PERFMON_PMU_NAME_LEN  32
+
+typedef struct {
+    uint32_t available;                     /* bit per perfmon_counter_type_t that opens */
+    int open_errno[PERFMON_MAX_COUNTERS];   /* why a counter does not open (0: it does) */
+    int paranoid;                           /* perf_event_paranoid (-100: unreadable) */
+    bool rdpmc;                             /* cap_user_rdpmc on a hardware event */
+    bool user_time;                         /* cap_user_time: TSC conversion in the mmap page */
+    int gp_counters;                        /* generic PMU counters per CPU (0: unknown) */
+    int fixed_counters;                     /* fixed PMU counters per CPU (0: unknown/none) */
+    bool nmi_watchdog;                      /* the NMI watchdog holds one generic counter */
+    int nr_core_pmus;                       /* > 1 on hybrid CPUs */
+    char core_pmus[PERFMON_MAX_CORE_PMUS][PERFMON_PMU_NAME_LEN];  /* e.g. cpu_core, cpu_atom */
+    int hw_events;                          /* hardware events a context opens */
+    bool multiplexed;                       /* they were time-shared in a trial run */
+    perfmon_mode_t cheapest_mode;
+} perfmon_caps_t;
+
+/*
+ * Probe capabilities (cached per process)
+ * Returns: true on success, false on invalid arguments
+ */
+bool perfmon_probe(perfmon_caps_t *caps);
+
+/*
+ * Print a capability report, with the reason for every missing counter
+ */
+void perfmon_print_caps(const perfmon_caps_t *caps, int fd);
+
+/*
+ * Host metadata
+ *
+ * Counts are only comparable between like machines.  perfmon_host_info()
+ * describes the one that produced them, captured once per process; its
+ * hash is stamped on every perfmon_stats_t (host_hash) and on the reports,
+ * so records from a heterogeneous fleet can be grouped by hardware:
+ *
+ *   perfmon_host_t host;
+ *   perfmon_host_info(&host);
+ *   perfmon_print_host(&host, STDOUT_FILENO);   // once, as a trace header
+ */
+#define PERFMON_HOST_STR_LEN 64
+
+typedef struct {
+    char cpu_model[PERFMON_HOST_STR_LEN];   /* e.g. "Intel(R) Xeon(R) Gold 6338 CPU @ 2.00GHz" */
+    char microcode[PERFMON_HOST_STR_LEN];   /* revision, "" if unknown */
+    uint32_t l1d_kb;                        /* cache sizes of cpu0 in KiB (0: unknown) */
+    uint32_t l1i_kb;
+    uint32_t l2_kb;
+    uint32_t l3_kb;
+    uint32_t cache_line_size;               /* bytes */
+    int online_cpus;
+    int threads_per_core;
+    bool smt_active;
+    int numa_nodes;
+    char governor[PERFMON_HOST_STR_LEN];    /* cpufreq scaling governor, "" without cpufreq */
+    int perf_event_paranoid;                /* -100: unreadable */
+    char kernel[PERFMON_HOST_STR_LEN];      /* uname release */
+    char hypervisor[PERFMON_HOST_STR_LEN];  /* "kvm", "xen", ..., "" on bare metal */
+    uint64_t hash;                          /* FNV-1a of all of the above */
+} perfmon_host_t;
+
+/*
+ * Host metadata (captured once per process)
+ * Returns: true on success, false on invalid arguments
+ */
+bool perfmon_host_info(perfmon_host_t *host);
+
+/*
+ * Hash of the host metadata, as stored in perfmon_stats_t.host_hash
+ */
+uint64_t perfmon_host_hash(void);
+
+/*
+ * Print the host metadata block
+ */
+void perfmon_print_host(const perfmon_host_t *host, int fd);
+
+/*
+ * Self-overhead calibration
+ *
+ * A start/stop pair retires instructions and cycles inside the measured
+ * window.  With opts.calibrate the context measures empty regions at init
+ * and keeps, per counter, the median (bias) and the median absolute
+ * deviation (spread, the residual uncertainty after subtraction).  With
+ * opts.subtract_bias perfmon_stop() and perfmon_read() subtract the bias,
+ * clamping at zero.  The first context of a process with a given backend,
+ * counter set and samplers measures; later ones reuse its calibration.
+ */
+
+/*
+ * Get the bias and spread of a calibrated context (either may be NULL)
+ * Returns: true on success, false if the context was not calibrated
+ */
+bool perfmon_get_calibration(const perfmon_context_t *ctx, perfmon_stats_t *bias,
+                             perfmon_stats_t *spread);
+
+/*
+ * Print the bias of each counter with its spread
+ */
+void perfmon_print_calibration(const perfmon_context_t *ctx, int fd);
+
 /*
  * Enable/disable specific counters (for fine-grained control)
  * By default, all counters are enabled
@@ -115,6 +370,329 @@ bool perfmon_is_supported(void);
 bool perfmon_enable_counter(perfmon_context_t *ctx, perfmon_counter_type_t type);
 bool perfmon_disable_counter(perfmon_context_t *ctx, perfmon_counter_type_t type);
 
+/*
+ * Whether start/stop count a counter: the backend opened it and it is enabled.
+ * Under the rusage backend this is true for the software counters it emulates.
+ */
+bool perfmon_counter_enabled(const perfmon_context_t *ctx, perfmon_counter_type_t type);
+
+/*
+ * Name of the backend a context measures with ("perf_event", "rusage", "mock")
+ */
+const char *perfmon_backend_name(const perfmon_context_t *ctx);
+
+/*
+ * Advance a mock-backend context: enabled counters grow by delta's counters,
+ * the clock by delta->elapsed_time_sec
+ * Returns: true on success, false if ctx does not use the mock backend
+ */
+bool perfmon_mock_advance(perfmon_context_t *ctx, const perfmon_stats_t *delta);
+
+/*
+ * RAPL energy domains that can be read, bit per perfmon_energy_domain_t;
+ * 0 without a power PMU or without permission (system-wide events need
+ * perf_event_paranoid <= 0 or CAP_PERFMON)
+ */
+uint32_t perfmon_energy_domains(void);
+
+/*
+ * Name of an energy domain ("energy-pkg", ...)
+ */
+const char *perfmon_energy_domain_name(perfmon_energy_domain_t domain);
+
+/*
+ * NUMA topology from /sys/devices/system/node, read once per process
+ * Returns: number of nodes (highest node id + 1), 1 without NUMA support
+ */
+int perfmon_numa_nodes(void);
+
+/*
+ * NUMA node of a CPU
+ * Returns: node id, -1 if the CPU is unknown
+ */
+int perfmon_numa_node_of_cpu(int cpu);
+
+/*
+ * Hybrid CPUs (P-cores and E-cores): hardware counters are opened once per
+ * core PMU and summed in perfmon_stats_t; the breakdown shows where the
+ * last interval ran
+ */
+typedef struct {
+    char pmu[PERFMON_PMU_NAME_LEN];     /* e.g. cpu_core, cpu_atom */
+    uint64_t cycles;
+    uint64_t instructions;
+    uint64_t branch_misses;
+    uint64_t cache_misses;
+    double insn_per_cycle;
+    double cycle_share;                 /* fraction of all cycles counted on this PMU */
+} perfmon_core_type_stats_t;
+
+/*
+ * Per-core-type counts of the last (or running) interval, raw (no bias
+ * subtraction); out holds up to max entries
+ * Returns: number of core types, 0 if the CPU is not hybrid
+ */
+int perfmon_core_breakdown(const perfmon_context_t *ctx, perfmon_core_type_stats_t *out, int max);
+
+/*
+ * Print the per-core-type breakdown (nothing on non-hybrid CPUs)
+ */
+void perfmon_print_core_breakdown(const perfmon_context_t *ctx, int fd);
+
+/*
+ * User-defined software counters
+ *
+ * Application events (tuples processed, bytes hashed, buckets scanned, ...)
+ * counted next to the hardware counters.  Names are registered once per
+ * process; each context keeps its slots in its own cache line, so adding is
+ * a plain increment with no sharing between threads.  Slots are cleared by
+ * perfmon_start()/perfmon_reset() and reported in perfmon_stats_t.
+ */
+
+/*
+ * Register a counter name; registering an existing name returns its id
+ * Returns: id (0..PERFMON_MAX_USER_COUNTERS-1) on success, -1 on failure
+ */
+int perfmon_user_counter_register(const char *name);
+
+/*
+ * Number of registered user counters / name of one (NULL if unknown)
+ */
+int perfmon_user_counter_count(void);
+const char *perfmon_user_counter_name(int id);
+
+/*
+ * Add delta to a user counter of this context
+ */
+void perfmon_user_counter_add(perfmon_context_t *ctx, int id, uint64_t delta);
+
+/*
+ * Value of a user counter in a stats snapshot (0 for an invalid id)
+ */
+uint64_t perfmon_user_counter_get(const perfmon_stats_t *stats, int id);
+
+/* Counters normalized by a unit count (tuples, probes, bytes, ...) */
+typedef struct {
+    uint64_t units;
+    double cycles_per_unit;
+    double insn_per_unit;
+    double cache_misses_per_unit;   /* LLC misses */
+    double branch_misses_per_unit;
+} perfmon_normalized_t;
+
+/*
+ * Normalize counters by a unit count; all ratios are 0 when units is 0
+ */
+void perfmon_normalize(const perfmon_stats_t *stats, uint64_t units, perfmon_normalized_t *out);
+
+/*
+ * Per-task counter virtualization
+ *
+ * For coroutines/fibers that multiplex many logical tasks on one thread.
+ * While the thread's context is running, call perfmon_task_switch_in() when
+ * a task is resumed and perfmon_task_switch_out() when it suspends; the
+ * counter deltas in between are charged to that task only.
+ */
+typedef struct {
+    uint64_t snapshot[PERFMON_MAX_COUNTERS];  /* counter values at switch-in */
+    uint64_t accum[PERFMON_MAX_COUNTERS];     /* charged to this task so far */
+    uint64_t snapshot_ns;
+    uint64_t running_ns;                      /* time spent switched in */
+    uint64_t slices;                          /* number of switch-in/out pairs */
+    bool running;
+} perfmon_task_t;
+
+/*
+ * Initialize (or clear) a task accumulator
+ */
+void perfmon_task_init(perfmon_task_t *task);
+
+/*
+ * Mark a task as resumed / suspended on the context's thread
+ * Returns: true on success, false on failure
+ */
+bool perfmon_task_switch_in(perfmon_context_t *ctx, perfmon_task_t *task);
+bool perfmon_task_switch_out(perfmon_context_t *ctx, perfmon_task_t *task);
+
+/*
+ * Get statistics accumulated by a task (elapsed time is time switched in)
+ */
+void perfmon_task_get_stats(const perfmon_task_t *task, perfmon_stats_t *stats);
+
+/*
+ * Static region registry
+ *
+ * PERFMON_REGION(name) defines a region descriptor in the "perfmon_regions"
+ * ELF section.  The linker gathers the descriptors of a module into one array
+ * bounded by __start_perfmon_regions/__stop_perfmon_regions, so a region's id
+ * is its index in that array: recording indexes a table with no hashing,
+ * string handling or registration lock.
+ *
+ *   PERFMON_REGION(hash_probe);
+ *
+ *   perfmon_region_table_t *table = perfmon_region_table_create();
+ *   perfmon_start(ctx);
+ *   probe();
+ *   perfmon_stop(ctx, &stats);
+ *   perfmon_region_record(table, &hash_probe, &stats);
+ *
+ * The section bounds are resolved in the calling module (inline functions),
+ * so this works for both static and shared linking of libperfmon.
+ */
+typedef struct {
+    const char *name;
+    const char *file;
+    uint32_t line;
+} __attribute__((aligned(32))) perfmon_region_t;
+
+#define PERFMON_REGION(var) \
+    static perfmon_region_t var \
+    __attribute__((section("perfmon_regions"), used)) = {#var, __FILE__, __LINE__}
+
+extern perfmon_region_t __start_perfmon_regions[] __attribute__((weak));
+extern perfmon_region_t __stop_perfmon_regions[] __attribute__((weak));
+
+/* Number of regions defined in this module */
+static inline uint32_t perfmon_region_count(void) {
+    if (!__start_perfmon_regions) {
+        return 0;
+    }
+    return (uint32_t)(__stop_perfmon_regions - __start_perfmon_regions);
+}
+
+/* Dense id of a region: its index in the section */
+static inline uint32_t perfmon_region_id(const perfmon_region_t *region) {
+    return (uint32_t)(region - __start_perfmon_regions);
+}
+
+/* Region descriptor by id (NULL if out of range) */
+static inline const perfmon_region_t *perfmon_region_get(uint32_t id) {
+    return id < perfmon_region_count() ? &__start_perfmon_regions[id] : NULL;
+}
+
+/* Calls of a region that started on one NUMA node (opts.numa) */
+typedef struct {
+    uint64_t calls;
+    uint64_t cycles;
+    uint64_t instructions;
+    uint64_t node_loads;
+    uint64_t node_load_misses;
+    uint64_t node_migrations;
+    double elapsed_time_sec;
+} perfmon_node_stats_t;
+
+/* Accumulated statistics of one region */
+typedef struct {
+    uint64_t calls;
+    perfmon_stats_t total;  /* summed counters, derived metrics of the sum */
+    perfmon_node_stats_t nodes[PERFMON_MAX_NUMA_NODES];    /* by start node */
+} perfmon_region_stats_t;
+
+/* Per-thread table of region statistics (opaque handle) */
+typedef struct perfmon_region_table perfmon_region_table_t;
+
+/*
+ * Create a table for an explicit region array
+ * Returns: table on success, NULL on failure
+ */
+perfmon_region_table_t *perfmon_region_table_create_for(const perfmon_region_t *regions,
+                                                        uint32_t nr_regions);
+
+/* Create a table for all regions of the calling module */
+static inline perfmon_region_table_t *perfmon_region_table_create(void) {
+    return perfmon_region_table_create_for(__start_perfmon_regions, perfmon_region_count());
+}
+
+/*
+ * Add one measurement to a region
+ * Returns: true on success, false if the region is not in the table
+ */
+bool perfmon_region_record(perfmon_region_table_t *table, const perfmon_region_t *region,
+                           const perfmon_stats_t *stats);
+
+/*
+ * Get accumulated statistics of a region (NULL if not in the table)
+ */
+const perfmon_region_stats_t *perfmon_region_table_get(const perfmon_region_table_t *table,
+                                                       const perfmon_region_t *region);
+
+/*
+ * Print all regions with at least one call
+ */
+void perfmon_region_table_print(const perfmon_region_table_t *table, int fd);
+
+/*
+ * Print the per-node breakdown of regions measured with opts.numa
+ */
+void perfmon_region_table_print_nodes(const perfmon_region_table_t *table, int fd);
+
+/*
+ * Free a region table
+ */
+void perfmon_region_table_free(perfmon_region_table_t *table);
+
+/*
+ * Compile-time instrumentation levels
+ *
+ * Build with -DPERFMON_LEVEL=N to keep only regions at level N or below:
+ *   0  off    - every region compiles to nothing
+ *   1  query  - whole query / statement regions
+ *   2  node   - executor node regions (HashJoin, NestLoop, ...)
+ *   3  fine   - inner loop regions (default)
+ *
+ * PERFMON_AT_QUERY/NODE/FINE(...) keep their arguments only when the level is
+ * enabled, so disabled instrumentation is removed by the preprocessor even at
+ * -O0.  The perfmon_level_*() inline functions branch on a constant and fold
+ * away under optimization.
+ */
+#define PERFMON_LEVEL_OFF   0
+#define PERFMON_LEVEL_QUERY 1
+#define PERFMON_LEVEL_NODE  2
+#define PERFMON_LEVEL_FINE  3
+
+#ifndef PERFMON_LEVEL
+#define PERFMON_LEVEL PERFMON_LEVEL_FINE
+#endif
+
+#define PERFMON_LEVEL_ENABLED(level) \
+    ((level) > PERFMON_LEVEL_OFF && (level) <= PERFMON_LEVEL)
+
+#if PERFMON_LEVEL >= PERFMON_LEVEL_QUERY
+#define PERFMON_AT_QUERY(...) __VA_ARGS__
+#else
+#define PERFMON_AT_QUERY(...)
+#endif
+
+#if PERFMON_LEVEL >= PERFMON_LEVEL_NODE
+#define PERFMON_AT_NODE(...) __VA_ARGS__
+#else
+#define PERFMON_AT_NODE(...)
+#endif
+
+#if PERFMON_LEVEL >= PERFMON_LEVEL_FINE
+#define PERFMON_AT_FINE(...) __VA_ARGS__
+#else
+#define PERFMON_AT_FINE(...)
+#endif
+
+/*
+ * Start/stop a region at the given level
+ * Returns: false without touching ctx when the level is compiled out
+ */
+static inline bool perfmon_level_start(int level, perfmon_context_t *ctx) {
+    if (!PERFMON_LEVEL_ENABLED(level)) {
+        return false;
+    }
+    return perfmon_start(ctx);
+}
+
+static inline bool perfmon_level_stop(int level, perfmon_context_t *ctx, perfmon_stats_t *stats) {
+    if (!PERFMON_LEVEL_ENABLED(level)) {
+        return false;
+    }
+    return perfmon_stop(ctx, stats);
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,485 @@
+/*
+ * libperfmon - C++ Interface
+ *
+ * Header-only C++ wrappers around libperfmon:
+ *   - perfmon::Context      move-only handle owning a perfmon_context_t
+ *   - perfmon::CounterSet   compile-time selected event group (no library needed)
+ *   - perfmon::Scope        RAII region that starts on entry and stops on exit
+ *   - perfmon::TaskScope    charges a coroutine's counters to its perfmon_task_t
+ *
+ * CounterSet<Cycles, Instructions, LLCMisses> opens exactly the named events
+ * as one perf event group.  The event table and the sample layout are fixed at
+ * compile time, so start/stop are a pair of group ioctls and a single read()
+ * with no per-counter enabled checks.
+ *
+ * Requires C++17.  PERFMON_LEVEL applies here too: see perfmon::LevelScope.
+ */
+
+#ifndef PERFMON_HPP
+#define PERFMON_HPP
+
+#include "perfmon.h"
+
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <type_traits>
+#include <utility>
+
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#endif
+
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+namespace perfmon {
+
+/* Compile-time description of a single perf event */
+struct EventDesc {
+    uint32_t type;
+    uint64_t config;
+    const char *name;
+};
+
+namespace detail {
+
+constexpr uint64_t cache_config(uint64_t cache, uint64_t op, uint64_t result) {
+    return cache | (op << 8) | (result << 16);
+}
+
+template <typename T, typename... Ts>
+struct index_of;
+
+template <typename T, typename... Ts>
+struct index_of<T, T, Ts...> : std::integral_constant<std::size_t, 0> {};
+
+template <typename T, typename U, typename... Ts>
+struct index_of<T, U, Ts...>
+    : std::integral_constant<std::size_t, 1 + index_of<T, Ts...>::value> {};
+
+template <typename... Ts>
+struct all_distinct : std::true_type {};
+
+template <typename T, typename... Ts>
+struct all_distinct<T, Ts...>
+    : std::bool_constant<(!std::is_same_v<T, Ts> && ...) && all_distinct<Ts...>::value> {};
+
+inline double timespec_diff_sec(const struct timespec &start, const struct timespec &end) {
+    return (double)(end.tv_sec - start.tv_sec) +
+           (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+} /* namespace detail */
+
+/*
+ * Event tags (same events as the C API)
+ */
+struct Cycles {
+    static constexpr EventDesc desc{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"};
+};
+struct Instructions {
+    static constexpr EventDesc desc{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions"};
+};
+struct Branches {
+    static constexpr EventDesc desc{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS, "branches"};
+};
+struct BranchMisses {
+    static constexpr EventDesc desc{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch-misses"};
+};
+struct CacheReferences {
+    static constexpr EventDesc desc{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES, "cache-references"};
+};
+struct CacheMisses {
+    static constexpr EventDesc desc{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache-misses"};
+};
+struct LLCMisses {
+    static constexpr EventDesc desc{PERF_TYPE_HW_CACHE,
+        detail::cache_config(PERF_COUNT_HW_CACHE_LL, PERF_COUNT_HW_CACHE_OP_READ,
+                             PERF_COUNT_HW_CACHE_RESULT_MISS),
+        "LLC-load-misses"};
+};
+struct DTLBLoadMisses {
+    static constexpr EventDesc desc{PERF_TYPE_HW_CACHE,
+        detail::cache_config(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ,
+                             PERF_COUNT_HW_CACHE_RESULT_MISS),
+        "dTLB-load-misses"};
+};
+struct ITLBMisses {
+    static constexpr EventDesc desc{PERF_TYPE_HW_CACHE,
+        detail::cache_config(PERF_COUNT_HW_CACHE_ITLB, PERF_COUNT_HW_CACHE_OP_READ,
+                             PERF_COUNT_HW_CACHE_RESULT_MISS),
+        "iTLB-misses"};
+};
+struct PageFaults {
+    static constexpr EventDesc desc{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "page-faults"};
+};
+struct MinorFaults {
+    static constexpr EventDesc desc{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MIN, "minor-faults"};
+};
+struct MajorFaults {
+    static constexpr EventDesc desc{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS_MAJ, "major-faults"};
+};
+struct ContextSwitches {
+    static constexpr EventDesc desc{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "cs"};
+};
+struct CPUMigrations {
+    static constexpr EventDesc desc{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS, "migrations"};
+};
+struct RefCycles {
+    static constexpr EventDesc desc{PERF_TYPE_HARDWARE, PERF_COUNT_HW_REF_CPU_CYCLES, "ref-cycles"};
+};
+struct TaskClock {
+    static constexpr EventDesc desc{PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task-clock"};
+};
+struct NodeLoads {
+    static constexpr EventDesc desc{PERF_TYPE_HW_CACHE,
+        detail::cache_config(PERF_COUNT_HW_CACHE_NODE, PERF_COUNT_HW_CACHE_OP_READ,
+                             PERF_COUNT_HW_CACHE_RESULT_ACCESS),
+        "node-loads"};
+};
+struct NodeLoadMisses {
+    static constexpr EventDesc desc{PERF_TYPE_HW_CACHE,
+        detail::cache_config(PERF_COUNT_HW_CACHE_NODE, PERF_COUNT_HW_CACHE_OP_READ,
+                             PERF_COUNT_HW_CACHE_RESULT_MISS),
+        "node-load-misses"};
+};
+
+/*
+ * Move-only handle for the C API context.
+ * Collects the full perfmon_stats_t set.
+ */
+class Context {
+public:
+    using result_type = perfmon_stats_t;
+
+    Context() : ctx_(perfmon_init()) {}
+    ~Context() { perfmon_cleanup(ctx_); }
+
+    Context(const Context &) = delete;
+    Context &operator=(const Context &) = delete;
+
+    Context(Context &&other) noexcept : ctx_(std::exchange(other.ctx_, nullptr)) {}
+    Context &operator=(Context &&other) noexcept {
+        if (this != &other) {
+            perfmon_cleanup(ctx_);
+            ctx_ = std::exchange(other.ctx_, nullptr);
+        }
+        return *this;
+    }
+
+    explicit operator bool() const { return ctx_ != nullptr; }
+    perfmon_context_t *get() const { return ctx_; }
+
+    bool start() { return perfmon_start(ctx_); }
+    bool stop(perfmon_stats_t &stats) { return perfmon_stop(ctx_, &stats); }
+    bool read(perfmon_stats_t &stats) { return perfmon_read(ctx_, &stats); }
+    bool reset() { return perfmon_reset(ctx_); }
+
+    static const char *error() { return perfmon_get_error(); }
+
+private:
+    perfmon_context_t *ctx_;
+};
+
+/*
+ * Event group with a compile-time event list.
+ *
+ * Only the named events are opened.  They are scheduled together as a group
+ * and read with PERF_FORMAT_GROUP, so all values come from the same window.
+ */
+template <typename... Events>
+class CounterSet {
+    static_assert(sizeof...(Events) > 0, "CounterSet needs at least one event");
+    static_assert(detail::all_distinct<Events...>::value, "CounterSet events must be distinct");
+
+public:
+    static constexpr std::size_t size = sizeof...(Events);
+    static constexpr std::array<EventDesc, size> events{{Events::desc...}};
+
+    template <typename E>
+    static constexpr std::size_t index_of() {
+        return detail::index_of<E, Events...>::value;
+    }
+
+    /* Values for one measurement window, laid out in event order */
+    struct Sample {
+        std::array<uint64_t, size> values{};
+        double elapsed_time_sec = 0.0;
+
+        template <typename E>
+        uint64_t get() const { return values[index_of<E>()]; }
+
+        template <typename Num, typename Den>
+        double ratio() const {
+            uint64_t den = get<Den>();
+            return den ? (double)get<Num>() / (double)den : 0.0;
+        }
+    };
+
+    using result_type = Sample;
+
+    CounterSet() { open(); }
+    ~CounterSet() { close(); }
+
+    CounterSet(const CounterSet &) = delete;
+    CounterSet &operator=(const CounterSet &) = delete;
+
+    CounterSet(CounterSet &&other) noexcept
+        : fds_(std::exchange(other.fds_, closed_fds())),
+          start_time_(other.start_time_),
+          error_(other.error_) {}
+
+    CounterSet &operator=(CounterSet &&other) noexcept {
+        if (this != &other) {
+            close();
+            fds_ = std::exchange(other.fds_, closed_fds());
+            start_time_ = other.start_time_;
+            error_ = other.error_;
+        }
+        return *this;
+    }
+
+    explicit operator bool() const { return fds_[0] != -1; }
+    const char *error() const { return std::strerror(error_); }
+
+    bool start() {
+        if (ioctl(fds_[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP) == -1 ||
+            ioctl(fds_[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP) == -1) {
+            error_ = errno;
+            return false;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &start_time_);
+        return true;
+    }
+
+    /* Read the running group without stopping it */
+    bool read(Sample &sample) {
+        group_read_t buf;
+        struct timespec now;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (::read(fds_[0], &buf, sizeof(buf)) != (ssize_t)sizeof(buf)) {
+            error_ = errno;
+            return false;
+        }
+        for (std::size_t i = 0; i < size; i++) {
+            sample.values[i] = buf.values[i];
+        }
+        sample.elapsed_time_sec = detail::timespec_diff_sec(start_time_, now);
+        return true;
+    }
+
+    bool stop(Sample &sample) {
+        if (ioctl(fds_[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP) == -1) {
+            error_ = errno;
+            return false;
+        }
+        return read(sample);
+    }
+
+private:
+    /* Layout returned by read() with PERF_FORMAT_GROUP */
+    struct group_read_t {
+        uint64_t nr;
+        uint64_t values[size];
+    };
+
+    static std::array<int, size> closed_fds() {
+        std::array<int, size> fds;
+        fds.fill(-1);
+        return fds;
+    }
+
+    void open() {
+        fds_ = closed_fds();
+        for (std::size_t i = 0; i < size; i++) {
+            struct perf_event_attr pe;
+
+            std::memset(&pe, 0, sizeof(pe));
+            pe.type = events[i].type;
+            pe.size = sizeof(pe);
+            pe.config = events[i].config;
+            pe.disabled = (i == 0);
+            pe.read_format = PERF_FORMAT_GROUP;
+
+            fds_[i] = (int)syscall(__NR_perf_event_open, &pe, 0, -1,
+                                   i == 0 ? -1 : fds_[0], 0);
+            if (fds_[i] == -1) {
+                error_ = errno;
+                close();
+                return;
+            }
+        }
+    }
+
+    void close() {
+        for (std::size_t i = size; i-- > 0;) {
+            if (fds_[i] != -1) {
+                ::close(fds_[i]);
+                fds_[i] = -1;
+            }
+        }
+    }
+
+    std::array<int, size> fds_;
+    struct timespec start_time_{};
+    int error_ = 0;
+};
+
+/*
+ * RAII measurement region.  Works with Context and any CounterSet:
+ *
+ *   perfmon::CounterSet<perfmon::Cycles, perfmon::Instructions> counters;
+ *   decltype(counters)::Sample sample;
+ *   {
+ *       perfmon::Scope scope(counters, sample);
+ *       hot_loop();
+ *   }
+ */
+template <typename Monitor>
+class Scope {
+public:
+    using result_type = typename Monitor::result_type;
+
+    Scope(Monitor &monitor, result_type &result)
+        : monitor_(monitor), result_(result), active_(monitor.start()) {}
+
+    ~Scope() {
+        if (active_) {
+            monitor_.stop(result_);
+        }
+    }
+
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+    bool active() const { return active_; }
+
+private:
+    Monitor &monitor_;
+    result_type &result_;
+    bool active_;
+};
+
+/* Compile-time instrumentation level (PERFMON_LEVEL in perfmon.h) */
+inline constexpr int level = PERFMON_LEVEL;
+
+template <int Level>
+inline constexpr bool level_enabled = PERFMON_LEVEL_ENABLED(Level);
+
+/*
+ * Scope that is only compiled in at the given level:
+ *
+ *   perfmon::LevelScope<PERFMON_LEVEL_FINE, Counters> scope(counters, sample);
+ *
+ * When the level is disabled this is an empty object that never touches the
+ * monitor, so the region costs nothing.
+ */
+template <int Level, typename Monitor, bool Enabled = level_enabled<Level>>
+class LevelScope : public Scope<Monitor> {
+public:
+    using Scope<Monitor>::Scope;
+};
+
+template <int Level, typename Monitor>
+class LevelScope<Level, Monitor, false> {
+public:
+    using result_type = typename Monitor::result_type;
+
+    LevelScope(Monitor &, result_type &) {}
+
+    LevelScope(const LevelScope &) = delete;
+    LevelScope &operator=(const LevelScope &) = delete;
+
+    bool active() const { return false; }
+};
+
+/*
+ * Per-task counters for coroutines (see perfmon_task_t in perfmon.h)
+ *
+ * TaskScope switches a task in for the lifetime of the scope.  Inside a
+ * coroutine, wrap every suspension point with charged() so the time spent
+ * suspended is not charged to the task:
+ *
+ *   Task handle_request(perfmon_context_t *ctx, perfmon_task_t *task) {
+ *       perfmon::TaskScope scope(ctx, task);
+ *       auto req = co_await perfmon::charged(ctx, task, socket.read());
+ *       ...
+ *   }
+ *
+ * The thread's context must be running (perfmon_start) while tasks execute.
+ */
+class TaskScope {
+public:
+    TaskScope(perfmon_context_t *ctx, perfmon_task_t *task)
+        : ctx_(ctx), task_(task), active_(perfmon_task_switch_in(ctx, task)) {}
+
+    ~TaskScope() {
+        if (active_ && task_->running) {
+            perfmon_task_switch_out(ctx_, task_);
+        }
+    }
+
+    TaskScope(const TaskScope &) = delete;
+    TaskScope &operator=(const TaskScope &) = delete;
+
+    bool active() const { return active_; }
+
+private:
+    perfmon_context_t *ctx_;
+    perfmon_task_t *task_;
+    bool active_;
+};
+
+#if defined(__cpp_impl_coroutine)
+
+/*
+ * Awaiter wrapper: switches the task out before the coroutine suspends and
+ * back in when it resumes.  Awaits that complete without suspending keep
+ * charging the task.
+ */
+template <typename Awaiter>
+class ChargedAwaiter {
+public:
+    ChargedAwaiter(perfmon_context_t *ctx, perfmon_task_t *task, Awaiter &&inner)
+        : inner_(std::forward<Awaiter>(inner)), ctx_(ctx), task_(task) {}
+
+    bool await_ready() { return inner_.await_ready(); }
+
+    template <typename Promise>
+    decltype(auto) await_suspend(std::coroutine_handle<Promise> handle) {
+        suspended_ = task_->running && perfmon_task_switch_out(ctx_, task_);
+        return inner_.await_suspend(handle);
+    }
+
+    decltype(auto) await_resume() {
+        if (suspended_) {
+            perfmon_task_switch_in(ctx_, task_);
+            suspended_ = false;
+        }
+        return inner_.await_resume();
+    }
+
+private:
+    Awaiter inner_;
+    perfmon_context_t *ctx_;
+    perfmon_task_t *task_;
+    bool suspended_ = false;
+};
+
+template <typename Awaiter>
+ChargedAwaiter<Awaiter> charged(perfmon_context_t *ctx, perfmon_task_t *task, Awaiter &&inner) {
+    return ChargedAwaiter<Awaiter>(ctx, task, std::forward<Awaiter>(inner));
+}
+
+#endif /* __cpp_impl_coroutine */
+
+} /* namespace perfmon */
+
+#endif /* PERFMON_HPP */
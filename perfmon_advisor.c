@@ -0,0 +1,315 @@
+/*
+ * libperfmon - Bottleneck Advisor Implementation
+ */
+
+#define _GNU_SOURCE
+#include "perfmon_advisor.h"
+#include "perfmon_expr.h"
+#include "perfmon_internal.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RULE_NAME_LEN    32
+#define RULE_MESSAGE_LEN 128
+
+/* One compiled rule */
+typedef struct {
+    char name[RULE_NAME_LEN];
+    char message[RULE_MESSAGE_LEN];
+    perfmon_expr_t *condition;
+    perfmon_expr_t *score;      /* NULL: score 1 */
+} advisor_rule_t;
+
+struct perfmon_advisor {
+    int nr_rules;
+    advisor_rule_t rules[PERFMON_ADVISOR_MAX_RULES];
+};
+
+/*
+ * Built-in rules, following the "Performance Metrics Interpretation"
+ * thresholds of the README.  Scores are observed value / threshold.
+ */
+static const struct {
+    const char *name;
+    const char *condition;
+    const char *score;
+    const char *message;
+} default_rules[] = {
+    {"memory_bound",
+     "insn_per_cycle < 0.5 and 1000 * cache_misses / instructions > 10",
+     "1000 * cache_misses / instructions / 10",
+     "memory-bound: consider smaller hash batches or prefetching"},
+    {"low_ipc",
+     "cycles > 0 and insn_per_cycle < 1.0",
+     "1.0 / insn_per_cycle",
+     "low IPC: pipeline stalls, check cache and branch findings"},
+    {"branch_mispredict",
+     "branches > 0 and branch_miss_rate > 5",
+     "branch_miss_rate / 5",
+     "poor branch prediction: consider branch-free predicates or sorted input"},
+    {"cache_locality",
+     "cache_references > 0 and cache_miss_rate > 8",
+     "cache_miss_rate / 8",
+     "poor data locality: large access span, consider a denser data layout"},
+    {"tlb_pressure",
+     "instructions > 0 and 1000 * (dtlb_load_misses + itlb_misses) / instructions > 1",
+     "1000 * (dtlb_load_misses + itlb_misses) / instructions",
+     "TLB pressure: irregular access or oversized working set, consider huge pages"},
+    {"spill_io",
+     "major_faults > 10",
+     "major_faults / 10",
+     "spill I/O: major page faults, consider raising work_mem"},
+    {"spill_write",
+     "io_write_bytes > 1048576",
+     "io_write_bytes / 1048576",
+     "spill I/O: temp file writes reached storage, consider raising work_mem"},
+    {"run_queue",
+     "time > 0 and run_delay_ns / 1e9 / time > 0.1",
+     "run_delay_ns / 1e9 / time / 0.1",
+     "run-queue delay: runnable but waiting for a CPU, the host is oversubscribed"},
+    {"remote_memory",
+     "node_loads > 10000 and remote_load_rate > 30",
+     "remote_load_rate / 30",
+     "remote memory: loads served by another NUMA node, bind the backend near its data"},
+    {"memory_pressure",
+     "psi_memory_some > 10",
+     "psi_memory_some / 10",
+     "memory pressure: tasks stalled on reclaim or swap-in during the region"},
+    {"io_pressure",
+     "psi_io_some > 20",
+     "psi_io_some / 20",
+     "I/O pressure: tasks stalled waiting on storage during the region"},
+    {"contention",
+     "time > 0 and context_switches / time > 1000",
+     "context_switches / time / 1000",
+     "resource contention: frequent context switches (lock or I/O waits)"},
+    {"migrations",
+     "cpu_migrations > 10",
+     "cpu_migrations / 10",
+     "scheduler migrations: consider pinning the backend to a CPU"},
+    {"throttled",
+     "throttled",
+     "0.95 * turbo_reference / turbo_ratio",
+     "frequency throttled: clock fell below its peak, cycle counts are not comparable"},
+};
+
+#define NR_DEFAULT_RULES (sizeof(default_rules) / sizeof(default_rules[0]))
+
+/* Create an empty advisor */
+perfmon_advisor_t *perfmon_advisor_create(void) {
+    perfmon_advisor_t *advisor;
+
+    advisor = (perfmon_advisor_t *)calloc(1, sizeof(perfmon_advisor_t));
+    if (!advisor) {
+        perfmon_set_error("Failed to allocate advisor: %s", strerror(ENOMEM));
+    }
+    return advisor;
+}
+
+/* Create an advisor with the built-in rules */
+perfmon_advisor_t *perfmon_advisor_create_default(void) {
+    perfmon_advisor_t *advisor = perfmon_advisor_create();
+    const char *rules_path;
+    size_t i;
+
+    if (!advisor) {
+        return NULL;
+    }
+
+    for (i = 0; i < NR_DEFAULT_RULES; i++) {
+        if (!perfmon_advisor_add_rule(advisor, default_rules[i].name, default_rules[i].condition,
+                                      default_rules[i].score, default_rules[i].message)) {
+            perfmon_advisor_free(advisor);
+            return NULL;
+        }
+    }
+
+    /* Site-specific rules on top of the built-in ones */
+    rules_path = getenv("PERFMON_ADVISOR_RULES");
+    if (rules_path && rules_path[0] && perfmon_advisor_load_rules(advisor, rules_path) < 0) {
+        perfmon_advisor_free(advisor);
+        return NULL;
+    }
+    return advisor;
+}
+
+/* Add a rule */
+bool perfmon_advisor_add_rule(perfmon_advisor_t *advisor, const char *name,
+                              const char *condition, const char *score,
+                              const char *message) {
+    advisor_rule_t *rule;
+
+    if (!advisor || !name || !condition || !message) {
+        perfmon_set_error("Invalid advisor rule");
+        return false;
+    }
+
+    if (advisor->nr_rules == PERFMON_ADVISOR_MAX_RULES) {
+        perfmon_set_error("Too many advisor rules (max %d)", PERFMON_ADVISOR_MAX_RULES);
+        return false;
+    }
+
+    rule = &advisor->rules[advisor->nr_rules];
+    memset(rule, 0, sizeof(advisor_rule_t));
+    snprintf(rule->name, sizeof(rule->name), "%s", name);
+    snprintf(rule->message, sizeof(rule->message), "%s", message);
+
+    rule->condition = perfmon_expr_compile(condition);
+    if (!rule->condition) {
+        return false;
+    }
+
+    if (score && score[0]) {
+        rule->score = perfmon_expr_compile(score);
+        if (!rule->score) {
+            perfmon_expr_free(rule->condition);
+            rule->condition = NULL;
+            return false;
+        }
+    }
+
+    advisor->nr_rules++;
+    return true;
+}
+
+/* Trim leading and trailing whitespace in place */
+static char *trim(char *s) {
+    char *end;
+
+    while (isspace((unsigned char)*s)) {
+        s++;
+    }
+    end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1])) {
+        end--;
+    }
+    *end = '\0';
+    return s;
+}
+
+/* Add rules from a file */
+int perfmon_advisor_load_rules(perfmon_advisor_t *advisor, const char *path) {
+    char line[512];
+    char *fields[4], *p, *sep;
+    FILE *file;
+    int lineno = 0, added = 0, i;
+
+    if (!advisor || !path) {
+        perfmon_set_error("Invalid advisor or path");
+        return -1;
+    }
+
+    file = fopen(path, "r");
+    if (!file) {
+        perfmon_set_error("Failed to open rule file %s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        lineno++;
+        p = trim(line);
+        if (!*p || *p == '#') {
+            continue;
+        }
+
+        /* name | condition | score | message (the message may contain '|') */
+        for (i = 0; i < 3; i++) {
+            sep = strchr(p, '|');
+            if (!sep) {
+                fclose(file);
+                perfmon_set_error("%s:%d: expected name | condition | score | message",
+                                  path, lineno);
+                return -1;
+            }
+            *sep = '\0';
+            fields[i] = trim(p);
+            p = sep + 1;
+        }
+        fields[3] = trim(p);
+
+        if (!perfmon_advisor_add_rule(advisor, fields[0], fields[1], fields[2], fields[3])) {
+            fclose(file);
+            return -1;
+        }
+        added++;
+    }
+
+    fclose(file);
+    return added;
+}
+
+/* Apply all rules, keeping findings sorted by descending score */
+int perfmon_advisor_evaluate(const perfmon_advisor_t *advisor, const perfmon_stats_t *stats,
+                             perfmon_finding_t *findings, int max) {
+    const advisor_rule_t *rule;
+    perfmon_finding_t finding;
+    int i, j, count = 0;
+
+    if (!advisor || !stats || !findings) {
+        return 0;
+    }
+
+    for (i = 0; i < advisor->nr_rules; i++) {
+        rule = &advisor->rules[i];
+        if (perfmon_expr_eval(rule->condition, stats) == 0.0) {
+            continue;
+        }
+
+        finding.rule = rule->name;
+        finding.message = rule->message;
+        finding.score = rule->score ? perfmon_expr_eval(rule->score, stats) : 1.0;
+
+        /* Insertion into the ranked list, dropping the lowest when full */
+        for (j = count; j > 0 && findings[j - 1].score < finding.score; j--) {
+            if (j < max) {
+                findings[j] = findings[j - 1];
+            }
+        }
+        if (j < max) {
+            findings[j] = finding;
+            if (count < max) {
+                count++;
+            }
+        }
+    }
+
+    return count;
+}
+
+/* Print ranked findings */
+void perfmon_advisor_print(const perfmon_advisor_t *advisor, const perfmon_stats_t *stats,
+                           const char *label, int fd) {
+    perfmon_finding_t findings[PERFMON_ADVISOR_MAX_RULES];
+    int i, count;
+
+    count = perfmon_advisor_evaluate(advisor, stats, findings, PERFMON_ADVISOR_MAX_RULES);
+
+    dprintf(fd, "\nFindings%s%s:\n", label ? " for " : "", label ? label : "");
+    if (count == 0) {
+        dprintf(fd, "  no bottleneck rule fired\n");
+        return;
+    }
+    for (i = 0; i < count; i++) {
+        dprintf(fd, "  %d. %-18s score %6.2f  %s\n", i + 1, findings[i].rule,
+                findings[i].score, findings[i].message);
+    }
+}
+
+/* Free an advisor */
+void perfmon_advisor_free(perfmon_advisor_t *advisor) {
+    int i;
+
+    if (!advisor) {
+        return;
+    }
+
+    for (i = 0; i < advisor->nr_rules; i++) {
+        perfmon_expr_free(advisor->rules[i].condition);
+        perfmon_expr_free(advisor->rules[i].score);
+    }
+    free(advisor);
+}
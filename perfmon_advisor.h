@@ -0,0 +1,84 @@
+/*
+ * libperfmon - Bottleneck Advisor
+ *
+ * Applies a table of rules to a region's statistics and reports ranked
+ * findings.  A rule is a condition and a score, both formulas in the
+ * perfmon_expr.h language, plus the advice to show when it fires:
+ *
+ *   memory_bound | insn_per_cycle < 0.5 and 1000*cache_misses/instructions > 10
+ *                | 1000*cache_misses/instructions / 10
+ *                | memory-bound: consider smaller hash batches or prefetching
+ *
+ * Findings are ranked by score, highest first.  The default rules score a
+ * finding as the ratio of the observed value to the rule's threshold, so
+ * scores of different rules are comparable.
+ */
+
+#ifndef PERFMON_ADVISOR_H
+#define PERFMON_ADVISOR_H
+
+#include "perfmon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Maximum number of rules in one advisor */
+#define PERFMON_ADVISOR_MAX_RULES 32
+
+/* One fired rule */
+typedef struct {
+    const char *rule;       /* rule name */
+    const char *message;    /* advice */
+    double score;           /* severity; findings are sorted by it */
+} perfmon_finding_t;
+
+/* Rule table (opaque handle) */
+typedef struct perfmon_advisor perfmon_advisor_t;
+
+/*
+ * Create an advisor with no rules / with the built-in rules.  The default
+ * advisor also loads the rule file named by PERFMON_ADVISOR_RULES, if set.
+ * Returns: advisor on success, NULL on failure
+ */
+perfmon_advisor_t *perfmon_advisor_create(void);
+perfmon_advisor_t *perfmon_advisor_create_default(void);
+
+/*
+ * Add a rule; an empty or NULL score formula scores 1
+ * Returns: true on success, false on failure (see perfmon_get_error)
+ */
+bool perfmon_advisor_add_rule(perfmon_advisor_t *advisor, const char *name,
+                              const char *condition, const char *score,
+                              const char *message);
+
+/*
+ * Add rules from a file with one "name | condition | score | message" per
+ * line; blank lines and lines starting with '#' are ignored
+ * Returns: number of rules added, -1 on failure
+ */
+int perfmon_advisor_load_rules(perfmon_advisor_t *advisor, const char *path);
+
+/*
+ * Apply all rules to stats and store up to max findings, highest score first
+ * Returns: number of findings stored
+ */
+int perfmon_advisor_evaluate(const perfmon_advisor_t *advisor, const perfmon_stats_t *stats,
+                             perfmon_finding_t *findings, int max);
+
+/*
+ * Print ranked findings for a labelled region (e.g. "HashJoin[node_id=3]")
+ */
+void perfmon_advisor_print(const perfmon_advisor_t *advisor, const perfmon_stats_t *stats,
+                           const char *label, int fd);
+
+/*
+ * Free an advisor
+ */
+void perfmon_advisor_free(perfmon_advisor_t *advisor);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PERFMON_ADVISOR_H */
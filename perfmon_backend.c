@@ -0,0 +1,478 @@
+/*
+ * libperfmon - Counter Backends
+ *
+ *   perf_event  one perf event per counter (per core PMU on hybrid CPUs),
+ *               driven by ioctl() and read()
+ *   rusage      getrusage(RUSAGE_THREAD) software counters, thread CPU time
+ *               and the monotonic clock, for hosts without perf_event access
+ *   mock        deterministic counters and clock, advanced only by a script
+ *               or perfmon_mock_advance(), for tests without a PMU
+ */
+
+#define _GNU_SOURCE
+#include "perfmon_internal.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <linux/perf_event.h>
+
+#define COUNTER_BIT(i) (1u << (i))
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * perf_event backend
+ */
+
+typedef struct {
+    int fds[PERFMON_MAX_COUNTERS];
+    /*
+     * Hybrid CPUs: a plain hardware event only counts on one core type, so
+     * hardware counters are opened once per core PMU instead and summed
+     */
+    int nr_pmus;
+    int pmu_fds[PERFMON_MAX_CORE_PMUS][PERFMON_MAX_COUNTERS];
+} perf_event_state_t;
+
+static void *perf_event_open_all(const perfmon_options_t *opts, uint32_t *available) {
+    perf_event_state_t *state = (perf_event_state_t *)malloc(sizeof(perf_event_state_t));
+    const perfmon_core_pmu_t *pmus;
+    int i, p, nr_pmus;
+
+    if (!state) {
+        perfmon_set_error("Failed to allocate backend state: %s", strerror(ENOMEM));
+        return NULL;
+    }
+
+    nr_pmus = perfmon_core_pmus(&pmus);
+    state->nr_pmus = nr_pmus > 1 ? nr_pmus : 0;
+
+    /* Unavailable counters stay at -1 */
+    *available = 0;
+    for (i = 0; i < PERFMON_MAX_COUNTERS; i++) {
+        state->fds[i] = -1;
+        for (p = 0; p < PERFMON_MAX_CORE_PMUS; p++) {
+            state->pmu_fds[p][i] = -1;
+        }
+
+        /* Node loads take two more hardware counters: only when asked for */
+        if ((PERFMON_NUMA_COUNTERS & COUNTER_BIT(i)) && !opts->numa) {
+            continue;
+        }
+
+        if (state->nr_pmus > 0 && (PERFMON_HW_COUNTERS & COUNTER_BIT(i))) {
+            for (p = 0; p < state->nr_pmus; p++) {
+                state->pmu_fds[p][i] = perfmon_open_counter_on_pmu((perfmon_counter_type_t)i,
+                                                                   pmus[p].type);
+                if (state->pmu_fds[p][i] != -1) {
+                    *available |= COUNTER_BIT(i);
+                }
+            }
+            continue;
+        }
+
+        state->fds[i] = perfmon_open_counter((perfmon_counter_type_t)i, -1, 0);
+        if (state->fds[i] != -1) {
+            *available |= COUNTER_BIT(i);
+        }
+    }
+    return state;
+}
+
+/* Issue an ioctl on every fd of the counters in mask */
+static void perf_event_ioctl(perf_event_state_t *state, uint32_t mask, unsigned long request) {
+    int i, p;
+
+    for (i = 0; i < PERFMON_MAX_COUNTERS; i++) {
+        if (!(mask & COUNTER_BIT(i))) {
+            continue;
+        }
+        if (state->fds[i] != -1) {
+            ioctl(state->fds[i], request, 0);
+        }
+        for (p = 0; p < state->nr_pmus; p++) {
+            if (state->pmu_fds[p][i] != -1) {
+                ioctl(state->pmu_fds[p][i], request, 0);
+            }
+        }
+    }
+}
+
+static void perf_event_start(void *arg, uint32_t mask) {
+    perf_event_state_t *state = (perf_event_state_t *)arg;
+
+    perf_event_ioctl(state, mask, PERF_EVENT_IOC_RESET);
+    perf_event_ioctl(state, mask, PERF_EVENT_IOC_ENABLE);
+}
+
+static void perf_event_stop(void *arg, uint32_t mask) {
+    perf_event_ioctl((perf_event_state_t *)arg, mask, PERF_EVENT_IOC_DISABLE);
+}
+
+static void perf_event_reset(void *arg, uint32_t mask) {
+    perf_event_ioctl((perf_event_state_t *)arg, mask, PERF_EVENT_IOC_RESET);
+}
+
+static uint64_t read_fd(int fd) {
+    uint64_t value = 0;
+
+    if (fd != -1 && read(fd, &value, sizeof(uint64_t)) != sizeof(uint64_t)) {
+        value = 0;
+    }
+    return value;
+}
+
+static void perf_event_read(void *arg, uint64_t values[PERFMON_MAX_COUNTERS]) {
+    perf_event_state_t *state = (perf_event_state_t *)arg;
+    int i, p;
+
+    for (i = 0; i < PERFMON_MAX_COUNTERS; i++) {
+        values[i] = read_fd(state->fds[i]);
+        for (p = 0; p < state->nr_pmus; p++) {
+            values[i] += read_fd(state->pmu_fds[p][i]);
+        }
+    }
+}
+
+static bool perf_event_read_pmu(void *arg, int pmu, uint64_t values[PERFMON_MAX_COUNTERS]) {
+    perf_event_state_t *state = (perf_event_state_t *)arg;
+    int i;
+
+    if (pmu < 0 || pmu >= state->nr_pmus) {
+        return false;
+    }
+    for (i = 0; i < PERFMON_MAX_COUNTERS; i++) {
+        values[i] = read_fd(state->pmu_fds[pmu][i]);
+    }
+    return true;
+}
+
+static uint64_t perf_event_now_ns(void *arg) {
+    (void)arg;
+    return monotonic_ns();
+}
+
+static void perf_event_close(void *arg) {
+    perf_event_state_t *state = (perf_event_state_t *)arg;
+    int i, p;
+
+    for (i = 0; i < PERFMON_MAX_COUNTERS; i++) {
+        if (state->fds[i] != -1) {
+            close(state->fds[i]);
+        }
+        for (p = 0; p < state->nr_pmus; p++) {
+            if (state->pmu_fds[p][i] != -1) {
+                close(state->pmu_fds[p][i]);
+            }
+        }
+    }
+    free(state);
+}
+
+const perfmon_backend_ops_t perfmon_backend_perf_event = {
+    "perf_event",
+    perf_event_open_all,
+    perf_event_start,
+    perf_event_stop,
+    perf_event_reset,
+    perf_event_read,
+    perf_event_now_ns,
+    perf_event_close,
+    perf_event_read_pmu,
+};
+
+/*
+ * rusage backend: counts are differences of getrusage() snapshots
+ */
+
+#define RUSAGE_COUNTERS (COUNTER_BIT(PERFMON_PAGE_FAULTS) | COUNTER_BIT(PERFMON_MINOR_FAULTS) | \
+                         COUNTER_BIT(PERFMON_MAJOR_FAULTS) | COUNTER_BIT(PERFMON_CONTEXT_SWITCHES) | \
+                         COUNTER_BIT(PERFMON_TASK_CLOCK))
+
+typedef struct {
+    uint64_t base[PERFMON_MAX_COUNTERS];
+    uint64_t accum[PERFMON_MAX_COUNTERS];
+    uint32_t running;
+} rusage_state_t;
+
+static void rusage_sample(uint64_t values[PERFMON_MAX_COUNTERS]) {
+    struct rusage ru;
+    struct timespec ts;
+
+    memset(values, 0, PERFMON_MAX_COUNTERS * sizeof(uint64_t));
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+        values[PERFMON_TASK_CLOCK] = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+    }
+    if (getrusage(RUSAGE_THREAD, &ru) != 0) {
+        return;
+    }
+    values[PERFMON_MINOR_FAULTS] = (uint64_t)ru.ru_minflt;
+    values[PERFMON_MAJOR_FAULTS] = (uint64_t)ru.ru_majflt;
+    values[PERFMON_PAGE_FAULTS] = (uint64_t)(ru.ru_minflt + ru.ru_majflt);
+    values[PERFMON_CONTEXT_SWITCHES] = (uint64_t)(ru.ru_nvcsw + ru.ru_nivcsw);
+}
+
+static void *rusage_open(const perfmon_options_t *opts, uint32_t *available) {
+    rusage_state_t *state = (rusage_state_t *)calloc(1, sizeof(rusage_state_t));
+
+    (void)opts;
+    if (!state) {
+        perfmon_set_error("Failed to allocate backend state: %s", strerror(ENOMEM));
+        return NULL;
+    }
+    *available = RUSAGE_COUNTERS;
+    return state;
+}
+
+static void rusage_start(void *arg, uint32_t mask) {
+    rusage_state_t *state = (rusage_state_t *)arg;
+    int i;
+
+    rusage_sample(state->base);
+    for (i = 0; i < PERFMON_MAX_COUNTERS; i++) {
+        if (mask & COUNTER_BIT(i)) {
+            state->accum[i] = 0;
+        }
+    }
+    state->running = mask;
+}
+
+static void rusage_stop(void *arg, uint32_t mask) {
+    rusage_state_t *state = (rusage_state_t *)arg;
+    uint64_t now[PERFMON_MAX_COUNTERS];
+    int i;
+
+    rusage_sample(now);
+    for (i = 0; i < PERFMON_MAX_COUNTERS; i++) {
+        if (mask & state->running & COUNTER_BIT(i)) {
+            state->accum[i] += now[i] - state->base[i];
+        }
+    }
+    state->running &= ~mask;
+}
+
+static void rusage_reset(void *arg, uint32_t mask) {
+    rusage_state_t *state = (rusage_state_t *)arg;
+    int i;
+
+    rusage_sample(state->base);
+    for (i = 0; i < PERFMON_MAX_COUNTERS; i++) {
+        if (mask & COUNTER_BIT(i)) {
+            state->accum[i] = 0;
+        }
+    }
+}
+
+static void rusage_read(void *arg, uint64_t values[PERFMON_MAX_COUNTERS]) {
+    rusage_state_t *state = (rusage_state_t *)arg;
+    uint64_t now[PERFMON_MAX_COUNTERS];
+    int i;
+
+    rusage_sample(now);
+    for (i = 0; i < PERFMON_MAX_COUNTERS; i++) {
+        values[i] = state->accum[i];
+        if (state->running & COUNTER_BIT(i)) {
+            values[i] += now[i] - state->base[i];
+        }
+    }
+}
+
+static uint64_t rusage_now_ns(void *arg) {
+    (void)arg;
+    return monotonic_ns();
+}
+
+static void rusage_close(void *arg) {
+    free(arg);
+}
+
+const perfmon_backend_ops_t perfmon_backend_rusage = {
+    "rusage",
+    rusage_open,
+    rusage_start,
+    rusage_stop,
+    rusage_reset,
+    rusage_read,
+    rusage_now_ns,
+    rusage_close,
+    NULL,
+};
+
+/*
+ * mock backend
+ *
+ * Counters and clock only move when a delta is applied.  With a script, the
+ * next step is applied once per start/stop interval: perfmon_start() samples
+ * the clock right after enabling, and the first observation after that (the
+ * clock or the counters) sees the whole step.
+ */
+
+typedef enum {
+    MOCK_IDLE = 0,
+    MOCK_ARMED,     /* enabled, start timestamp not taken yet */
+    MOCK_PENDING    /* start timestamp taken, step not applied yet */
+} mock_phase_t;
+
+typedef struct {
+    uint64_t values[PERFMON_MAX_COUNTERS];
+    uint64_t clock_ns;
+    uint32_t running;
+    mock_phase_t phase;
+    perfmon_stats_t bias;
+    int script_len;
+    int next_step;
+    perfmon_stats_t script[];
+} mock_state_t;
+
+static void stats_to_values(const perfmon_stats_t *stats, uint64_t values[PERFMON_MAX_COUNTERS]) {
+    values[PERFMON_CYCLES] = stats->cycles;
+    values[PERFMON_INSTRUCTIONS] = stats->instructions;
+    values[PERFMON_BRANCHES] = stats->branches;
+    values[PERFMON_BRANCH_MISSES] = stats->branch_misses;
+    values[PERFMON_CACHE_REFERENCES] = stats->cache_references;
+    values[PERFMON_CACHE_MISSES] = stats->cache_misses;
+    values[PERFMON_DTLB_LOAD_MISSES] = stats->dtlb_load_misses;
+    values[PERFMON_ITLB_MISSES] = stats->itlb_misses;
+    values[PERFMON_PAGE_FAULTS] = stats->page_faults;
+    values[PERFMON_MINOR_FAULTS] = stats->minor_faults;
+    values[PERFMON_MAJOR_FAULTS] = stats->major_faults;
+    values[PERFMON_CONTEXT_SWITCHES] = stats->context_switches;
+    values[PERFMON_CPU_MIGRATIONS] = stats->cpu_migrations;
+    values[PERFMON_REF_CYCLES] = stats->ref_cycles;
+    values[PERFMON_TASK_CLOCK] = stats->task_clock_ns;
+    values[PERFMON_NODE_LOADS] = stats->node_loads;
+    values[PERFMON_NODE_LOAD_MISSES] = stats->node_load_misses;
+}
+
+/* Add a delta to the running counters and to the clock */
+void perfmon_mock_apply(void *arg, const perfmon_stats_t *delta) {
+    mock_state_t *state = (mock_state_t *)arg;
+    uint64_t values[PERFMON_MAX_COUNTERS];
+    int i;
+
+    stats_to_values(delta, values);
+    for (i = 0; i < PERFMON_MAX_COUNTERS; i++) {
+        if (state->running & COUNTER_BIT(i)) {
+            state->values[i] += values[i];
+        }
+    }
+    state->clock_ns += (uint64_t)(delta->elapsed_time_sec * 1e9 + 0.5);
+}
+
+/* Scripted calibration result */
+void perfmon_mock_bias(void *arg, uint64_t values[PERFMON_MAX_COUNTERS], uint64_t *elapsed_ns) {
+    mock_state_t *state = (mock_state_t *)arg;
+
+    stats_to_values(&state->bias, values);
+    *elapsed_ns = (uint64_t)(state->bias.elapsed_time_sec * 1e9 + 0.5);
+}
+
+/* Apply the next script step if the interval is waiting for one */
+static void mock_settle(mock_state_t *state) {
+    if (state->phase == MOCK_PENDING) {
+        perfmon_mock_apply(state, &state->script[state->next_step]);
+        state->next_step = (state->next_step + 1) % state->script_len;
+        state->phase = MOCK_IDLE;
+    }
+}
+
+static void *mock_open(const perfmon_options_t *opts, uint32_t *available) {
+    int len = opts && opts->mock_script ? opts->mock_script_len : 0;
+    mock_state_t *state;
+
+    if (len < 0) {
+        perfmon_set_error("Invalid mock script length: %d", len);
+        return NULL;
+    }
+
+    state = (mock_state_t *)calloc(1, sizeof(mock_state_t) + (size_t)len * sizeof(perfmon_stats_t));
+    if (!state) {
+        perfmon_set_error("Failed to allocate backend state: %s", strerror(ENOMEM));
+        return NULL;
+    }
+    if (len > 0) {
+        memcpy(state->script, opts->mock_script, (size_t)len * sizeof(perfmon_stats_t));
+    }
+    state->script_len = len;
+    if (opts && opts->mock_bias) {
+        state->bias = *opts->mock_bias;
+    }
+    *available = COUNTER_BIT(PERFMON_MAX_COUNTERS) - 1;
+    return state;
+}
+
+static void mock_start(void *arg, uint32_t mask) {
+    mock_state_t *state = (mock_state_t *)arg;
+    int i;
+
+    for (i = 0; i < PERFMON_MAX_COUNTERS; i++) {
+        if (mask & COUNTER_BIT(i)) {
+            state->values[i] = 0;
+        }
+    }
+    state->running = mask;
+    state->phase = state->script_len > 0 ? MOCK_ARMED : MOCK_IDLE;
+}
+
+static void mock_stop(void *arg, uint32_t mask) {
+    mock_state_t *state = (mock_state_t *)arg;
+
+    mock_settle(state);
+    state->running &= ~mask;
+    state->phase = MOCK_IDLE;
+}
+
+static void mock_reset(void *arg, uint32_t mask) {
+    mock_state_t *state = (mock_state_t *)arg;
+    int i;
+
+    for (i = 0; i < PERFMON_MAX_COUNTERS; i++) {
+        if (mask & COUNTER_BIT(i)) {
+            state->values[i] = 0;
+        }
+    }
+}
+
+static void mock_read(void *arg, uint64_t values[PERFMON_MAX_COUNTERS]) {
+    mock_state_t *state = (mock_state_t *)arg;
+
+    mock_settle(state);
+    memcpy(values, state->values, sizeof(state->values));
+}
+
+static uint64_t mock_now_ns(void *arg) {
+    mock_state_t *state = (mock_state_t *)arg;
+
+    if (state->phase == MOCK_ARMED) {
+        state->phase = MOCK_PENDING;
+    } else {
+        mock_settle(state);
+    }
+    return state->clock_ns;
+}
+
+static void mock_close(void *arg) {
+    free(arg);
+}
+
+const perfmon_backend_ops_t perfmon_backend_mock = {
+    "mock",
+    mock_open,
+    mock_start,
+    mock_stop,
+    mock_reset,
+    mock_read,
+    mock_now_ns,
+    mock_close,
+    NULL,
+};
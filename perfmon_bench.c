@@ -0,0 +1,378 @@
+/*
+ * libperfmon - Repetition Runner Implementation
+ */
+
+#define _GNU_SOURCE
+#include "perfmon_bench.h"
+#include "perfmon_internal.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_WARMUP       3
+#define DEFAULT_REPETITIONS  30
+#define DEFAULT_OUTLIER_MADS 3.5
+
+/* MAD to standard deviation for normally distributed data */
+#define MAD_SCALE 1.4826
+
+/* Counter fields of perfmon_stats_t in perfmon_counter_type_t order */
+static const struct {
+    const char *name;
+    size_t offset;
+} series_fields[PERFMON_MAX_COUNTERS] = {
+    {"cycles", offsetof(perfmon_stats_t, cycles)},
+    {"instructions", offsetof(perfmon_stats_t, instructions)},
+    {"branches", offsetof(perfmon_stats_t, branches)},
+    {"branch-misses", offsetof(perfmon_stats_t, branch_misses)},
+    {"cache-references", offsetof(perfmon_stats_t, cache_references)},
+    {"cache-misses", offsetof(perfmon_stats_t, cache_misses)},
+    {"dTLB-load-misses", offsetof(perfmon_stats_t, dtlb_load_misses)},
+    {"iTLB-misses", offsetof(perfmon_stats_t, itlb_misses)},
+    {"page-faults", offsetof(perfmon_stats_t, page_faults)},
+    {"minor-faults", offsetof(perfmon_stats_t, minor_faults)},
+    {"major-faults", offsetof(perfmon_stats_t, major_faults)},
+    {"cs", offsetof(perfmon_stats_t, context_switches)},
+    {"migrations", offsetof(perfmon_stats_t, cpu_migrations)},
+    {"ref-cycles", offsetof(perfmon_stats_t, ref_cycles)},
+    {"task-clock", offsetof(perfmon_stats_t, task_clock_ns)},
+    {"node-loads", offsetof(perfmon_stats_t, node_loads)},
+    {"node-load-misses", offsetof(perfmon_stats_t, node_load_misses)},
+};
+
+/* OS counter deltas and node migrations of perfmon_stats_t (not the RSS high-water mark) */
+static const size_t os_fields[] = {
+    offsetof(perfmon_stats_t, io_read_bytes),
+    offsetof(perfmon_stats_t, io_write_bytes),
+    offsetof(perfmon_stats_t, io_syscr),
+    offsetof(perfmon_stats_t, io_syscw),
+    offsetof(perfmon_stats_t, run_delay_ns),
+    offsetof(perfmon_stats_t, voluntary_switches),
+    offsetof(perfmon_stats_t, involuntary_switches),
+    offsetof(perfmon_stats_t, node_migrations),
+};
+
+#define NR_OS_FIELDS (sizeof(os_fields) / sizeof(os_fields[0]))
+
+/* Pressure percentages of perfmon_stats_t */
+static const size_t psi_fields[] = {
+    offsetof(perfmon_stats_t, psi_cpu_some),
+    offsetof(perfmon_stats_t, psi_memory_some),
+    offsetof(perfmon_stats_t, psi_memory_full),
+    offsetof(perfmon_stats_t, psi_io_some),
+    offsetof(perfmon_stats_t, psi_io_full),
+};
+
+#define NR_PSI_FIELDS (sizeof(psi_fields) / sizeof(psi_fields[0]))
+
+#define STATS_U64(stats, offset) (*(uint64_t *)((char *)(stats) + (offset)))
+#define STATS_F64(stats, offset) (*(double *)((char *)(stats) + (offset)))
+
+/* Two-sided 95% Student's t critical values for 1..30 degrees of freedom */
+static const double t_critical_95[30] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+};
+
+/* Fill options with the defaults */
+void perfmon_bench_options_init(perfmon_bench_options_t *opts) {
+    if (!opts) {
+        return;
+    }
+
+    memset(opts, 0, sizeof(perfmon_bench_options_t));
+    opts->warmup = DEFAULT_WARMUP;
+    opts->repetitions = DEFAULT_REPETITIONS;
+    opts->cpu = -1;
+    opts->outlier_mads = DEFAULT_OUTLIER_MADS;
+}
+
+/* Value of one series in a measurement */
+static double series_value(const perfmon_stats_t *stats, int series) {
+    if (series == PERFMON_BENCH_TIME) {
+        return stats->elapsed_time_sec;
+    }
+    return (double)*(const uint64_t *)((const char *)stats + series_fields[series].offset);
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Median of n values (sorts them) */
+static double median_double(double *v, int n) {
+    qsort(v, (size_t)n, sizeof(double), compare_double);
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2.0;
+}
+
+/* Square root by Newton's method; keeps libperfmon free of a libm dependency */
+static double sqrt_newton(double x) {
+    double r = x > 1.0 ? x : 1.0;
+    int i;
+
+    if (x <= 0.0) {
+        return 0.0;
+    }
+    for (i = 0; i < 64; i++) {
+        double next = 0.5 * (r + x / r);
+        if (next >= r) {
+            break;
+        }
+        r = next;
+    }
+    return r;
+}
+
+/* Summarize n values (sorts them) */
+static void summarize(double *v, int n, perfmon_bench_summary_t *out) {
+    double sum = 0.0, sq = 0.0, half;
+    int i;
+
+    memset(out, 0, sizeof(perfmon_bench_summary_t));
+    for (i = 0; i < n; i++) {
+        sum += v[i];
+    }
+    out->mean = sum / n;
+    for (i = 0; i < n; i++) {
+        sq += (v[i] - out->mean) * (v[i] - out->mean);
+    }
+    out->stddev = n > 1 ? sqrt_newton(sq / (n - 1)) : 0.0;
+    out->median = median_double(v, n);
+    out->min = v[0];
+    out->max = v[n - 1];
+
+    half = n > 1 ? (n - 1 <= 30 ? t_critical_95[n - 2] : 1.960) * out->stddev / sqrt_newton(n) : 0.0;
+    out->ci_low = out->mean - half;
+    out->ci_high = out->mean + half;
+    out->cv = out->mean != 0.0 ? out->stddev / out->mean : 0.0;
+}
+
+/*
+ * Mark runs whose elapsed time is further than k scaled MADs from the median.
+ * Returns the number of runs kept.
+ */
+static int reject_outliers(const perfmon_stats_t *runs, int n, double k, bool *keep, double *scratch) {
+    double median, mad;
+    int i, kept = 0;
+
+    for (i = 0; i < n; i++) {
+        scratch[i] = runs[i].elapsed_time_sec;
+    }
+    median = median_double(scratch, n);
+    for (i = 0; i < n; i++) {
+        scratch[i] = runs[i].elapsed_time_sec > median ? runs[i].elapsed_time_sec - median
+                                                       : median - runs[i].elapsed_time_sec;
+    }
+    mad = median_double(scratch, n) * MAD_SCALE;
+
+    /* scratch is sorted now; recompute each run's deviation */
+    for (i = 0; i < n; i++) {
+        double dev = runs[i].elapsed_time_sec > median ? runs[i].elapsed_time_sec - median
+                                                       : median - runs[i].elapsed_time_sec;
+        keep[i] = k <= 0.0 || mad == 0.0 || dev <= k * mad;
+        kept += keep[i];
+    }
+    return kept;
+}
+
+/* Mean of the kept runs, with derived metrics recomputed from it */
+static void mean_stats(const perfmon_stats_t *runs, const bool *keep, int n, int kept,
+                       perfmon_stats_t *mean) {
+    double sums[PERFMON_BENCH_NR_SERIES] = {0.0};
+    double user[PERFMON_MAX_USER_COUNTERS] = {0.0};
+    double energy[PERFMON_MAX_ENERGY_DOMAINS] = {0.0};
+    double os[NR_OS_FIELDS] = {0.0};
+    double psi[NR_PSI_FIELDS] = {0.0};
+    uint64_t process_max_rss_kb = 0;
+    bool other_thread = false;
+    double turbo_reference = 0.0;
+    size_t f;
+    int i, s;
+
+    for (i = 0; i < n; i++) {
+        if (!keep[i]) {
+            continue;
+        }
+        for (s = 0; s < PERFMON_BENCH_NR_SERIES; s++) {
+            sums[s] += series_value(&runs[i], s);
+        }
+        for (s = 0; s < PERFMON_MAX_USER_COUNTERS; s++) {
+            user[s] += (double)runs[i].user_counters[s];
+        }
+        for (s = 0; s < PERFMON_MAX_ENERGY_DOMAINS; s++) {
+            energy[s] += runs[i].energy_joules[s];
+        }
+        for (f = 0; f < NR_OS_FIELDS; f++) {
+            os[f] += (double)STATS_U64(&runs[i], os_fields[f]);
+        }
+        for (f = 0; f < NR_PSI_FIELDS; f++) {
+            psi[f] += STATS_F64(&runs[i], psi_fields[f]);
+        }
+        if (runs[i].process_max_rss_kb > process_max_rss_kb) {
+            process_max_rss_kb = runs[i].process_max_rss_kb;
+        }
+        other_thread |= runs[i].os_other_thread;
+        if (runs[i].turbo_reference > turbo_reference) {
+            turbo_reference = runs[i].turbo_reference;
+        }
+    }
+
+    memset(mean, 0, sizeof(perfmon_stats_t));
+    for (s = 0; s < PERFMON_MAX_COUNTERS; s++) {
+        *(uint64_t *)((char *)mean + series_fields[s].offset) = (uint64_t)(sums[s] / kept + 0.5);
+    }
+    mean->elapsed_time_sec = sums[PERFMON_BENCH_TIME] / kept;
+    for (s = 0; s < PERFMON_MAX_USER_COUNTERS; s++) {
+        mean->user_counters[s] = (uint64_t)(user[s] / kept + 0.5);
+    }
+    for (s = 0; s < PERFMON_MAX_ENERGY_DOMAINS; s++) {
+        mean->energy_joules[s] = energy[s] / kept;
+    }
+    for (f = 0; f < NR_OS_FIELDS; f++) {
+        STATS_U64(mean, os_fields[f]) = (uint64_t)(os[f] / kept + 0.5);
+    }
+    for (f = 0; f < NR_PSI_FIELDS; f++) {
+        STATS_F64(mean, psi_fields[f]) = psi[f] / kept;
+    }
+    mean->process_max_rss_kb = process_max_rss_kb;
+    mean->os_other_thread = other_thread;
+    mean->turbo_reference = turbo_reference;
+    mean->start_cpu = mean->start_node = mean->stop_cpu = mean->stop_node = -1;
+    mean->host_hash = perfmon_host_hash();
+    perfmon_compute_derived(mean);
+}
+
+/* Run fn(arg) repeatedly and summarize the measured runs */
+bool perfmon_bench_run(perfmon_bench_fn fn, void *arg, const perfmon_bench_options_t *opts,
+                       perfmon_bench_result_t *result) {
+    perfmon_bench_options_t defaults;
+    perfmon_context_t *ctx;
+    perfmon_stats_t *runs = NULL;
+    double *values = NULL;
+    bool *keep = NULL;
+    cpu_set_t old_affinity, affinity;
+    bool pinned = false, ok = false;
+    int i, s, n, kept;
+
+    if (!fn || !result) {
+        perfmon_set_error("Invalid arguments");
+        return false;
+    }
+    if (!opts) {
+        perfmon_bench_options_init(&defaults);
+        opts = &defaults;
+    }
+    if (opts->repetitions < 1 || opts->warmup < 0) {
+        perfmon_set_error("Invalid repetition count");
+        return false;
+    }
+    if (opts->cpu < -1 || opts->cpu >= CPU_SETSIZE) {
+        perfmon_set_error("Invalid CPU %d (0 to %d, or -1 for no pinning)", opts->cpu,
+                          CPU_SETSIZE - 1);
+        return false;
+    }
+    n = opts->repetitions;
+
+    ctx = opts->ctx ? opts->ctx : perfmon_init();
+    if (!ctx) {
+        return false;
+    }
+
+    runs = (perfmon_stats_t *)malloc((size_t)n * sizeof(perfmon_stats_t));
+    values = (double *)malloc((size_t)n * sizeof(double));
+    keep = (bool *)malloc((size_t)n * sizeof(bool));
+    if (!runs || !values || !keep) {
+        perfmon_set_error("Failed to allocate run buffer: %s", strerror(ENOMEM));
+        goto out;
+    }
+
+    if (opts->cpu >= 0) {
+        CPU_ZERO(&affinity);
+        CPU_SET(opts->cpu, &affinity);
+        if (sched_getaffinity(0, sizeof(cpu_set_t), &old_affinity) != 0 ||
+            sched_setaffinity(0, sizeof(cpu_set_t), &affinity) != 0) {
+            perfmon_set_error("Failed to pin to CPU %d: %s", opts->cpu, strerror(errno));
+            goto out;
+        }
+        pinned = true;
+    }
+
+    for (i = 0; i < opts->warmup; i++) {
+        fn(arg);
+    }
+    for (i = 0; i < n; i++) {
+        if (!perfmon_start(ctx)) {
+            goto out;
+        }
+        fn(arg);
+        if (!perfmon_stop(ctx, &runs[i])) {
+            goto out;
+        }
+    }
+
+    memset(result, 0, sizeof(perfmon_bench_result_t));
+    kept = reject_outliers(runs, n, opts->outlier_mads, keep, values);
+    result->runs = n;
+    result->kept = kept;
+    mean_stats(runs, keep, n, kept, &result->mean);
+
+    for (s = 0; s < PERFMON_BENCH_NR_SERIES; s++) {
+        int k = 0;
+
+        for (i = 0; i < n; i++) {
+            if (keep[i]) {
+                values[k++] = series_value(&runs[i], s);
+            }
+        }
+        summarize(values, k, &result->series[s]);
+    }
+    ok = true;
+
+out:
+    if (pinned) {
+        sched_setaffinity(0, sizeof(cpu_set_t), &old_affinity);
+    }
+    free(keep);
+    free(values);
+    free(runs);
+    if (!opts->ctx) {
+        perfmon_cleanup(ctx);
+    }
+    return ok;
+}
+
+/* Print one series */
+static void print_series(const perfmon_bench_summary_t *sum, const char *name, double scale, int fd) {
+    dprintf(fd, "%-18s %16.2f %16.2f %7.2f%%  [%14.2f, %14.2f]\n", name, sum->mean * scale,
+            sum->median * scale, sum->cv * 100.0, sum->ci_low * scale, sum->ci_high * scale);
+}
+
+/* Print every counter that moved */
+void perfmon_bench_print(const perfmon_bench_result_t *result, int fd) {
+    int s;
+
+    if (!result) {
+        return;
+    }
+
+    dprintf(fd, "\nRepetition Summary (%d runs, %d kept after outlier rejection):\n",
+            result->runs, result->kept);
+    dprintf(fd, "host %016lx\n", result->mean.host_hash);
+    dprintf(fd, "%-18s %16s %16s %8s  %32s\n", "counter", "mean", "median", "CV", "95% CI of mean");
+    for (s = 0; s < PERFMON_MAX_COUNTERS; s++) {
+        if (result->series[s].max > 0.0) {
+            print_series(&result->series[s], series_fields[s].name, 1.0, fd);
+        }
+    }
+    print_series(&result->series[PERFMON_BENCH_TIME], "time (us)", 1e6, fd);
+    if (result->mean.cycles > 0) {
+        dprintf(fd, "%-18s %16.2f\n", "IPC of mean", result->mean.insn_per_cycle);
+    }
+}
@@ -0,0 +1,90 @@
+/*
+ * libperfmon - Repetition Runner
+ *
+ * Runs a function many times and summarizes every counter over the runs,
+ * instead of trusting a single measurement:
+ *
+ *   perfmon_bench_options_t opts;
+ *   perfmon_bench_result_t result;
+ *
+ *   perfmon_bench_options_init(&opts);
+ *   opts.repetitions = 50;
+ *   opts.cpu = 2;                           // pin to CPU 2 while running
+ *   if (perfmon_bench_run(hash_join, &args, &opts, &result)) {
+ *       perfmon_bench_print(&result, STDOUT_FILENO);
+ *   }
+ *
+ * Warmup runs are executed but not measured.  A run whose elapsed time is
+ * more than outlier_mads scaled median absolute deviations from the median
+ * is rejected as a whole, so the counters of a run are kept or dropped
+ * together.
+ */
+
+#ifndef PERFMON_BENCH_H
+#define PERFMON_BENCH_H
+
+#include "perfmon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Function under test */
+typedef void (*perfmon_bench_fn)(void *arg);
+
+/* Runner options */
+typedef struct {
+    int warmup;             /* unmeasured runs first (default 3) */
+    int repetitions;        /* measured runs (default 30) */
+    int cpu;                /* pin the calling thread to this CPU (< CPU_SETSIZE), -1 = no pinning (default) */
+    double outlier_mads;    /* rejection threshold in scaled MADs, 0 = keep all (default 3.5) */
+    perfmon_context_t *ctx; /* context to measure with, NULL = a temporary one (default) */
+} perfmon_bench_options_t;
+
+/* Series index of elapsed time; counters use their perfmon_counter_type_t */
+#define PERFMON_BENCH_TIME      PERFMON_MAX_COUNTERS
+#define PERFMON_BENCH_NR_SERIES (PERFMON_MAX_COUNTERS + 1)
+
+/* Distribution of one counter over the kept runs */
+typedef struct {
+    double mean;
+    double median;
+    double stddev;
+    double min;
+    double max;
+    double ci_low;          /* 95% confidence interval of the mean (Student's t) */
+    double ci_high;
+    double cv;              /* coefficient of variation: stddev / mean */
+} perfmon_bench_summary_t;
+
+/* Result of a repetition run */
+typedef struct {
+    int runs;               /* measured runs */
+    int kept;               /* runs left after outlier rejection */
+    perfmon_stats_t mean;   /* mean of the kept runs, derived metrics of the mean */
+    perfmon_bench_summary_t series[PERFMON_BENCH_NR_SERIES];
+} perfmon_bench_result_t;
+
+/*
+ * Fill options with the defaults
+ */
+void perfmon_bench_options_init(perfmon_bench_options_t *opts);
+
+/*
+ * Run fn(arg) warmup + repetitions times and summarize the measured runs;
+ * opts may be NULL for the defaults
+ * Returns: true on success, false on failure
+ */
+bool perfmon_bench_run(perfmon_bench_fn fn, void *arg, const perfmon_bench_options_t *opts,
+                       perfmon_bench_result_t *result);
+
+/*
+ * Print mean, median, CV and confidence interval of every counter that moved
+ */
+void perfmon_bench_print(const perfmon_bench_result_t *result, int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PERFMON_BENCH_H */
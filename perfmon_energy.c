@@ -0,0 +1,126 @@
+/*
+ * libperfmon - RAPL Energy Counters
+ *
+ * The power PMU counts energy per package, not per thread: its events are
+ * opened once per process on one CPU of every package (the PMU's cpumask)
+ * and left running.  A context reads them at start and stop, so a region is
+ * charged with the energy the packages used during its wall-clock interval.
+ */
+
+#define _GNU_SOURCE
+#include "perfmon.h"
+#include "perfmon_internal.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+
+#define POWER_PMU "/sys/bus/event_source/devices/power"
+
+/* Packages with one power PMU instance each */
+#define MAX_PACKAGES 8
+
+typedef struct {
+    int fds[MAX_PACKAGES];
+    int nr_fds;
+    double scale;       /* joules per count */
+} energy_domain_t;
+
+static const char *domain_names[PERFMON_MAX_ENERGY_DOMAINS] = {
+    [PERFMON_ENERGY_PKG]   = "energy-pkg",
+    [PERFMON_ENERGY_CORES] = "energy-cores",
+    [PERFMON_ENERGY_RAM]   = "energy-ram",
+    [PERFMON_ENERGY_GPU]   = "energy-gpu",
+    [PERFMON_ENERGY_PSYS]  = "energy-psys",
+};
+
+static energy_domain_t domains[PERFMON_MAX_ENERGY_DOMAINS];
+static uint32_t available_domains;
+static pthread_once_t energy_once = PTHREAD_ONCE_INIT;
+
+static void open_domain(int domain, uint32_t type, const int *cpus, int nr_cpus) {
+    energy_domain_t *d = &domains[domain];
+    char path[256], line[128];
+    unsigned long long config;
+    int i, fd;
+
+    snprintf(path, sizeof(path), POWER_PMU "/events/%s", domain_names[domain]);
+    if (!perfmon_read_line(path, line, sizeof(line)) || sscanf(line, "event=%llx", &config) != 1) {
+        return;
+    }
+    snprintf(path, sizeof(path), POWER_PMU "/events/%s.scale", domain_names[domain]);
+    if (!perfmon_read_line(path, line, sizeof(line)) || (d->scale = strtod(line, NULL)) <= 0.0) {
+        return;
+    }
+    snprintf(path, sizeof(path), POWER_PMU "/events/%s.unit", domain_names[domain]);
+    if (!perfmon_read_line(path, line, sizeof(line)) || strcmp(line, "Joules") != 0) {
+        return;
+    }
+
+    for (i = 0; i < nr_cpus; i++) {
+        fd = perfmon_open_event(type, config, -1, cpus[i], -1, 0);
+        if (fd == -1) {
+            /* A package we cannot read would make the sum meaningless */
+            while (d->nr_fds > 0) {
+                close(d->fds[--d->nr_fds]);
+            }
+            return;
+        }
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        d->fds[d->nr_fds++] = fd;
+    }
+    available_domains |= 1u << domain;
+}
+
+static void energy_open_once(void) {
+    char line[256];
+    int cpus[MAX_PACKAGES], nr_cpus, type, i;
+
+    if (!perfmon_read_line(POWER_PMU "/type", line, sizeof(line)) || (type = atoi(line)) <= 0) {
+        return;
+    }
+    if (!perfmon_read_line(POWER_PMU "/cpumask", line, sizeof(line)) ||
+        (nr_cpus = perfmon_parse_cpu_list(line, cpus, MAX_PACKAGES)) == 0) {
+        return;
+    }
+
+    for (i = 0; i < PERFMON_MAX_ENERGY_DOMAINS; i++) {
+        open_domain(i, (uint32_t)type, cpus, nr_cpus);
+    }
+}
+
+/* Energy domains that can be read (opens the power PMU once per process) */
+uint32_t perfmon_energy_domains(void) {
+    pthread_once(&energy_once, energy_open_once);
+    return available_domains;
+}
+
+/* Name of an energy domain */
+const char *perfmon_energy_domain_name(perfmon_energy_domain_t domain) {
+    if ((int)domain < 0 || domain >= PERFMON_MAX_ENERGY_DOMAINS) {
+        return NULL;
+    }
+    return domain_names[domain];
+}
+
+/* Joules consumed so far by every available domain, summed over packages */
+void perfmon_energy_read(double joules[PERFMON_MAX_ENERGY_DOMAINS]) {
+    uint64_t count;
+    int i, p;
+
+    for (i = 0; i < PERFMON_MAX_ENERGY_DOMAINS; i++) {
+        joules[i] = 0.0;
+        if (!(available_domains & (1u << i))) {
+            continue;
+        }
+        for (p = 0; p < domains[i].nr_fds; p++) {
+            if (read(domains[i].fds[p], &count, sizeof(uint64_t)) == sizeof(uint64_t)) {
+                joules[i] += (double)count * domains[i].scale;
+            }
+        }
+    }
+}
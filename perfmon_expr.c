@@ -0,0 +1,846 @@
+/*
+ * libperfmon - Derived Metric Expressions Implementation
+ *
+ * Formulas are parsed by recursive descent into a small AST, constant
+ * subtrees are folded, and the result is emitted as postfix bytecode for a
+ * stack machine whose registers are columns of samples.
+ */
+
+#define _GNU_SOURCE
+#include "perfmon_expr.h"
+#include "perfmon_internal.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/* Limits */
+#define EXPR_MAX_NODES  64
+#define EXPR_MAX_DEPTH  16
+#define EXPR_MAX_NESTING 64     /* parentheses and unary signs, bounds parser recursion */
+#define EXPR_CHUNK      64      /* samples evaluated per instruction pass */
+#define NAME_LEN        32
+#define MAX_CONSTANTS   16
+
+/* Node kinds and bytecode opcodes */
+typedef enum {
+    OP_CONST = 0,
+    OP_VAR,
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_NEG,
+    OP_LT,
+    OP_LE,
+    OP_GT,
+    OP_GE,
+    OP_EQ,
+    OP_NE,
+    OP_AND,
+    OP_OR
+} expr_op_t;
+
+/* Type of a perfmon_stats_t field */
+typedef enum {
+    VAR_U64 = 0,
+    VAR_F64,
+    VAR_BOOL
+} expr_var_type_t;
+
+/* Named field of perfmon_stats_t */
+typedef struct {
+    const char *name;
+    uint16_t offset;
+    uint8_t type;
+} expr_var_t;
+
+#define STATS_VAR(name, field, type) {name, (uint16_t)offsetof(perfmon_stats_t, field), type}
+
+static const expr_var_t builtin_vars[] = {
+    STATS_VAR("cycles", cycles, VAR_U64),
+    STATS_VAR("instructions", instructions, VAR_U64),
+    STATS_VAR("branches", branches, VAR_U64),
+    STATS_VAR("branch_misses", branch_misses, VAR_U64),
+    STATS_VAR("cache_references", cache_references, VAR_U64),
+    STATS_VAR("cache_misses", cache_misses, VAR_U64),
+    STATS_VAR("LLC_misses", cache_misses, VAR_U64),
+    STATS_VAR("dtlb_load_misses", dtlb_load_misses, VAR_U64),
+    STATS_VAR("itlb_misses", itlb_misses, VAR_U64),
+    STATS_VAR("page_faults", page_faults, VAR_U64),
+    STATS_VAR("minor_faults", minor_faults, VAR_U64),
+    STATS_VAR("major_faults", major_faults, VAR_U64),
+    STATS_VAR("context_switches", context_switches, VAR_U64),
+    STATS_VAR("cpu_migrations", cpu_migrations, VAR_U64),
+    STATS_VAR("ref_cycles", ref_cycles, VAR_U64),
+    STATS_VAR("task_clock", task_clock_ns, VAR_U64),
+    STATS_VAR("node_loads", node_loads, VAR_U64),
+    STATS_VAR("node_load_misses", node_load_misses, VAR_U64),
+    STATS_VAR("elapsed_time_sec", elapsed_time_sec, VAR_F64),
+    STATS_VAR("time", elapsed_time_sec, VAR_F64),
+    STATS_VAR("insn_per_cycle", insn_per_cycle, VAR_F64),
+    STATS_VAR("branch_miss_rate", branch_miss_rate, VAR_F64),
+    STATS_VAR("cache_miss_rate", cache_miss_rate, VAR_F64),
+    STATS_VAR("effective_ghz", effective_ghz, VAR_F64),
+    STATS_VAR("turbo_ratio", turbo_ratio, VAR_F64),
+    STATS_VAR("turbo_reference", turbo_reference, VAR_F64),
+    STATS_VAR("throttled", throttled, VAR_BOOL),
+    STATS_VAR("remote_load_rate", remote_load_rate, VAR_F64),
+    STATS_VAR("energy_pkg", energy_joules[PERFMON_ENERGY_PKG], VAR_F64),
+    STATS_VAR("energy_cores", energy_joules[PERFMON_ENERGY_CORES], VAR_F64),
+    STATS_VAR("energy_ram", energy_joules[PERFMON_ENERGY_RAM], VAR_F64),
+    STATS_VAR("energy_gpu", energy_joules[PERFMON_ENERGY_GPU], VAR_F64),
+    STATS_VAR("energy_psys", energy_joules[PERFMON_ENERGY_PSYS], VAR_F64),
+    STATS_VAR("io_read_bytes", io_read_bytes, VAR_U64),
+    STATS_VAR("io_write_bytes", io_write_bytes, VAR_U64),
+    STATS_VAR("io_syscr", io_syscr, VAR_U64),
+    STATS_VAR("io_syscw", io_syscw, VAR_U64),
+    STATS_VAR("run_delay_ns", run_delay_ns, VAR_U64),
+    STATS_VAR("voluntary_switches", voluntary_switches, VAR_U64),
+    STATS_VAR("involuntary_switches", involuntary_switches, VAR_U64),
+    STATS_VAR("process_max_rss_kb", process_max_rss_kb, VAR_U64),
+    STATS_VAR("max_rss_kb", process_max_rss_kb, VAR_U64),
+    STATS_VAR("psi_cpu_some", psi_cpu_some, VAR_F64),
+    STATS_VAR("psi_memory_some", psi_memory_some, VAR_F64),
+    STATS_VAR("psi_memory_full", psi_memory_full, VAR_F64),
+    STATS_VAR("psi_io_some", psi_io_some, VAR_F64),
+    STATS_VAR("psi_io_full", psi_io_full, VAR_F64),
+    STATS_VAR("node_migrations", node_migrations, VAR_U64),
+};
+
+#define NR_BUILTIN_VARS (sizeof(builtin_vars) / sizeof(builtin_vars[0]))
+
+/* One bytecode instruction */
+typedef struct {
+    uint8_t op;
+    uint8_t type;       /* OP_VAR: field type */
+    uint16_t offset;    /* OP_VAR: field offset in perfmon_stats_t */
+    double value;       /* OP_CONST */
+} expr_insn_t;
+
+/* Compiled expression */
+struct perfmon_expr {
+    int nr_insns;
+    int max_depth;
+    expr_insn_t insns[];
+};
+
+/* AST node (indices into the parser's node arena) */
+typedef struct {
+    uint8_t op;
+    uint8_t type;
+    uint16_t offset;
+    double value;
+    int left;
+    int right;
+} expr_node_t;
+
+/* Parser state */
+typedef struct {
+    const char *text;
+    const char *pos;
+    expr_node_t nodes[EXPR_MAX_NODES];
+    int nr_nodes;
+    int nesting;        /* open parentheses and unary signs being parsed */
+    bool failed;
+} expr_parser_t;
+
+/* Process-wide named constants */
+static struct {
+    char name[NAME_LEN];
+    double value;
+} constants[MAX_CONSTANTS];
+static int nr_constants = 0;
+static pthread_mutex_t constants_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Process-wide derived metrics */
+static struct {
+    char name[NAME_LEN];
+    perfmon_expr_t *expr;
+} metrics[PERFMON_MAX_METRICS];
+static int nr_metrics = 0;
+static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t metrics_env_once = PTHREAD_ONCE_INIT;
+
+/* Record the first parse error */
+static int parse_error(expr_parser_t *p, const char *what) {
+    if (!p->failed) {
+        /* Quote at most 64 characters so the reason fits the error buffer */
+        perfmon_set_error("Expression error at offset %d in \"%.64s%s\": %s",
+                          (int)(p->pos - p->text), p->text,
+                          strlen(p->text) > 64 ? "..." : "", what);
+        p->failed = true;
+    }
+    return -1;
+}
+
+static void skip_space(expr_parser_t *p) {
+    while (isspace((unsigned char)*p->pos)) {
+        p->pos++;
+    }
+}
+
+/* Apply a binary operator to two scalars (constant folding) */
+static double apply_binary(expr_op_t op, double a, double b) {
+    switch (op) {
+    case OP_ADD: return a + b;
+    case OP_SUB: return a - b;
+    case OP_MUL: return a * b;
+    case OP_DIV: return b != 0.0 ? a / b : 0.0;
+    case OP_LT: return a < b;
+    case OP_LE: return a <= b;
+    case OP_GT: return a > b;
+    case OP_GE: return a >= b;
+    case OP_EQ: return a == b;
+    case OP_NE: return a != b;
+    case OP_AND: return a != 0.0 && b != 0.0;
+    case OP_OR: return a != 0.0 || b != 0.0;
+    default: return 0.0;
+    }
+}
+
+/* Allocate a node, folding constant operands of operator nodes */
+static int new_node(expr_parser_t *p, expr_op_t op, int left, int right) {
+    expr_node_t *n, *l, *r;
+
+    if (left < 0 || (op != OP_NEG && op != OP_CONST && op != OP_VAR && right < 0)) {
+        return -1;
+    }
+
+    l = left >= 0 && op != OP_CONST && op != OP_VAR ? &p->nodes[left] : NULL;
+    r = right >= 0 ? &p->nodes[right] : NULL;
+
+    /* Constant folding: reuse the left node to hold the result */
+    if (op == OP_NEG && l->op == OP_CONST) {
+        l->value = -l->value;
+        return left;
+    }
+    if (l && r && l->op == OP_CONST && r->op == OP_CONST) {
+        l->value = apply_binary(op, l->value, r->value);
+        return left;
+    }
+
+    if (p->nr_nodes >= EXPR_MAX_NODES) {
+        return parse_error(p, "expression too long");
+    }
+
+    n = &p->nodes[p->nr_nodes];
+    memset(n, 0, sizeof(expr_node_t));
+    n->op = (uint8_t)op;
+    n->left = left;
+    n->right = right;
+    return p->nr_nodes++;
+}
+
+/* Resolve an identifier to a stats field or a constant */
+static int parse_identifier(expr_parser_t *p) {
+    char name[NAME_LEN];
+    size_t len = 0;
+    int i, node, count;
+
+    while (isalnum((unsigned char)*p->pos) || *p->pos == '_') {
+        if (len + 1 >= sizeof(name)) {
+            return parse_error(p, "identifier too long");
+        }
+        name[len++] = *p->pos++;
+    }
+    name[len] = '\0';
+
+    for (i = 0; i < (int)NR_BUILTIN_VARS; i++) {
+        if (strcmp(builtin_vars[i].name, name) == 0) {
+            node = new_node(p, OP_VAR, 0, -1);
+            if (node >= 0) {
+                p->nodes[node].offset = builtin_vars[i].offset;
+                p->nodes[node].type = builtin_vars[i].type;
+            }
+            return node;
+        }
+    }
+
+    count = perfmon_user_counter_count();
+    for (i = 0; i < count; i++) {
+        if (strcmp(perfmon_user_counter_name(i), name) == 0) {
+            node = new_node(p, OP_VAR, 0, -1);
+            if (node >= 0) {
+                p->nodes[node].offset =
+                    (uint16_t)(offsetof(perfmon_stats_t, user_counters) + i * sizeof(uint64_t));
+                p->nodes[node].type = VAR_U64;
+            }
+            return node;
+        }
+    }
+
+    pthread_mutex_lock(&constants_lock);
+    for (i = 0; i < nr_constants; i++) {
+        if (strcmp(constants[i].name, name) == 0) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&constants_lock);
+    if (i < nr_constants) {
+        node = new_node(p, OP_CONST, 0, -1);
+        if (node >= 0) {
+            p->nodes[node].value = constants[i].value;
+        }
+        return node;
+    }
+
+    p->pos -= len;
+    return parse_error(p, "unknown identifier");
+}
+
+static int parse_expr(expr_parser_t *p);
+
+/* Enter a nested construct; false (error recorded) past EXPR_MAX_NESTING */
+static bool enter_nesting(expr_parser_t *p) {
+    if (++p->nesting > EXPR_MAX_NESTING) {
+        parse_error(p, "formula nested too deeply");
+        return false;
+    }
+    return true;
+}
+
+/* primary := number | identifier | '(' expr ')' */
+static int parse_primary(expr_parser_t *p) {
+    char *end;
+    double value;
+    int node;
+
+    skip_space(p);
+
+    if (*p->pos == '(') {
+        p->pos++;
+        if (!enter_nesting(p)) {
+            return -1;
+        }
+        node = parse_expr(p);
+        p->nesting--;
+        skip_space(p);
+        if (*p->pos != ')') {
+            return parse_error(p, "expected ')'");
+        }
+        p->pos++;
+        return node;
+    }
+
+    if (isdigit((unsigned char)*p->pos) || *p->pos == '.') {
+        value = strtod(p->pos, &end);
+        if (end == p->pos) {
+            return parse_error(p, "invalid number");
+        }
+        p->pos = end;
+        node = new_node(p, OP_CONST, 0, -1);
+        if (node >= 0) {
+            p->nodes[node].value = value;
+        }
+        return node;
+    }
+
+    if (isalpha((unsigned char)*p->pos) || *p->pos == '_') {
+        return parse_identifier(p);
+    }
+
+    return parse_error(p, *p->pos ? "unexpected character" : "unexpected end of formula");
+}
+
+/* unary := '-' unary | '+' unary | primary */
+static int parse_unary(expr_parser_t *p) {
+    int node;
+
+    skip_space(p);
+    if (*p->pos == '-' || *p->pos == '+') {
+        if (!enter_nesting(p)) {
+            return -1;
+        }
+        if (*p->pos++ == '-') {
+            node = parse_unary(p);
+            node = new_node(p, OP_NEG, node, -1);
+        } else {
+            node = parse_unary(p);
+        }
+        p->nesting--;
+        return node;
+    }
+    return parse_primary(p);
+}
+
+/* term := unary (('*' | '/') unary)* */
+static int parse_term(expr_parser_t *p) {
+    int left = parse_unary(p);
+    char c;
+
+    for (;;) {
+        skip_space(p);
+        c = *p->pos;
+        if (c != '*' && c != '/') {
+            return left;
+        }
+        p->pos++;
+        left = new_node(p, c == '*' ? OP_MUL : OP_DIV, left, parse_unary(p));
+    }
+}
+
+/* sum := term (('+' | '-') term)* */
+static int parse_sum(expr_parser_t *p) {
+    int left = parse_term(p);
+    char c;
+
+    for (;;) {
+        skip_space(p);
+        c = *p->pos;
+        if (c != '+' && c != '-') {
+            return left;
+        }
+        p->pos++;
+        left = new_node(p, c == '+' ? OP_ADD : OP_SUB, left, parse_term(p));
+    }
+}
+
+/* Match a symbolic or word operator at the current position */
+static bool match_operator(expr_parser_t *p, const char *symbol, const char *word) {
+    size_t len;
+
+    skip_space(p);
+    len = strlen(symbol);
+    if (strncmp(p->pos, symbol, len) == 0) {
+        p->pos += len;
+        return true;
+    }
+    len = strlen(word);
+    if (strncmp(p->pos, word, len) == 0 &&
+        !isalnum((unsigned char)p->pos[len]) && p->pos[len] != '_') {
+        p->pos += len;
+        return true;
+    }
+    return false;
+}
+
+/* compare := sum (('<' | '<=' | '>' | '>=' | '==' | '!=') sum)? */
+static int parse_compare(expr_parser_t *p) {
+    int left = parse_sum(p);
+    expr_op_t op;
+
+    skip_space(p);
+    if (strncmp(p->pos, "<=", 2) == 0) {
+        op = OP_LE;
+    } else if (strncmp(p->pos, ">=", 2) == 0) {
+        op = OP_GE;
+    } else if (strncmp(p->pos, "==", 2) == 0) {
+        op = OP_EQ;
+    } else if (strncmp(p->pos, "!=", 2) == 0) {
+        op = OP_NE;
+    } else if (*p->pos == '<') {
+        op = OP_LT;
+    } else if (*p->pos == '>') {
+        op = OP_GT;
+    } else {
+        return left;
+    }
+    p->pos += (op == OP_LT || op == OP_GT) ? 1 : 2;
+
+    return new_node(p, op, left, parse_sum(p));
+}
+
+/* conjunction := compare (('and' | '&&') compare)* */
+static int parse_and(expr_parser_t *p) {
+    int left = parse_compare(p);
+
+    while (match_operator(p, "&&", "and")) {
+        left = new_node(p, OP_AND, left, parse_compare(p));
+    }
+    return left;
+}
+
+/* expr := conjunction (('or' | '||') conjunction)* */
+static int parse_expr(expr_parser_t *p) {
+    int left = parse_and(p);
+
+    while (match_operator(p, "||", "or")) {
+        left = new_node(p, OP_OR, left, parse_and(p));
+    }
+    return left;
+}
+
+/* Stack depth needed to evaluate a subtree */
+static int node_depth(const expr_parser_t *p, int node) {
+    const expr_node_t *n = &p->nodes[node];
+    int l, r;
+
+    switch (n->op) {
+    case OP_CONST:
+    case OP_VAR:
+        return 1;
+    case OP_NEG:
+        return node_depth(p, n->left);
+    default:
+        l = node_depth(p, n->left);
+        r = node_depth(p, n->right) + 1;
+        return l > r ? l : r;
+    }
+}
+
+/* Emit postfix bytecode for a subtree */
+static void emit(const expr_parser_t *p, int node, perfmon_expr_t *expr) {
+    const expr_node_t *n = &p->nodes[node];
+    expr_insn_t *insn;
+
+    if (n->op != OP_CONST && n->op != OP_VAR) {
+        emit(p, n->left, expr);
+        if (n->op != OP_NEG) {
+            emit(p, n->right, expr);
+        }
+    }
+
+    insn = &expr->insns[expr->nr_insns++];
+    insn->op = n->op;
+    insn->type = n->type;
+    insn->offset = n->offset;
+    insn->value = n->value;
+}
+
+/* Define a named constant */
+bool perfmon_expr_define_constant(const char *name, double value) {
+    int i;
+
+    if (!name || !name[0] || strlen(name) >= NAME_LEN) {
+        perfmon_set_error("Invalid constant name");
+        return false;
+    }
+
+    pthread_mutex_lock(&constants_lock);
+    for (i = 0; i < nr_constants; i++) {
+        if (strcmp(constants[i].name, name) == 0) {
+            break;
+        }
+    }
+    if (i == MAX_CONSTANTS) {
+        pthread_mutex_unlock(&constants_lock);
+        perfmon_set_error("Too many constants (max %d)", MAX_CONSTANTS);
+        return false;
+    }
+    strcpy(constants[i].name, name);
+    constants[i].value = value;
+    if (i == nr_constants) {
+        nr_constants++;
+    }
+    pthread_mutex_unlock(&constants_lock);
+    return true;
+}
+
+/* Compile a formula */
+perfmon_expr_t *perfmon_expr_compile(const char *formula) {
+    expr_parser_t *p;
+    perfmon_expr_t *expr = NULL;
+    int root, depth;
+
+    if (!formula) {
+        perfmon_set_error("Invalid formula");
+        return NULL;
+    }
+
+    p = (expr_parser_t *)calloc(1, sizeof(expr_parser_t));
+    if (!p) {
+        perfmon_set_error("Failed to allocate parser");
+        return NULL;
+    }
+    p->text = formula;
+    p->pos = formula;
+
+    root = parse_expr(p);
+    skip_space(p);
+    if (!p->failed && *p->pos) {
+        parse_error(p, "unexpected trailing input");
+    }
+    if (p->failed || root < 0) {
+        free(p);
+        return NULL;
+    }
+
+    depth = node_depth(p, root);
+    if (depth > EXPR_MAX_DEPTH) {
+        perfmon_set_error("Expression too deeply nested (max depth %d)", EXPR_MAX_DEPTH);
+        free(p);
+        return NULL;
+    }
+
+    expr = (perfmon_expr_t *)calloc(1, sizeof(perfmon_expr_t) + p->nr_nodes * sizeof(expr_insn_t));
+    if (!expr) {
+        perfmon_set_error("Failed to allocate expression");
+        free(p);
+        return NULL;
+    }
+    expr->max_depth = depth;
+    emit(p, root, expr);
+
+    free(p);
+    return expr;
+}
+
+/* Load one field column for a chunk of samples */
+static void load_column(const expr_insn_t *insn, const perfmon_stats_t *samples, size_t m,
+                        double *col) {
+    const char *base = (const char *)samples + insn->offset;
+    size_t i;
+
+    if (insn->type == VAR_U64) {
+        for (i = 0; i < m; i++) {
+            col[i] = (double)*(const uint64_t *)(base + i * sizeof(perfmon_stats_t));
+        }
+    } else if (insn->type == VAR_BOOL) {
+        for (i = 0; i < m; i++) {
+            col[i] = *(const bool *)(base + i * sizeof(perfmon_stats_t)) ? 1.0 : 0.0;
+        }
+    } else {
+        for (i = 0; i < m; i++) {
+            col[i] = *(const double *)(base + i * sizeof(perfmon_stats_t));
+        }
+    }
+}
+
+/* Evaluate for n samples */
+void perfmon_expr_eval_batch(const perfmon_expr_t *expr, const perfmon_stats_t *samples,
+                             size_t n, double *out) {
+    double stack[EXPR_MAX_DEPTH][EXPR_CHUNK];
+    const expr_insn_t *insn;
+    size_t base, m, i;
+    double *a, *b;
+    int pc, sp;
+
+    if (!expr || !samples || !out) {
+        return;
+    }
+
+    for (base = 0; base < n; base += EXPR_CHUNK) {
+        m = n - base < EXPR_CHUNK ? n - base : EXPR_CHUNK;
+        sp = 0;
+
+        for (pc = 0; pc < expr->nr_insns; pc++) {
+            insn = &expr->insns[pc];
+            a = stack[sp - 2 >= 0 ? sp - 2 : 0];
+            b = stack[sp - 1 >= 0 ? sp - 1 : 0];
+
+            switch (insn->op) {
+            case OP_CONST:
+                for (i = 0; i < m; i++) {
+                    stack[sp][i] = insn->value;
+                }
+                sp++;
+                break;
+            case OP_VAR:
+                load_column(insn, samples + base, m, stack[sp]);
+                sp++;
+                break;
+            case OP_ADD:
+                for (i = 0; i < m; i++) {
+                    a[i] += b[i];
+                }
+                sp--;
+                break;
+            case OP_SUB:
+                for (i = 0; i < m; i++) {
+                    a[i] -= b[i];
+                }
+                sp--;
+                break;
+            case OP_MUL:
+                for (i = 0; i < m; i++) {
+                    a[i] *= b[i];
+                }
+                sp--;
+                break;
+            case OP_DIV:
+                for (i = 0; i < m; i++) {
+                    a[i] = b[i] != 0.0 ? a[i] / b[i] : 0.0;
+                }
+                sp--;
+                break;
+            case OP_NEG:
+                for (i = 0; i < m; i++) {
+                    b[i] = -b[i];
+                }
+                break;
+            case OP_LT:
+                for (i = 0; i < m; i++) {
+                    a[i] = a[i] < b[i];
+                }
+                sp--;
+                break;
+            case OP_LE:
+                for (i = 0; i < m; i++) {
+                    a[i] = a[i] <= b[i];
+                }
+                sp--;
+                break;
+            case OP_GT:
+                for (i = 0; i < m; i++) {
+                    a[i] = a[i] > b[i];
+                }
+                sp--;
+                break;
+            case OP_GE:
+                for (i = 0; i < m; i++) {
+                    a[i] = a[i] >= b[i];
+                }
+                sp--;
+                break;
+            case OP_EQ:
+                for (i = 0; i < m; i++) {
+                    a[i] = a[i] == b[i];
+                }
+                sp--;
+                break;
+            case OP_NE:
+                for (i = 0; i < m; i++) {
+                    a[i] = a[i] != b[i];
+                }
+                sp--;
+                break;
+            case OP_AND:
+                for (i = 0; i < m; i++) {
+                    a[i] = (a[i] != 0.0) & (b[i] != 0.0);
+                }
+                sp--;
+                break;
+            case OP_OR:
+                for (i = 0; i < m; i++) {
+                    a[i] = (a[i] != 0.0) | (b[i] != 0.0);
+                }
+                sp--;
+                break;
+            }
+        }
+
+        memcpy(out + base, stack[0], m * sizeof(double));
+    }
+}
+
+/* Evaluate for one sample */
+double perfmon_expr_eval(const perfmon_expr_t *expr, const perfmon_stats_t *stats) {
+    double result = 0.0;
+
+    perfmon_expr_eval_batch(expr, stats, 1, &result);
+    return result;
+}
+
+/* Number of bytecode instructions */
+int perfmon_expr_size(const perfmon_expr_t *expr) {
+    return expr ? expr->nr_insns : 0;
+}
+
+/* Free a compiled expression */
+void perfmon_expr_free(perfmon_expr_t *expr) {
+    free(expr);
+}
+
+/* Define a derived metric */
+int perfmon_metric_define(const char *name, const char *formula) {
+    perfmon_expr_t *expr;
+    int i, id = -1;
+
+    if (!name || !name[0] || strlen(name) >= NAME_LEN) {
+        perfmon_set_error("Invalid metric name");
+        return -1;
+    }
+
+    expr = perfmon_expr_compile(formula);
+    if (!expr) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&metrics_lock);
+    for (i = 0; i < nr_metrics; i++) {
+        if (strcmp(metrics[i].name, name) == 0) {
+            break;
+        }
+    }
+    if (i < nr_metrics) {
+        perfmon_set_error("Metric already defined: %s", name);
+    } else if (nr_metrics == PERFMON_MAX_METRICS) {
+        perfmon_set_error("Too many metrics (max %d)", PERFMON_MAX_METRICS);
+    } else {
+        id = nr_metrics;
+        strcpy(metrics[id].name, name);
+        metrics[id].expr = expr;
+        __atomic_store_n(&nr_metrics, id + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&metrics_lock);
+
+    if (id == -1) {
+        perfmon_expr_free(expr);
+    }
+    return id;
+}
+
+/* Define metrics from "name=formula;name=formula" */
+int perfmon_metric_define_list(const char *spec) {
+    char buf[1024];
+    char *item, *save = NULL, *eq, *name, *end;
+    int defined = 0;
+
+    if (!spec || strlen(spec) >= sizeof(buf)) {
+        perfmon_set_error("Invalid metric list");
+        return -1;
+    }
+    strcpy(buf, spec);
+
+    for (item = strtok_r(buf, ";", &save); item; item = strtok_r(NULL, ";", &save)) {
+        eq = strchr(item, '=');
+        if (!eq) {
+            perfmon_set_error("Expected name=formula in \"%s\"", item);
+            return -1;
+        }
+        *eq = '\0';
+
+        /* Trim the name */
+        for (name = item; isspace((unsigned char)*name); name++) {
+        }
+        for (end = eq; end > name && isspace((unsigned char)end[-1]); end--) {
+        }
+        *end = '\0';
+
+        if (perfmon_metric_define(name, eq + 1) < 0) {
+            return -1;
+        }
+        defined++;
+    }
+
+    return defined;
+}
+
+/* Number of defined metrics */
+int perfmon_metric_count(void) {
+    return __atomic_load_n(&nr_metrics, __ATOMIC_ACQUIRE);
+}
+
+/* Name of a defined metric */
+const char *perfmon_metric_name(int id) {
+    if (id < 0 || id >= perfmon_metric_count()) {
+        return NULL;
+    }
+    return metrics[id].name;
+}
+
+/* Evaluate all defined metrics into stats->metrics */
+void perfmon_metrics_evaluate(perfmon_stats_t *stats) {
+    int i, count = perfmon_metric_count();
+
+    for (i = 0; i < count; i++) {
+        stats->metrics[i] = perfmon_expr_eval(metrics[i].expr, stats);
+    }
+}
+
+/* Read PERFMON_METRICS from the environment */
+static void load_env_metrics(void) {
+    const char *spec = getenv("PERFMON_METRICS");
+
+    if (spec && spec[0]) {
+        perfmon_metric_define_list(spec);
+    }
+}
+
+/* Define the metrics from the environment once per process */
+void perfmon_metrics_load_env(void) {
+    pthread_once(&metrics_env_once, load_env_metrics);
+}
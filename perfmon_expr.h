@@ -0,0 +1,118 @@
+/*
+ * libperfmon - Derived Metric Expressions
+ *
+ * A small expression language over perfmon_stats_t fields:
+ *
+ *   1000 * cache_misses / instructions          (MPKI)
+ *   cycles / task_clock                         (effective GHz)
+ *   (branch_misses * 20) / cycles               (approx. mispredict stall fraction)
+ *
+ * Operands are numbers, counter names (cycles, instructions, branches,
+ * branch_misses, cache_references, cache_misses / LLC_misses,
+ * dtlb_load_misses, itlb_misses, page_faults, minor_faults, major_faults,
+ * context_switches, cpu_migrations, ref_cycles, task_clock (ns),
+ * node_loads, node_load_misses, node_migrations, elapsed_time_sec / time),
+ * the derived insn_per_cycle, branch_miss_rate, cache_miss_rate,
+ * effective_ghz, turbo_ratio and remote_load_rate, the RAPL energies in
+ * joules (energy_pkg, energy_cores, energy_ram, energy_gpu, energy_psys),
+ * the OS counters (io_read_bytes, io_write_bytes, io_syscr, io_syscw,
+ * run_delay_ns, voluntary_switches, involuntary_switches,
+ * process_max_rss_kb / max_rss_kb),
+ * the pressure percentages (psi_cpu_some, psi_memory_some, psi_memory_full,
+ * psi_io_some, psi_io_full), registered user counter names and constants
+ * defined with perfmon_expr_define_constant().
+ * Operators are + - * / and unary minus; division by zero yields 0.
+ * Comparisons (< <= > >= == !=) and the logical operators and/&&, or/||
+ * yield 1 or 0, so a formula can also serve as a condition:
+ *
+ *   insn_per_cycle < 0.5 and 1000 * cache_misses / instructions > 10
+ *
+ * Formulas are compiled once to a constant-folded stack bytecode.  Batch
+ * evaluation runs each instruction over a chunk of samples in a flat loop,
+ * so the inner loops vectorize.
+ */
+
+#ifndef PERFMON_EXPR_H
+#define PERFMON_EXPR_H
+
+#include <stddef.h>
+#include "perfmon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Compiled expression (opaque handle) */
+typedef struct perfmon_expr perfmon_expr_t;
+
+/*
+ * Define a named constant (e.g. "base_ghz") usable in formulas.
+ * Constants are folded at compile time; define them before compiling.
+ * Returns: true on success, false on failure
+ */
+bool perfmon_expr_define_constant(const char *name, double value);
+
+/*
+ * Compile a formula
+ * Returns: expression on success, NULL on syntax error (see perfmon_get_error)
+ */
+perfmon_expr_t *perfmon_expr_compile(const char *formula);
+
+/*
+ * Evaluate for one sample
+ */
+double perfmon_expr_eval(const perfmon_expr_t *expr, const perfmon_stats_t *stats);
+
+/*
+ * Evaluate for n samples: out[i] = expr(samples[i])
+ */
+void perfmon_expr_eval_batch(const perfmon_expr_t *expr, const perfmon_stats_t *samples,
+                             size_t n, double *out);
+
+/*
+ * Number of bytecode instructions after constant folding
+ */
+int perfmon_expr_size(const perfmon_expr_t *expr);
+
+/*
+ * Free a compiled expression
+ */
+void perfmon_expr_free(perfmon_expr_t *expr);
+
+/*
+ * Named derived metrics
+ *
+ * Metrics are defined once per process and evaluated whenever statistics are
+ * produced (perfmon_stop, perfmon_read, task and region totals) into
+ * perfmon_stats_t.metrics[id].  perfmon_init() also defines the metrics listed
+ * in the PERFMON_METRICS environment variable, e.g.
+ *
+ *   PERFMON_METRICS="mpki=1000*cache_misses/instructions;ghz=cycles/time/1e9"
+ *
+ * User counters referenced by a formula must be registered before it is
+ * defined.
+ */
+
+/*
+ * Define a metric
+ * Returns: id (0..PERFMON_MAX_METRICS-1) on success, -1 on failure
+ */
+int perfmon_metric_define(const char *name, const char *formula);
+
+/*
+ * Define metrics from a "name=formula;name=formula" list
+ * Returns: number of metrics defined, -1 on the first failure
+ */
+int perfmon_metric_define_list(const char *spec);
+
+/*
+ * Number of defined metrics / name of one (NULL if unknown)
+ */
+int perfmon_metric_count(void);
+const char *perfmon_metric_name(int id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PERFMON_EXPR_H */
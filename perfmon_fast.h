@@ -0,0 +1,222 @@
+/*
+ * libperfmon - Inline Fast Path
+ *
+ * Minimal start/stop/read operations for hot loops, as static inline
+ * functions over a layout precomputed by perfmon_fast_open():
+ *
+ *   perfmon_fast_t fast;
+ *   perfmon_counter_type_t events[] = {PERFMON_CYCLES, PERFMON_INSTRUCTIONS};
+ *
+ *   perfmon_fast_open(&fast, events, 2);    // once, out of line
+ *   perfmon_fast_enable(&fast);             // one group ioctl
+ *
+ *   perfmon_fast_sample(&fast, &begin);     // rdpmc + TSC, no syscalls
+ *   probe_batch();
+ *   perfmon_fast_sample(&fast, &end);
+ *   perfmon_fast_delta(&fast, &begin, &end, &delta);
+ *
+ * Counters stay enabled between regions; a region is two samples and a
+ * subtraction.  Events that cannot be read with rdpmc (software events, or
+ * kernels without cap_user_rdpmc) fall back to a group read().
+ */
+
+#ifndef PERFMON_FAST_H
+#define PERFMON_FAST_H
+
+#include "perfmon.h"
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Maximum number of events in one fast-path group */
+#define PERFMON_FAST_MAX_EVENTS 8
+
+/* Precomputed fast-path layout (filled by perfmon_fast_open) */
+typedef struct {
+    int nr_events;
+    int group_fd;                                    /* group leader */
+    int fds[PERFMON_FAST_MAX_EVENTS];
+    perfmon_counter_type_t types[PERFMON_FAST_MAX_EVENTS];
+    struct perf_event_mmap_page *pages[PERFMON_FAST_MAX_EVENTS];  /* NULL: use read() */
+} perfmon_fast_t;
+
+/* One snapshot of all events plus the timestamp counter */
+typedef struct {
+    uint64_t tsc;
+    uint64_t values[PERFMON_FAST_MAX_EVENTS];
+} perfmon_fast_sample_t;
+
+/*
+ * Open the given events as one group and map their user pages for rdpmc.
+ * The group starts disabled.
+ * Returns: true on success, false on failure (see perfmon_get_error)
+ */
+bool perfmon_fast_open(perfmon_fast_t *fast, const perfmon_counter_type_t *types, int nr_events);
+
+/*
+ * Unmap pages and close all events
+ */
+void perfmon_fast_close(perfmon_fast_t *fast);
+
+/* Enable/disable/reset the whole group with a single ioctl */
+static inline void perfmon_fast_enable(const perfmon_fast_t *fast) {
+    ioctl(fast->group_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+static inline void perfmon_fast_disable(const perfmon_fast_t *fast) {
+    ioctl(fast->group_fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+}
+
+static inline void perfmon_fast_reset(const perfmon_fast_t *fast) {
+    ioctl(fast->group_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+}
+
+/* Read the timestamp counter (monotonic nanoseconds where there is none) */
+static inline uint64_t perfmon_fast_rdtsc(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+#elif defined(__aarch64__)
+    uint64_t val;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(val));
+    return val;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PERFMON_FAST_HAVE_RDPMC 1
+
+static inline uint64_t perfmon_fast_rdpmc_raw(uint32_t counter) {
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdpmc" : "=a"(lo), "=d"(hi) : "c"(counter));
+    return ((uint64_t)hi << 32) | lo;
+}
+#else
+#define PERFMON_FAST_HAVE_RDPMC 0
+#endif
+
+/*
+ * Read one event with rdpmc under the mmap page seqlock.
+ * Returns: false when the event is not currently on a hardware counter or
+ * rdpmc is not allowed (the mmap page ABI then requires a read())
+ */
+static inline bool perfmon_fast_rdpmc_event(const perfmon_fast_t *fast, int i, uint64_t *value) {
+#if PERFMON_FAST_HAVE_RDPMC
+    volatile struct perf_event_mmap_page *pc = fast->pages[i];
+    uint32_t seq, idx, cap;
+    uint64_t count, pmc;
+    int width;
+
+    if (!pc) {
+        return false;
+    }
+    do {
+        seq = pc->lock;
+        __asm__ __volatile__("" ::: "memory");
+        idx = pc->index;
+        cap = pc->cap_user_rdpmc;
+        count = pc->offset;
+        if (cap && idx) {
+            width = pc->pmc_width;
+            pmc = perfmon_fast_rdpmc_raw(idx - 1);
+            pmc <<= 64 - width;
+            count += (uint64_t)((int64_t)pmc >> (64 - width));
+        }
+        __asm__ __volatile__("" ::: "memory");
+    } while (pc->lock != seq);
+
+    if (cap && idx) {
+        *value = count;
+        return true;
+    }
+#else
+    (void)fast;
+    (void)i;
+    (void)value;
+#endif
+    return false;
+}
+
+/* The whole group with one read() (PERF_FORMAT_GROUP): nr, then one value per event */
+static inline bool perfmon_fast_read_values(const perfmon_fast_t *fast,
+                                            uint64_t buf[1 + PERFMON_FAST_MAX_EVENTS]) {
+    ssize_t len = (ssize_t)((1 + fast->nr_events) * sizeof(uint64_t));
+
+    return read(fast->group_fd, buf, len) == len;
+}
+
+/*
+ * Read one event: rdpmc when possible, else a group read()
+ */
+static inline uint64_t perfmon_fast_read_event(const perfmon_fast_t *fast, int i) {
+    uint64_t buf[1 + PERFMON_FAST_MAX_EVENTS];
+    uint64_t count;
+
+    if (perfmon_fast_rdpmc_event(fast, i, &count)) {
+        return count;
+    }
+    return perfmon_fast_read_values(fast, buf) ? buf[1 + i] : 0;
+}
+
+/*
+ * Snapshot all events and the TSC: rdpmc for the events on hardware
+ * counters, and at most one group read() for all the others
+ */
+static inline void perfmon_fast_sample(const perfmon_fast_t *fast, perfmon_fast_sample_t *sample) {
+    uint64_t buf[1 + PERFMON_FAST_MAX_EVENTS];
+    int i, state = 0;       /* group read: 0 not yet, 1 done, -1 failed */
+
+    for (i = 0; i < fast->nr_events; i++) {
+        if (perfmon_fast_rdpmc_event(fast, i, &sample->values[i])) {
+            continue;
+        }
+        if (state == 0) {
+            state = perfmon_fast_read_values(fast, buf) ? 1 : -1;
+        }
+        sample->values[i] = state == 1 ? buf[1 + i] : 0;
+    }
+    sample->tsc = perfmon_fast_rdtsc();
+}
+
+/* Read the whole group with a single read() (PERF_FORMAT_GROUP) */
+static inline bool perfmon_fast_read_group(const perfmon_fast_t *fast, perfmon_fast_sample_t *sample) {
+    uint64_t buf[1 + PERFMON_FAST_MAX_EVENTS];
+    int i;
+
+    if (!perfmon_fast_read_values(fast, buf)) {
+        return false;
+    }
+    for (i = 0; i < fast->nr_events; i++) {
+        sample->values[i] = buf[1 + i];
+    }
+    sample->tsc = perfmon_fast_rdtsc();
+    return true;
+}
+
+/* delta = end - begin */
+static inline void perfmon_fast_delta(const perfmon_fast_t *fast, const perfmon_fast_sample_t *begin,
+                                      const perfmon_fast_sample_t *end, perfmon_fast_sample_t *delta) {
+    int i;
+
+    for (i = 0; i < fast->nr_events; i++) {
+        delta->values[i] = end->values[i] - begin->values[i];
+    }
+    delta->tsc = end->tsc - begin->tsc;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PERFMON_FAST_H */
@@ -0,0 +1,277 @@
+/*
+ * libperfmon - Host Metadata
+ *
+ * What produced the counts: CPU model and microcode from /proc/cpuinfo,
+ * caches and SMT from /sys/devices/system/cpu, the frequency governor,
+ * perf_event_paranoid, the kernel release and the hypervisor (CPUID leaf
+ * 0x40000000 on x86, /sys/hypervisor elsewhere).  Captured once per
+ * process; the hash is FNV-1a over the canonical "key=value" block, so two
+ * hosts share a hash exactly when every field matches.
+ */
+
+#define _GNU_SOURCE
+#include "perfmon.h"
+#include "perfmon_internal.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/utsname.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#define CPU_DIR "/sys/devices/system/cpu"
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+static perfmon_host_t host;
+static pthread_once_t host_once = PTHREAD_ONCE_INIT;
+
+/* Copy at most size - 1 bytes of src, trimmed of surrounding blanks */
+static void copy_trimmed(char *dst, const char *src, size_t size) {
+    size_t len;
+
+    while (*src == ' ' || *src == '\t') {
+        src++;
+    }
+    len = strcspn(src, "\n");
+    while (len > 0 && (src[len - 1] == ' ' || src[len - 1] == '\t')) {
+        len--;
+    }
+    if (len >= size) {
+        len = size - 1;
+    }
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+/* Model name and microcode of the first processor in /proc/cpuinfo */
+static void read_cpuinfo(void) {
+    char line[512], *colon;
+    FILE *f = fopen("/proc/cpuinfo", "r");
+
+    if (!f) {
+        return;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '\n') {
+            break;      /* end of the first processor */
+        }
+        colon = strchr(line, ':');
+        if (!colon) {
+            continue;
+        }
+        if (strncmp(line, "model name", 10) == 0) {
+            copy_trimmed(host.cpu_model, colon + 1, sizeof(host.cpu_model));
+        } else if (strncmp(line, "microcode", 9) == 0) {
+            copy_trimmed(host.microcode, colon + 1, sizeof(host.microcode));
+        }
+    }
+    fclose(f);
+}
+
+/* "48K", "2048K", "30M" in KiB */
+static uint32_t parse_size_kb(const char *s) {
+    char *end;
+    unsigned long v = strtoul(s, &end, 10);
+
+    if (*end == 'M') {
+        v *= 1024;
+    } else if (*end != 'K') {
+        v /= 1024;
+    }
+    return (uint32_t)v;
+}
+
+/* Cache sizes and line size of cpu0 */
+static void read_caches(void) {
+    char path[128], level[16], type[32], size[32];
+    uint32_t kb;
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        snprintf(path, sizeof(path), CPU_DIR "/cpu0/cache/index%d/level", i);
+        if (!perfmon_read_line(path, level, sizeof(level))) {
+            break;
+        }
+        snprintf(path, sizeof(path), CPU_DIR "/cpu0/cache/index%d/type", i);
+        if (!perfmon_read_line(path, type, sizeof(type))) {
+            continue;
+        }
+        snprintf(path, sizeof(path), CPU_DIR "/cpu0/cache/index%d/size", i);
+        if (!perfmon_read_line(path, size, sizeof(size))) {
+            continue;
+        }
+        kb = parse_size_kb(size);
+
+        if (strcmp(level, "1") == 0 && strcmp(type, "Data") == 0) {
+            host.l1d_kb = kb;
+            snprintf(path, sizeof(path), CPU_DIR "/cpu0/cache/index%d/coherency_line_size", i);
+            if (perfmon_read_line(path, size, sizeof(size))) {
+                host.cache_line_size = (uint32_t)atoi(size);
+            }
+        } else if (strcmp(level, "1") == 0 && strcmp(type, "Instruction") == 0) {
+            host.l1i_kb = kb;
+        } else if (strcmp(level, "2") == 0) {
+            host.l2_kb = kb;
+        } else if (strcmp(level, "3") == 0) {
+            host.l3_kb = kb;
+        }
+    }
+}
+
+static void read_smt(void) {
+    char line[256];
+    int cpus[64];
+
+    if (perfmon_read_line(CPU_DIR "/smt/active", line, sizeof(line))) {
+        host.smt_active = atoi(line) == 1;
+    }
+    if (perfmon_read_line(CPU_DIR "/cpu0/topology/thread_siblings_list", line, sizeof(line))) {
+        host.threads_per_core = perfmon_parse_cpu_list(line, cpus, 64);
+    }
+}
+
+/* Hypervisor vendor, "" on bare metal */
+static void read_hypervisor(void) {
+    static const struct {
+        const char *signature;
+        const char *name;
+    } vendors[] = {
+        {"KVMKVMKVM", "kvm"},
+        {"Microsoft Hv", "hyper-v"},
+        {"VMwareVMware", "vmware"},
+        {"XenVMMXenVMM", "xen"},
+        {"TCGTCGTCGTCG", "qemu"},
+        {"ACRNACRNACRN", "acrn"},
+        {"bhyve bhyve ", "bhyve"},
+    };
+    char line[PERFMON_HOST_STR_LEN];
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+    char signature[13];
+    size_t i;
+
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & (1u << 31))) {
+        __cpuid(0x40000000, eax, ebx, ecx, edx);
+        memcpy(signature, &ebx, 4);
+        memcpy(signature + 4, &ecx, 4);
+        memcpy(signature + 8, &edx, 4);
+        signature[12] = '\0';
+        for (i = 0; i < sizeof(vendors) / sizeof(vendors[0]); i++) {
+            if (strcmp(signature, vendors[i].signature) == 0) {
+                strcpy(host.hypervisor, vendors[i].name);
+                return;
+            }
+        }
+        copy_trimmed(host.hypervisor, signature[0] ? signature : "unknown",
+                     sizeof(host.hypervisor));
+        return;
+    }
+#else
+    (void)vendors;
+#endif
+    if (perfmon_read_line("/sys/hypervisor/type", line, sizeof(line))) {
+        copy_trimmed(host.hypervisor, line, sizeof(host.hypervisor));
+    }
+}
+
+static uint64_t fnv1a(uint64_t hash, const char *s) {
+    while (*s) {
+        hash ^= (unsigned char)*s++;
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+/* The block that is printed and hashed */
+static int format_block(const perfmon_host_t *h, char *buf, size_t size, const char *indent) {
+    return snprintf(buf, size,
+                    "%scpu_model=%s\n"
+                    "%smicrocode=%s\n"
+                    "%scaches=L1d %uK, L1i %uK, L2 %uK, L3 %uK, line %uB\n"
+                    "%scpus=%d online, %d threads/core, smt %s\n"
+                    "%snuma_nodes=%d\n"
+                    "%sgovernor=%s\n"
+                    "%sperf_event_paranoid=%d\n"
+                    "%skernel=%s\n"
+                    "%shypervisor=%s\n",
+                    indent, h->cpu_model[0] ? h->cpu_model : "unknown",
+                    indent, h->microcode[0] ? h->microcode : "unknown",
+                    indent, h->l1d_kb, h->l1i_kb, h->l2_kb, h->l3_kb, h->cache_line_size,
+                    indent, h->online_cpus, h->threads_per_core, h->smt_active ? "on" : "off",
+                    indent, h->numa_nodes,
+                    indent, h->governor[0] ? h->governor : "none",
+                    indent, h->perf_event_paranoid,
+                    indent, h->kernel,
+                    indent, h->hypervisor[0] ? h->hypervisor : "none");
+}
+
+static void capture_host(void) {
+    char line[256], block[1024];
+    struct utsname uts;
+
+    memset(&host, 0, sizeof(host));
+    host.perf_event_paranoid = -100;
+
+    read_cpuinfo();
+    if (!host.cpu_model[0] && uname(&uts) == 0) {
+        copy_trimmed(host.cpu_model, uts.machine, sizeof(host.cpu_model));
+    }
+    if (!host.microcode[0] && perfmon_read_line(CPU_DIR "/cpu0/microcode/version", line, sizeof(line))) {
+        copy_trimmed(host.microcode, line, sizeof(host.microcode));
+    }
+    read_caches();
+    read_smt();
+    host.online_cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    host.numa_nodes = perfmon_numa_nodes();
+    if (perfmon_read_line(CPU_DIR "/cpu0/cpufreq/scaling_governor", line, sizeof(line))) {
+        copy_trimmed(host.governor, line, sizeof(host.governor));
+    }
+    if (perfmon_read_line("/proc/sys/kernel/perf_event_paranoid", line, sizeof(line))) {
+        host.perf_event_paranoid = atoi(line);
+    }
+    if (uname(&uts) == 0) {
+        copy_trimmed(host.kernel, uts.release, sizeof(host.kernel));
+    }
+    read_hypervisor();
+
+    format_block(&host, block, sizeof(block), "");
+    host.hash = fnv1a(FNV_OFFSET, block);
+}
+
+/* Host metadata, captured once per process */
+bool perfmon_host_info(perfmon_host_t *info) {
+    if (!info) {
+        perfmon_set_error("Invalid host info");
+        return false;
+    }
+
+    pthread_once(&host_once, capture_host);
+    *info = host;
+    return true;
+}
+
+/* Hash of the host metadata */
+uint64_t perfmon_host_hash(void) {
+    pthread_once(&host_once, capture_host);
+    return host.hash;
+}
+
+/* Print the host block */
+void perfmon_print_host(const perfmon_host_t *info, int fd) {
+    char block[1024];
+
+    if (!info) {
+        return;
+    }
+
+    format_block(info, block, sizeof(block), "  ");
+    dprintf(fd, "\nHost %016lx:\n", info->hash);
+    dprintf(fd, "%s", block);
+}
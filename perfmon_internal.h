@@ -0,0 +1,158 @@
+/*
+ * libperfmon - Internal declarations shared between library modules
+ *
+ * Not installed; nothing here is part of the public API.
+ */
+
+#ifndef PERFMON_INTERNAL_H
+#define PERFMON_INTERNAL_H
+
+#include "perfmon.h"
+
+#include <pthread.h>
+
+#define PERFMON_INTERNAL __attribute__((visibility("hidden")))
+
+/* Set the thread-local error message returned by perfmon_get_error() */
+PERFMON_INTERNAL void perfmon_set_error(const char *fmt, ...)
+    __attribute__((format(printf, 1, 2)));
+
+/*
+ * Open one perf event for pid (0: calling thread, -1: all) on cpu (-1: any).
+ * Standalone events (group_fd -1) start disabled; errors are recorded.
+ * Returns: fd on success, -1 on failure
+ */
+PERFMON_INTERNAL int perfmon_open_event(uint32_t type, uint64_t config, int pid, int cpu,
+                                        int group_fd, uint64_t read_format);
+
+/*
+ * Open one of the built-in counters as a perf event (see perfmon_open_event)
+ * Returns: fd on success, -1 on failure
+ */
+PERFMON_INTERNAL int perfmon_open_counter(perfmon_counter_type_t counter, int group_fd,
+                                          uint64_t read_format);
+
+/* Node-local/remote load counters, opened only with opts.numa */
+#define PERFMON_NUMA_COUNTERS ((1u << PERFMON_NODE_LOADS) | (1u << PERFMON_NODE_LOAD_MISSES))
+
+/* Hardware and hardware-cache events: the counters before PERFMON_PAGE_FAULTS, ref-cycles and node loads */
+#define PERFMON_HW_COUNTERS (((1u << PERFMON_PAGE_FAULTS) - 1) | (1u << PERFMON_REF_CYCLES) | \
+                             PERFMON_NUMA_COUNTERS)
+
+/* First line of a (sysfs) file without the newline; false if it cannot be read */
+PERFMON_INTERNAL bool perfmon_read_line(const char *path, char *buf, size_t size);
+
+/*
+ * Parse a CPU list such as "0,28" or "0-3,8-11" into cpus
+ * Returns: number of CPUs stored, at most max
+ */
+PERFMON_INTERNAL int perfmon_parse_cpu_list(const char *list, int *cpus, int max);
+
+/* CPU and NUMA node the calling thread runs on (perfmon_numa.c) */
+PERFMON_INTERNAL void perfmon_numa_place(int *cpu, int *node);
+
+/*
+ * Open a hardware counter on one core PMU of a hybrid CPU (extended type
+ * in the upper config bits); software counters cannot be
+ * Returns: fd on success, -1 on failure
+ */
+PERFMON_INTERNAL int perfmon_open_counter_on_pmu(perfmon_counter_type_t counter, uint32_t pmu_type);
+
+/* A core PMU as listed in /sys/bus/event_source/devices */
+typedef struct {
+    char name[PERFMON_PMU_NAME_LEN];
+    uint32_t type;
+} perfmon_core_pmu_t;
+
+/*
+ * Core PMUs that list their CPUs in sysfs (cpu_core, cpu_atom, ...),
+ * discovered once per process; more than one means a hybrid CPU
+ */
+PERFMON_INTERNAL int perfmon_core_pmus(const perfmon_core_pmu_t **pmus);
+
+/*
+ * Counter backend: how a context's counters are opened, driven and read.
+ * Counter sets are bitmasks with bit i for perfmon_counter_type_t i.
+ */
+typedef struct {
+    const char *name;
+    /* Open every counter possible, report them in *available; NULL on failure */
+    void *(*open)(const perfmon_options_t *opts, uint32_t *available);
+    void (*start)(void *state, uint32_t mask);  /* reset and enable */
+    void (*stop)(void *state, uint32_t mask);   /* disable */
+    void (*reset)(void *state, uint32_t mask);
+    /* Current value of every counter (0 if unavailable) */
+    void (*read)(void *state, uint64_t values[PERFMON_MAX_COUNTERS]);
+    uint64_t (*now_ns)(void *state);
+    void (*close)(void *state);
+    /* Values counted on core PMU i of a hybrid CPU; false if none (may be NULL) */
+    bool (*read_pmu)(void *state, int pmu, uint64_t values[PERFMON_MAX_COUNTERS]);
+} perfmon_backend_ops_t;
+
+PERFMON_INTERNAL extern const perfmon_backend_ops_t perfmon_backend_perf_event;
+PERFMON_INTERNAL extern const perfmon_backend_ops_t perfmon_backend_rusage;
+PERFMON_INTERNAL extern const perfmon_backend_ops_t perfmon_backend_mock;
+
+/* Add a delta to a mock backend's enabled counters and clock */
+PERFMON_INTERNAL void perfmon_mock_apply(void *state, const perfmon_stats_t *delta);
+
+/* Scripted cost of an empty mock region (opts.mock_bias), stands in for calibration */
+PERFMON_INTERNAL void perfmon_mock_bias(void *state, uint64_t values[PERFMON_MAX_COUNTERS],
+                                        uint64_t *elapsed_ns);
+
+/* Joules consumed so far by every available RAPL domain (perfmon_energy.c) */
+PERFMON_INTERNAL void perfmon_energy_read(double joules[PERFMON_MAX_ENERGY_DOMAINS]);
+
+/* OS resource counters of one thread (perfmon_os.c) */
+enum {
+    PERFMON_OS_READ_BYTES = 0,
+    PERFMON_OS_WRITE_BYTES,
+    PERFMON_OS_SYSCR,
+    PERFMON_OS_SYSCW,
+    PERFMON_OS_RUN_DELAY,
+    PERFMON_OS_NVCSW,
+    PERFMON_OS_NIVCSW,
+    PERFMON_OS_MAX_RSS,
+    PERFMON_OS_NR
+};
+
+/* Pre-opened /proc files of the thread that created a context (-1: missing) */
+typedef struct {
+    int io_fd;
+    int schedstat_fd;
+    pthread_t owner;
+} perfmon_os_files_t;
+
+PERFMON_INTERNAL void perfmon_os_open(perfmon_os_files_t *files);
+PERFMON_INTERNAL void perfmon_os_close(perfmon_os_files_t *files);
+
+/*
+ * Current values, indexed by PERFMON_OS_*; false (thread counters 0, the
+ * process RSS peak still sampled) when called off the owning thread
+ */
+PERFMON_INTERNAL bool perfmon_os_sample(const perfmon_os_files_t *files,
+                                        uint64_t values[PERFMON_OS_NR]);
+
+/* Store the deltas between two samples in the OS fields of stats; !same_thread marks them */
+PERFMON_INTERNAL void perfmon_os_fill(perfmon_stats_t *stats, const uint64_t start[PERFMON_OS_NR],
+                                      const uint64_t now[PERFMON_OS_NR], bool same_thread);
+
+/* PSI sampler hooks (perfmon_psi.c): sample number at region start, 0 if not running */
+PERFMON_INTERNAL uint64_t perfmon_psi_mark(void);
+
+/* Fill the psi_* fields of stats for a region that started at mark */
+PERFMON_INTERNAL void perfmon_psi_fill(perfmon_stats_t *stats, uint64_t mark);
+
+/* Start the sampler named in PERFMON_PSI, once per process */
+PERFMON_INTERNAL void perfmon_psi_load_env(void);
+
+/* Recompute the derived fields and metrics of stats from its counters */
+PERFMON_INTERNAL void perfmon_compute_derived(perfmon_stats_t *stats);
+
+/* Evaluate all defined metrics into stats->metrics (perfmon_expr.c) */
+PERFMON_INTERNAL void perfmon_metrics_evaluate(perfmon_stats_t *stats);
+
+/* Define the metrics listed in PERFMON_METRICS, once per process */
+PERFMON_INTERNAL void perfmon_metrics_load_env(void);
+
+#endif /* PERFMON_INTERNAL_H */
@@ -0,0 +1,84 @@
+/*
+ * libperfmon - NUMA Topology and Placement
+ *
+ * The CPU-to-node map is built once per process from the cpulist of every
+ * /sys/devices/system/node/node<N> directory.  A placement is the current
+ * CPU from sched_getcpu(), which glibc serves from rseq or the vDSO without
+ * entering the kernel, looked up in that map.
+ */
+
+#define _GNU_SOURCE
+#include "perfmon.h"
+#include "perfmon_internal.h"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NODE_DIR "/sys/devices/system/node"
+
+/* CPUs covered by the map; higher ones report node -1 */
+#define MAX_CPUS 4096
+
+static int16_t cpu_node[MAX_CPUS];
+static int nr_nodes = 1;
+static pthread_once_t topology_once = PTHREAD_ONCE_INIT;
+
+static void read_topology(void) {
+    static int cpus[MAX_CPUS];
+    char path[300], line[4096];
+    struct dirent *entry;
+    DIR *dir;
+    int node, n, i;
+
+    /* Without NUMA support every CPU is on node 0 */
+    memset(cpu_node, 0, sizeof(cpu_node));
+
+    dir = opendir(NODE_DIR);
+    if (!dir) {
+        return;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        if (sscanf(entry->d_name, "node%d", &node) != 1 || node < 0 || node > INT16_MAX) {
+            continue;
+        }
+        snprintf(path, sizeof(path), NODE_DIR "/%s/cpulist", entry->d_name);
+        if (!perfmon_read_line(path, line, sizeof(line))) {
+            continue;
+        }
+        n = perfmon_parse_cpu_list(line, cpus, MAX_CPUS);
+        for (i = 0; i < n; i++) {
+            if (cpus[i] >= 0 && cpus[i] < MAX_CPUS) {
+                cpu_node[cpus[i]] = (int16_t)node;
+            }
+        }
+        if (node + 1 > nr_nodes) {
+            nr_nodes = node + 1;
+        }
+    }
+    closedir(dir);
+}
+
+/* Number of NUMA nodes */
+int perfmon_numa_nodes(void) {
+    pthread_once(&topology_once, read_topology);
+    return nr_nodes;
+}
+
+/* NUMA node of a CPU */
+int perfmon_numa_node_of_cpu(int cpu) {
+    pthread_once(&topology_once, read_topology);
+    return cpu >= 0 && cpu < MAX_CPUS ? cpu_node[cpu] : -1;
+}
+
+/* CPU and node of the calling thread; -1 for both if unknown */
+void perfmon_numa_place(int *cpu, int *node) {
+    *cpu = sched_getcpu();
+    *node = perfmon_numa_node_of_cpu(*cpu);
+    if (*node == -1) {
+        *cpu = -1;
+    }
+}
@@ -0,0 +1,160 @@
+/*
+ * libperfmon - OS Resource Counters
+ *
+ * Storage I/O and run-queue delay come from /proc/thread-self/io and
+ * /proc/thread-self/schedstat, context switches and the RSS high-water mark
+ * from getrusage(RUSAGE_THREAD).  The proc files are opened once per
+ * context and re-read with pread(), which regenerates their contents, so a
+ * sample costs three syscalls and no open/close.  Both sources describe one
+ * thread only, the one that opened the files, so samples taken on any other
+ * thread are refused rather than mixed into the region.
+ */
+
+#define _GNU_SOURCE
+#include "perfmon_internal.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+/* Fields of the io file that are sampled */
+static const struct {
+    const char *key;
+    int index;
+} io_fields[] = {
+    {"syscr", PERFMON_OS_SYSCR},
+    {"syscw", PERFMON_OS_SYSCW},
+    {"read_bytes", PERFMON_OS_READ_BYTES},
+    {"write_bytes", PERFMON_OS_WRITE_BYTES},
+};
+
+#define NR_IO_FIELDS (sizeof(io_fields) / sizeof(io_fields[0]))
+
+/* Open a per-thread proc file, falling back to the task directory before Linux 3.17 */
+static int open_thread_file(const char *name) {
+    char path[64];
+    int fd;
+
+    snprintf(path, sizeof(path), "/proc/thread-self/%s", name);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        snprintf(path, sizeof(path), "/proc/self/task/%ld/%s", (long)syscall(SYS_gettid), name);
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+    }
+    return fd;
+}
+
+/* Open the calling thread's proc files; missing ones read as 0 */
+void perfmon_os_open(perfmon_os_files_t *files) {
+    files->io_fd = open_thread_file("io");
+    files->schedstat_fd = open_thread_file("schedstat");
+    files->owner = pthread_self();
+}
+
+void perfmon_os_close(perfmon_os_files_t *files) {
+    if (files->io_fd != -1) {
+        close(files->io_fd);
+    }
+    if (files->schedstat_fd != -1) {
+        close(files->schedstat_fd);
+    }
+    files->io_fd = files->schedstat_fd = -1;
+}
+
+/* Whole file from offset 0 into buf, NUL-terminated; false on failure */
+static bool pread_all(int fd, char *buf, size_t size) {
+    ssize_t n;
+
+    if (fd == -1) {
+        return false;
+    }
+    n = pread(fd, buf, size - 1, 0);
+    if (n <= 0) {
+        return false;
+    }
+    buf[n] = '\0';
+    return true;
+}
+
+static void parse_io(const char *buf, uint64_t values[PERFMON_OS_NR]) {
+    const char *line = buf;
+    size_t i, len;
+
+    while (*line) {
+        for (i = 0; i < NR_IO_FIELDS; i++) {
+            len = strlen(io_fields[i].key);
+            if (strncmp(line, io_fields[i].key, len) == 0 && line[len] == ':') {
+                values[io_fields[i].index] = strtoull(line + len + 1, NULL, 10);
+                break;
+            }
+        }
+        line = strchr(line, '\n');
+        if (!line) {
+            break;
+        }
+        line++;
+    }
+}
+
+/* Current values of the owning thread; false when called on another one */
+bool perfmon_os_sample(const perfmon_os_files_t *files, uint64_t values[PERFMON_OS_NR]) {
+    char buf[512];
+    struct rusage ru;
+    char *end;
+
+    memset(values, 0, PERFMON_OS_NR * sizeof(uint64_t));
+
+    if (!pthread_equal(pthread_self(), files->owner)) {
+        /* The RSS peak is process-wide and valid from any thread */
+        if (getrusage(RUSAGE_SELF, &ru) == 0) {
+            values[PERFMON_OS_MAX_RSS] = (uint64_t)ru.ru_maxrss;
+        }
+        return false;
+    }
+
+    if (pread_all(files->io_fd, buf, sizeof(buf))) {
+        parse_io(buf, values);
+    }
+
+    /* "<on-cpu ns> <run-queue wait ns> <timeslices>" */
+    if (pread_all(files->schedstat_fd, buf, sizeof(buf))) {
+        strtoull(buf, &end, 10);
+        values[PERFMON_OS_RUN_DELAY] = strtoull(end, NULL, 10);
+    }
+
+    if (getrusage(RUSAGE_THREAD, &ru) == 0) {
+        values[PERFMON_OS_NVCSW] = (uint64_t)ru.ru_nvcsw;
+        values[PERFMON_OS_NIVCSW] = (uint64_t)ru.ru_nivcsw;
+        values[PERFMON_OS_MAX_RSS] = (uint64_t)ru.ru_maxrss;
+    }
+    return true;
+}
+
+/*
+ * Store deltas since start in stats; the RSS high-water mark is absolute.
+ * Samples from two different threads have no meaningful delta.
+ */
+void perfmon_os_fill(perfmon_stats_t *stats, const uint64_t start[PERFMON_OS_NR],
+                     const uint64_t now[PERFMON_OS_NR], bool same_thread) {
+    uint64_t delta[PERFMON_OS_NR];
+    int i;
+
+    for (i = 0; i < PERFMON_OS_NR; i++) {
+        delta[i] = same_thread && now[i] > start[i] ? now[i] - start[i] : 0;
+    }
+
+    stats->io_read_bytes = delta[PERFMON_OS_READ_BYTES];
+    stats->io_write_bytes = delta[PERFMON_OS_WRITE_BYTES];
+    stats->io_syscr = delta[PERFMON_OS_SYSCR];
+    stats->io_syscw = delta[PERFMON_OS_SYSCW];
+    stats->run_delay_ns = delta[PERFMON_OS_RUN_DELAY];
+    stats->voluntary_switches = delta[PERFMON_OS_NVCSW];
+    stats->involuntary_switches = delta[PERFMON_OS_NIVCSW];
+    stats->process_max_rss_kb = now[PERFMON_OS_MAX_RSS];
+    stats->os_other_thread = !same_thread;
+}
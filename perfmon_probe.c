@@ -0,0 +1,351 @@
+/*
+ * libperfmon - Capability Probing
+ */
+
+#define _GNU_SOURCE
+#include "perfmon.h"
+#include "perfmon_internal.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/perf_event.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+/* Busy time for the multiplexing trial */
+#define MUX_TRIAL_NS 5000000ULL
+
+#define PMU_DEVICES "/sys/bus/event_source/devices"
+
+static perfmon_caps_t cached_caps;
+static pthread_once_t probe_once = PTHREAD_ONCE_INIT;
+
+static perfmon_core_pmu_t core_pmus[PERFMON_MAX_CORE_PMUS];
+static int nr_core_pmus;
+static pthread_once_t core_pmus_once = PTHREAD_ONCE_INIT;
+
+static const char *counter_names[PERFMON_MAX_COUNTERS] = {
+    "cycles", "instructions", "branches", "branch-misses", "cache-references",
+    "cache-misses", "dTLB-load-misses", "iTLB-misses", "page-faults",
+    "minor-faults", "major-faults", "cs", "migrations", "ref-cycles", "task-clock",
+    "node-loads", "node-load-misses"
+};
+
+static const char *mode_names[] = {"rdpmc", "grouped", "per-fd", "rusage"};
+
+/* Read a single integer from a file; false if missing */
+static bool read_int_file(const char *path, int *value) {
+    FILE *f = fopen(path, "r");
+    bool ok;
+
+    if (!f) {
+        return false;
+    }
+    ok = fscanf(f, "%d", value) == 1;
+    fclose(f);
+    return ok;
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Open every counter once, remembering why the missing ones failed */
+static void probe_events(perfmon_caps_t *caps) {
+    int i, fd;
+
+    for (i = 0; i < PERFMON_MAX_COUNTERS; i++) {
+        errno = 0;
+        fd = perfmon_open_counter((perfmon_counter_type_t)i, -1, 0);
+        if (fd == -1) {
+            caps->open_errno[i] = errno ? errno : ENOENT;
+            continue;
+        }
+        caps->available |= 1u << i;
+        if (PERFMON_HW_COUNTERS & (1u << i)) {
+            caps->hw_events++;
+        }
+        close(fd);
+    }
+}
+
+/* cap_user_rdpmc / cap_user_time from the mmap page of one event */
+static void probe_user_page(perfmon_caps_t *caps) {
+    long page_size = sysconf(_SC_PAGESIZE);
+    struct perf_event_mmap_page *page;
+    int i, fd = -1;
+
+    /* rdpmc is only meaningful on a hardware event; any event has the time fields */
+    for (i = 0; i < PERFMON_MAX_COUNTERS && fd == -1; i++) {
+        if (caps->available & PERFMON_HW_COUNTERS & (1u << i)) {
+            fd = perfmon_open_counter((perfmon_counter_type_t)i, -1, 0);
+        }
+    }
+    for (i = 0; i < PERFMON_MAX_COUNTERS && fd == -1; i++) {
+        if (caps->available & (1u << i)) {
+            fd = perfmon_open_counter((perfmon_counter_type_t)i, -1, 0);
+        }
+    }
+    if (fd == -1) {
+        return;
+    }
+
+    page = (struct perf_event_mmap_page *)mmap(NULL, (size_t)page_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (page != MAP_FAILED) {
+        caps->rdpmc = page->cap_user_rdpmc && (caps->available & PERFMON_HW_COUNTERS);
+        caps->user_time = page->cap_user_time;
+        munmap(page, (size_t)page_size);
+    }
+    close(fd);
+}
+
+/* Generic and fixed counters per logical CPU from CPUID */
+static void probe_pmu_counters(perfmon_caps_t *caps) {
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx, max_leaf, max_ext;
+    bool amd;
+
+    if (!__get_cpuid(0, &max_leaf, &ebx, &ecx, &edx)) {
+        return;
+    }
+    amd = ebx == 0x68747541;    /* "Auth"enticAMD */
+
+    /* Intel architectural performance monitoring leaf */
+    if (!amd && max_leaf >= 0xA) {
+        __cpuid(0xA, eax, ebx, ecx, edx);
+        if ((eax & 0xff) > 0) {
+            caps->gp_counters = (int)((eax >> 8) & 0xff);
+            caps->fixed_counters = (eax & 0xff) > 1 ? (int)(edx & 0x1f) : 0;
+        }
+        return;
+    }
+
+    if (amd) {
+        max_ext = __get_cpuid_max(0x80000000, NULL);
+        if (max_ext >= 0x80000022) {
+            /* PerfMonV2: NumPerfCtrCore */
+            __cpuid_count(0x80000022, 0, eax, ebx, ecx, edx);
+            caps->gp_counters = (int)(ebx & 0xf);
+        }
+        if (caps->gp_counters == 0 && max_ext >= 0x80000001) {
+            /* PerfCtrExtCore adds two counters to the legacy four */
+            __cpuid(0x80000001, eax, ebx, ecx, edx);
+            caps->gp_counters = (ecx & (1u << 23)) ? 6 : 4;
+        }
+    }
+#else
+    (void)caps;
+#endif
+}
+
+static int compare_pmu_name(const void *a, const void *b) {
+    return strcmp(((const perfmon_core_pmu_t *)a)->name, ((const perfmon_core_pmu_t *)b)->name);
+}
+
+/* Core PMUs list their CPUs in a "cpus" file; more than one means hybrid */
+static void discover_core_pmus(void) {
+    DIR *dir = opendir(PMU_DEVICES);
+    struct dirent *entry;
+    char path[512];
+    int type;
+
+    if (!dir) {
+        return;
+    }
+    while ((entry = readdir(dir)) != NULL && nr_core_pmus < PERFMON_MAX_CORE_PMUS) {
+        if (entry->d_name[0] == '.' || strlen(entry->d_name) >= PERFMON_PMU_NAME_LEN) {
+            continue;
+        }
+        snprintf(path, sizeof(path), PMU_DEVICES "/%s/cpus", entry->d_name);
+        if (access(path, R_OK) != 0) {
+            continue;
+        }
+        snprintf(path, sizeof(path), PMU_DEVICES "/%s/type", entry->d_name);
+        if (!read_int_file(path, &type)) {
+            continue;
+        }
+        strcpy(core_pmus[nr_core_pmus].name, entry->d_name);
+        core_pmus[nr_core_pmus].type = (uint32_t)type;
+        nr_core_pmus++;
+    }
+    closedir(dir);
+
+    /* readdir() order is arbitrary; keep reports stable */
+    qsort(core_pmus, (size_t)nr_core_pmus, sizeof(perfmon_core_pmu_t), compare_pmu_name);
+}
+
+/* Core PMUs, discovered once per process */
+int perfmon_core_pmus(const perfmon_core_pmu_t **pmus) {
+    pthread_once(&core_pmus_once, discover_core_pmus);
+    if (pmus) {
+        *pmus = core_pmus;
+    }
+    return nr_core_pmus;
+}
+
+static void probe_core_pmus(perfmon_caps_t *caps) {
+    const perfmon_core_pmu_t *pmus;
+    int i;
+
+    caps->nr_core_pmus = perfmon_core_pmus(&pmus);
+    for (i = 0; i < caps->nr_core_pmus; i++) {
+        strcpy(caps->core_pmus[i], pmus[i].name);
+    }
+}
+
+/*
+ * Enable all hardware events a context would open, spin briefly and compare
+ * time running with time enabled: less means the PMU time-shared them
+ */
+static void probe_multiplexing(perfmon_caps_t *caps) {
+    uint64_t values[3];
+    int fds[PERFMON_MAX_COUNTERS];
+    uint64_t start;
+    volatile uint64_t spin = 0;
+    int i;
+
+    if (caps->hw_events == 0) {
+        return;
+    }
+
+    for (i = 0; i < PERFMON_MAX_COUNTERS; i++) {
+        fds[i] = -1;
+        if (caps->available & PERFMON_HW_COUNTERS & (1u << i)) {
+            fds[i] = perfmon_open_counter((perfmon_counter_type_t)i, -1,
+                                          PERF_FORMAT_TOTAL_TIME_ENABLED |
+                                          PERF_FORMAT_TOTAL_TIME_RUNNING);
+            if (fds[i] != -1) {
+                ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+    }
+
+    start = monotonic_ns();
+    while (monotonic_ns() - start < MUX_TRIAL_NS) {
+        spin++;
+    }
+
+    for (i = 0; i < PERFMON_MAX_COUNTERS; i++) {
+        if (fds[i] == -1) {
+            continue;
+        }
+        ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fds[i], values, sizeof(values)) == sizeof(values) && values[2] < values[1]) {
+            caps->multiplexed = true;
+        }
+        close(fds[i]);
+    }
+}
+
+static void probe_once_fn(void) {
+    perfmon_caps_t *caps = &cached_caps;
+    int value;
+
+    memset(caps, 0, sizeof(perfmon_caps_t));
+    caps->paranoid = read_int_file("/proc/sys/kernel/perf_event_paranoid", &value) ? value : -100;
+    caps->nmi_watchdog = read_int_file("/proc/sys/kernel/nmi_watchdog", &value) && value != 0;
+
+    probe_events(caps);
+    probe_user_page(caps);
+    probe_pmu_counters(caps);
+    probe_core_pmus(caps);
+    probe_multiplexing(caps);
+
+    if (caps->available == 0) {
+        caps->cheapest_mode = PERFMON_MODE_RUSAGE;
+    } else if (caps->multiplexed) {
+        /* A group larger than the PMU is never scheduled as a whole */
+        caps->cheapest_mode = PERFMON_MODE_PER_FD;
+    } else if (caps->rdpmc) {
+        caps->cheapest_mode = PERFMON_MODE_RDPMC;
+    } else {
+        caps->cheapest_mode = PERFMON_MODE_GROUPED;
+    }
+}
+
+/* Probe capabilities (cached per process) */
+bool perfmon_probe(perfmon_caps_t *caps) {
+    if (!caps) {
+        perfmon_set_error("Invalid caps");
+        return false;
+    }
+
+    pthread_once(&probe_once, probe_once_fn);
+    memcpy(caps, &cached_caps, sizeof(perfmon_caps_t));
+    return true;
+}
+
+/* Why a counter is missing, in words */
+static const char *missing_reason(const perfmon_caps_t *caps, int counter) {
+    switch (caps->open_errno[counter]) {
+    case EACCES:
+    case EPERM:
+        return caps->paranoid >= 2 ? "not permitted (perf_event_paranoid >= 2, needs CAP_PERFMON)"
+                                   : "not permitted (needs CAP_PERFMON)";
+    case ENOENT:
+    case EOPNOTSUPP:
+        return "event not supported by this PMU";
+    case ENODEV:
+        return "no PMU (virtual machine without PMU passthrough?)";
+    case EMFILE:
+    case ENFILE:
+        return "out of file descriptors";
+    default:
+        return strerror(caps->open_errno[counter]);
+    }
+}
+
+/* Print a capability report */
+void perfmon_print_caps(const perfmon_caps_t *caps, int fd) {
+    int i;
+
+    if (!caps) {
+        return;
+    }
+
+    dprintf(fd, "\nPerformance Monitoring Capabilities:\n");
+    dprintf(fd, "====================================\n");
+    if (caps->paranoid == -100) {
+        dprintf(fd, "%-24s unreadable\n", "perf_event_paranoid");
+    } else {
+        dprintf(fd, "%-24s %d\n", "perf_event_paranoid", caps->paranoid);
+    }
+    dprintf(fd, "%-24s %s\n", "rdpmc", caps->rdpmc ? "yes" : "no");
+    dprintf(fd, "%-24s %s\n", "user-space time", caps->user_time ? "yes" : "no");
+    if (caps->gp_counters > 0) {
+        dprintf(fd, "%-24s %d generic, %d fixed%s\n", "PMU counters", caps->gp_counters,
+                caps->fixed_counters, caps->nmi_watchdog ? " (NMI watchdog holds one)" : "");
+    } else {
+        dprintf(fd, "%-24s unknown\n", "PMU counters");
+    }
+    dprintf(fd, "%-24s", "core PMUs");
+    for (i = 0; i < caps->nr_core_pmus; i++) {
+        dprintf(fd, " %s", caps->core_pmus[i]);
+    }
+    dprintf(fd, "%s\n", caps->nr_core_pmus > 1 ? " (hybrid)" : caps->nr_core_pmus == 0 ? " none" : "");
+    dprintf(fd, "%-24s %d%s\n", "hardware events", caps->hw_events,
+            caps->multiplexed ? " (multiplexed: counts are scaled estimates)" : "");
+    dprintf(fd, "%-24s %s\n", "cheapest mode", mode_names[caps->cheapest_mode]);
+
+    dprintf(fd, "\nCounters:\n");
+    for (i = 0; i < PERFMON_MAX_COUNTERS; i++) {
+        if (caps->available & (1u << i)) {
+            dprintf(fd, "  %-20s available\n", counter_names[i]);
+        } else {
+            dprintf(fd, "  %-20s missing: %s\n", counter_names[i], missing_reason(caps, i));
+        }
+    }
+}
@@ -0,0 +1,344 @@
+/*
+ * libperfmon - Pressure Stall Information Sampler Implementation
+ */
+
+#define _GNU_SOURCE
+#include "perfmon_psi.h"
+#include "perfmon_internal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_INTERVAL_MS 100
+
+/* 256 samples: 25 s of history at the default interval */
+#define RING_SIZE 256
+
+enum { PSI_CPU = 0, PSI_MEMORY, PSI_IO, PSI_NR_FILES };
+
+static const char *psi_files[PSI_NR_FILES] = {"cpu", "memory", "io"};
+
+/*
+ * Ring slot.  seq is the number of the sample it holds (1-based), 0 while
+ * the sampler rewrites it; a reader that sees the same seq before and after
+ * copying has a consistent sample.
+ */
+typedef struct {
+    uint64_t seq;
+    perfmon_psi_sample_t sample;
+} psi_slot_t;
+
+static struct {
+    pthread_mutex_t lock;       /* start/stop */
+    pthread_t thread;
+    bool running;
+    bool stop;
+    int interval_ms;
+    int fds[PSI_NR_FILES];
+    uint64_t head;              /* samples written */
+    psi_slot_t ring[RING_SIZE];
+} sampler = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Fill options with the defaults */
+void perfmon_psi_options_init(perfmon_psi_options_t *opts) {
+    if (!opts) {
+        return;
+    }
+
+    memset(opts, 0, sizeof(perfmon_psi_options_t));
+    opts->interval_ms = DEFAULT_INTERVAL_MS;
+}
+
+/* Directory of the process's cgroup v2 (unified or hybrid hierarchy) */
+static bool cgroup_dir(char *dir, size_t size) {
+    static const char *roots[] = {"/sys/fs/cgroup", "/sys/fs/cgroup/unified"};
+    char line[512], path[600];
+    FILE *f = fopen("/proc/self/cgroup", "r");
+    bool found = false;
+    size_t i;
+
+    if (!f) {
+        return false;
+    }
+    while (!found && fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "0::", 3) == 0) {
+            line[strcspn(line, "\n")] = '\0';
+            for (i = 0; i < sizeof(roots) / sizeof(roots[0]) && !found; i++) {
+                snprintf(path, sizeof(path), "%s%s/cpu.pressure", roots[i], line + 3);
+                if (access(path, R_OK) == 0) {
+                    snprintf(dir, size, "%s%s", roots[i], line + 3);
+                    found = true;
+                }
+            }
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+static bool open_files(bool cgroup) {
+    char dir[600], path[700];
+    int i;
+
+    if (cgroup && !cgroup_dir(dir, sizeof(dir))) {
+        perfmon_set_error("No cgroup v2 pressure files for this process");
+        return false;
+    }
+
+    for (i = 0; i < PSI_NR_FILES; i++) {
+        if (cgroup) {
+            snprintf(path, sizeof(path), "%s/%s.pressure", dir, psi_files[i]);
+        } else {
+            snprintf(path, sizeof(path), "/proc/pressure/%s", psi_files[i]);
+        }
+        sampler.fds[i] = open(path, O_RDONLY | O_CLOEXEC);
+        if (sampler.fds[i] == -1) {
+            perfmon_set_error("Failed to open %s: %s", path, strerror(errno));
+            while (i-- > 0) {
+                close(sampler.fds[i]);
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+/* "some avg10=0.00 avg60=0.00 avg300=0.00 total=N" and the "full" line */
+static void parse_totals(int fd, uint64_t *some_us, uint64_t *full_us) {
+    char buf[256];
+    const char *p;
+    ssize_t n;
+
+    *some_us = *full_us = 0;
+    n = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0) {
+        return;
+    }
+    buf[n] = '\0';
+
+    p = strstr(buf, "some ");
+    if (p && (p = strstr(p, "total=")) != NULL) {
+        *some_us = strtoull(p + 6, NULL, 10);
+    }
+    p = strstr(buf, "full ");
+    if (p && (p = strstr(p, "total=")) != NULL) {
+        *full_us = strtoull(p + 6, NULL, 10);
+    }
+}
+
+static void take_sample(void) {
+    perfmon_psi_sample_t s;
+    psi_slot_t *slot;
+    uint64_t unused, seq;
+
+    s.time_ns = monotonic_ns();
+    parse_totals(sampler.fds[PSI_CPU], &s.cpu_some_us, &unused);
+    parse_totals(sampler.fds[PSI_MEMORY], &s.memory_some_us, &s.memory_full_us);
+    parse_totals(sampler.fds[PSI_IO], &s.io_some_us, &s.io_full_us);
+
+    seq = sampler.head + 1;
+    slot = &sampler.ring[(seq - 1) % RING_SIZE];
+    __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->sample = s;
+    __atomic_store_n(&slot->seq, seq, __ATOMIC_RELEASE);
+    __atomic_store_n(&sampler.head, seq, __ATOMIC_RELEASE);
+}
+
+static void *sampler_main(void *arg) {
+    struct timespec next;
+
+    (void)arg;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (!__atomic_load_n(&sampler.stop, __ATOMIC_ACQUIRE)) {
+        take_sample();
+        next.tv_nsec += (long)sampler.interval_ms * 1000000L;
+        while (next.tv_nsec >= 1000000000L) {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    return NULL;
+}
+
+/* Start the sampler thread */
+bool perfmon_psi_start(const perfmon_psi_options_t *opts) {
+    perfmon_psi_options_t defaults;
+    sigset_t all, old;
+    int i, err;
+
+    if (!opts) {
+        perfmon_psi_options_init(&defaults);
+        opts = &defaults;
+    }
+    if (opts->interval_ms <= 0) {
+        perfmon_set_error("Invalid PSI interval: %d ms", opts->interval_ms);
+        return false;
+    }
+
+    pthread_mutex_lock(&sampler.lock);
+    if (sampler.running) {
+        pthread_mutex_unlock(&sampler.lock);
+        perfmon_set_error("PSI sampler already running");
+        return false;
+    }
+    if (!open_files(opts->cgroup)) {
+        pthread_mutex_unlock(&sampler.lock);
+        return false;
+    }
+
+    sampler.interval_ms = opts->interval_ms;
+    sampler.stop = false;
+    __atomic_store_n(&sampler.head, 0, __ATOMIC_RELEASE);
+    take_sample();      /* regions starting now have a baseline */
+
+    /*
+     * The sampler inherits the caller's signal mask: block everything so
+     * process-directed signals (PostgreSQL's SIGINT, SIGTERM, SIGUSR1,
+     * SIGALRM) keep running their handlers on the application's threads
+     */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    err = pthread_create(&sampler.thread, NULL, sampler_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err != 0) {
+        for (i = 0; i < PSI_NR_FILES; i++) {
+            close(sampler.fds[i]);
+        }
+        pthread_mutex_unlock(&sampler.lock);
+        perfmon_set_error("Failed to start PSI sampler: %s", strerror(err));
+        return false;
+    }
+    __atomic_store_n(&sampler.running, true, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&sampler.lock);
+    return true;
+}
+
+/* Stop the sampler thread */
+void perfmon_psi_stop(void) {
+    int i;
+
+    pthread_mutex_lock(&sampler.lock);
+    if (sampler.running) {
+        __atomic_store_n(&sampler.running, false, __ATOMIC_RELEASE);
+        __atomic_store_n(&sampler.stop, true, __ATOMIC_RELEASE);
+        pthread_join(sampler.thread, NULL);
+        for (i = 0; i < PSI_NR_FILES; i++) {
+            close(sampler.fds[i]);
+        }
+    }
+    pthread_mutex_unlock(&sampler.lock);
+}
+
+/* Copy sample number seq; false if it was overwritten */
+static bool read_sample(uint64_t seq, perfmon_psi_sample_t *out) {
+    const psi_slot_t *slot = &sampler.ring[(seq - 1) % RING_SIZE];
+
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != seq) {
+        return false;
+    }
+    *out = slot->sample;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq;
+}
+
+/* Start the sampler from PERFMON_PSI ("<interval_ms>[,cgroup]"), once per process */
+static void load_env_once(void) {
+    perfmon_psi_options_t opts;
+    const char *env = getenv("PERFMON_PSI");
+
+    if (!env || !*env) {
+        return;
+    }
+    perfmon_psi_options_init(&opts);
+    if (atoi(env) > 0) {
+        opts.interval_ms = atoi(env);
+    }
+    opts.cgroup = strstr(env, "cgroup") != NULL;
+    if (!perfmon_psi_start(&opts)) {
+        fprintf(stderr, "libperfmon: PERFMON_PSI: %s\n", perfmon_get_error());
+    }
+}
+
+void perfmon_psi_load_env(void) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+    pthread_once(&once, load_env_once);
+}
+
+/* Most recent sample */
+bool perfmon_psi_latest(perfmon_psi_sample_t *sample) {
+    uint64_t head;
+
+    if (!sample || !__atomic_load_n(&sampler.running, __ATOMIC_ACQUIRE)) {
+        perfmon_set_error("PSI sampler not running");
+        return false;
+    }
+    head = __atomic_load_n(&sampler.head, __ATOMIC_ACQUIRE);
+    return head > 0 && read_sample(head, sample);
+}
+
+/* Sample number to measure a starting region from (0: sampler not running) */
+uint64_t perfmon_psi_mark(void) {
+    if (!__atomic_load_n(&sampler.running, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    return __atomic_load_n(&sampler.head, __ATOMIC_ACQUIRE);
+}
+
+static double stall_percent(uint64_t from_us, uint64_t to_us, uint64_t window_ns) {
+    return to_us > from_us ? (double)(to_us - from_us) * 1e3 / (double)window_ns * 100.0 : 0.0;
+}
+
+/* Fill the psi_* fields for a region that started at sample mark */
+void perfmon_psi_fill(perfmon_stats_t *stats, uint64_t mark) {
+    perfmon_psi_sample_t s0, s1;
+    uint64_t head, window_ns;
+
+    if (mark == 0 || !__atomic_load_n(&sampler.running, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    head = __atomic_load_n(&sampler.head, __ATOMIC_ACQUIRE);
+    if (mark >= head) {
+        /* No sample inside the region: use the most recent interval */
+        mark = head - 1;
+    }
+    if (head > RING_SIZE && mark <= head - RING_SIZE) {
+        /* The start sample was overwritten: measure over the history still held */
+        mark = head - RING_SIZE + 1;
+    }
+    if (mark == 0 || !read_sample(head, &s1)) {
+        return;
+    }
+    /* The oldest slot may be rewritten under us: move on to the next one */
+    while (!read_sample(mark, &s0)) {
+        if (++mark >= head) {
+            return;
+        }
+    }
+    if (s1.time_ns <= s0.time_ns) {
+        return;
+    }
+
+    window_ns = s1.time_ns - s0.time_ns;
+    stats->psi_cpu_some = stall_percent(s0.cpu_some_us, s1.cpu_some_us, window_ns);
+    stats->psi_memory_some = stall_percent(s0.memory_some_us, s1.memory_some_us, window_ns);
+    stats->psi_memory_full = stall_percent(s0.memory_full_us, s1.memory_full_us, window_ns);
+    stats->psi_io_some = stall_percent(s0.io_some_us, s1.io_some_us, window_ns);
+    stats->psi_io_full = stall_percent(s0.io_full_us, s1.io_full_us, window_ns);
+}
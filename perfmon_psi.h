@@ -0,0 +1,84 @@
+/*
+ * libperfmon - Pressure Stall Information Sampler
+ *
+ * A background thread reads /proc/pressure/{cpu,memory,io} (or the pressure
+ * files of the process's own cgroup) at a fixed interval into a ring buffer.
+ * While it runs, perfmon_stop() and perfmon_read() fill the psi_* fields of
+ * perfmon_stats_t with the share of time tasks were stalled during the
+ * region, so a collapsed IPC can be told apart from a box under memory or
+ * I/O pressure:
+ *
+ *   perfmon_psi_options_t opts;
+ *   perfmon_psi_options_init(&opts);
+ *   opts.interval_ms = 50;
+ *   perfmon_psi_start(&opts);               // once per process
+ *   ...
+ *   perfmon_stop(ctx, &stats);              // stats.psi_memory_some, ...
+ *   ...
+ *   perfmon_psi_stop();
+ *
+ * Without code changes, PERFMON_PSI="<interval_ms>[,cgroup]" starts the
+ * sampler at the first perfmon_init().
+ *
+ * Pressure is the increase of the kernel's cumulative stall time between the
+ * last sample before perfmon_start() and the last sample before
+ * perfmon_stop(), so it is exact over that window and the window is aligned
+ * to the sampling interval.  A region shorter than one interval gets the
+ * pressure of the most recent interval; one longer than the ring's history
+ * (256 samples, 25 s at the default interval) gets the pressure of that
+ * history, i.e. of its last part.
+ */
+
+#ifndef PERFMON_PSI_H
+#define PERFMON_PSI_H
+
+#include "perfmon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Sampler options */
+typedef struct {
+    int interval_ms;        /* sampling interval (default 100) */
+    bool cgroup;            /* the process's cgroup v2 pressure files instead of system-wide */
+} perfmon_psi_options_t;
+
+/* One reading: cumulative stall time in microseconds */
+typedef struct {
+    uint64_t time_ns;       /* CLOCK_MONOTONIC */
+    uint64_t cpu_some_us;
+    uint64_t memory_some_us;
+    uint64_t memory_full_us;
+    uint64_t io_some_us;
+    uint64_t io_full_us;
+} perfmon_psi_sample_t;
+
+/*
+ * Fill options with the defaults
+ */
+void perfmon_psi_options_init(perfmon_psi_options_t *opts);
+
+/*
+ * Start the process-wide sampler thread (opts may be NULL for the defaults)
+ * Returns: true on success, false if PSI is unavailable (kernel without
+ * CONFIG_PSI, psi=0 on the command line) or the sampler already runs
+ */
+bool perfmon_psi_start(const perfmon_psi_options_t *opts);
+
+/*
+ * Stop the sampler thread; later regions get no pressure
+ */
+void perfmon_psi_stop(void);
+
+/*
+ * Most recent sample
+ * Returns: true on success, false if the sampler is not running
+ */
+bool perfmon_psi_latest(perfmon_psi_sample_t *sample);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PERFMON_PSI_H */
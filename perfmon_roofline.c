@@ -0,0 +1,560 @@
+/*
+ * libperfmon - Roofline Estimation Implementation
+ */
+
+#define _GNU_SOURCE
+#include "perfmon_roofline.h"
+#include "perfmon_internal.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+/* STREAM triad: three arrays well beyond the last-level cache */
+#define TRIAD_ELEMENTS  (4 * 1024 * 1024)
+#define TRIAD_REPS      5
+
+/* Peak FLOP kernel: independent multiply-add chains */
+#define FLOP_CHAINS     16
+#define FLOP_ITERS      10000000L
+
+/* Intel FP_ARITH_INST_RETIRED (event 0xC7), umasks grouped by FLOPs per op */
+#define FP_ARITH_EVENT  0xC7
+#define NR_FP_EVENTS    5
+
+/* General-purpose counters assumed when CPUID does not say (4 with SMT on) */
+#define DEFAULT_GP_COUNTERS 4
+
+/* Group read: nr, time_enabled, time_running, then one value per event */
+#define FP_READ_FORMAT  (PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | \
+                         PERF_FORMAT_TOTAL_TIME_RUNNING)
+
+static const struct {
+    uint8_t umask;
+    uint8_t weight;
+} fp_events[NR_FP_EVENTS] = {
+    {0x03, 1},      /* scalar double + scalar single */
+    {0x04, 2},      /* 128-bit packed double */
+    {0x18, 4},      /* 128-bit packed single + 256-bit packed double */
+    {0x60, 8},      /* 256-bit packed single + 512-bit packed double */
+    {0x80, 16},     /* 512-bit packed single */
+};
+
+/* Uncore IMC CAS counters (two per channel) */
+#define MAX_IMC_EVENTS  32
+#define IMC_CAS_BYTES   64
+#define PMU_DIR         "/sys/bus/event_source/devices"
+
+struct perfmon_roofline_events {
+    int fp_fds[NR_FP_EVENTS];       /* groups of fp_group_size, each led by its first fd; -1 if absent */
+    int fp_group_size;
+    int imc_fds[MAX_IMC_EVENTS];
+    int nr_imc;
+};
+
+/* Elapsed seconds between two timestamps */
+static double seconds_between(const struct timespec *start, const struct timespec *end) {
+    return (double)(end->tv_sec - start->tv_sec) + (double)(end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Best-of-N STREAM triad bandwidth in GB/s */
+static double measure_triad_gbs(void) {
+    double *a, *b, *c;
+    double best = 0.0, t;
+    struct timespec start, end;
+    size_t i;
+    int rep;
+
+    a = (double *)malloc(TRIAD_ELEMENTS * sizeof(double));
+    b = (double *)malloc(TRIAD_ELEMENTS * sizeof(double));
+    c = (double *)malloc(TRIAD_ELEMENTS * sizeof(double));
+    if (!a || !b || !c) {
+        free(a);
+        free(b);
+        free(c);
+        return 0.0;
+    }
+
+    for (i = 0; i < TRIAD_ELEMENTS; i++) {
+        a[i] = 0.0;
+        b[i] = 1.0;
+        c[i] = 2.0;
+    }
+
+    for (rep = 0; rep < TRIAD_REPS; rep++) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < TRIAD_ELEMENTS; i++) {
+            a[i] = b[i] + 3.0 * c[i];
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        t = seconds_between(&start, &end);
+        if (best == 0.0 || t < best) {
+            best = t;
+        }
+    }
+
+    /* Keep the stores observable */
+    __asm__ __volatile__("" : : "r"(a) : "memory");
+
+    free(a);
+    free(b);
+    free(c);
+    return best > 0.0 ? 3.0 * sizeof(double) * TRIAD_ELEMENTS / best / 1e9 : 0.0;
+}
+
+/* Double-precision multiply-add rate in GFLOP/s */
+static double measure_peak_gflops(void) {
+    volatile double mul_in = 0.999999, add_in = 1e-6;
+    volatile double sink;
+    double acc[FLOP_CHAINS];
+    double mul = mul_in, add = add_in, sum = 0.0, t;
+    struct timespec start, end;
+    long it;
+    int k;
+
+    for (k = 0; k < FLOP_CHAINS; k++) {
+        acc[k] = (double)k;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (it = 0; it < FLOP_ITERS; it++) {
+        for (k = 0; k < FLOP_CHAINS; k++) {
+            acc[k] = acc[k] * mul + add;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    for (k = 0; k < FLOP_CHAINS; k++) {
+        sum += acc[k];
+    }
+    sink = sum;
+    (void)sink;
+
+    t = seconds_between(&start, &end);
+    return t > 0.0 ? 2.0 * FLOP_CHAINS * FLOP_ITERS / t / 1e9 : 0.0;
+}
+
+/* Measure the machine roofline */
+bool perfmon_roofline_calibrate(perfmon_roofline_t *roof) {
+    if (!roof) {
+        perfmon_set_error("Invalid roofline");
+        return false;
+    }
+
+    roof->peak_gbs = measure_triad_gbs();
+    roof->peak_gflops = measure_peak_gflops();
+    if (roof->peak_gbs <= 0.0 || roof->peak_gflops <= 0.0) {
+        perfmon_set_error("Roofline calibration failed");
+        return false;
+    }
+    return true;
+}
+
+/* True if /proc/cpuinfo reports an Intel CPU */
+static bool cpu_is_intel(void) {
+    char line[256];
+    bool intel = false;
+    FILE *file = fopen("/proc/cpuinfo", "r");
+
+    if (!file) {
+        return false;
+    }
+    while (fgets(line, sizeof(line), file)) {
+        if (strncmp(line, "vendor_id", 9) == 0) {
+            intel = strstr(line, "GenuineIntel") != NULL;
+            break;
+        }
+    }
+    fclose(file);
+    return intel;
+}
+
+/* Read a small sysfs file into buf (newline stripped) */
+static bool read_sysfs(const char *path, char *buf, size_t size) {
+    FILE *file = fopen(path, "r");
+    size_t len;
+
+    if (!file) {
+        return false;
+    }
+    if (!fgets(buf, (int)size, file)) {
+        fclose(file);
+        return false;
+    }
+    fclose(file);
+    len = strlen(buf);
+    if (len > 0 && buf[len - 1] == '\n') {
+        buf[len - 1] = '\0';
+    }
+    return true;
+}
+
+/* Encode a sysfs event string ("event=0x04,umask=0x03") as a raw config */
+static bool parse_event_config(const char *desc, uint64_t *config) {
+    char buf[128];
+    char *item, *save = NULL, *eq;
+    unsigned long value;
+
+    snprintf(buf, sizeof(buf), "%s", desc);
+    *config = 0;
+    for (item = strtok_r(buf, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+        eq = strchr(item, '=');
+        if (!eq) {
+            return false;
+        }
+        *eq = '\0';
+        value = strtoul(eq + 1, NULL, 0);
+        if (strcmp(item, "event") == 0) {
+            *config |= value & 0xff;
+        } else if (strcmp(item, "umask") == 0) {
+            *config |= (value & 0xff) << 8;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Open one CAS event of an IMC PMU on the first CPU of its cpumask */
+static int open_imc_event(const char *pmu, uint32_t type, int cpu, const char *event) {
+    char path[512], desc[128];
+    uint64_t config;
+
+    snprintf(path, sizeof(path), PMU_DIR "/%s/events/%s", pmu, event);
+    if (!read_sysfs(path, desc, sizeof(desc)) || !parse_event_config(desc, &config)) {
+        return -1;
+    }
+    return perfmon_open_event(type, config, -1, cpu, -1, 0);
+}
+
+/* Open CAS read/write counters on every uncore_imc_N PMU */
+static void open_imc_events(perfmon_roofline_events_t *events) {
+    char path[512], buf[64];
+    struct dirent *entry;
+    uint32_t type;
+    int cpu, fd;
+    DIR *dir = opendir(PMU_DIR);
+
+    if (!dir) {
+        return;
+    }
+
+    while ((entry = readdir(dir)) && events->nr_imc + 2 <= MAX_IMC_EVENTS) {
+        if (strncmp(entry->d_name, "uncore_imc_", 11) != 0 ||
+            strstr(entry->d_name, "free_running")) {
+            continue;
+        }
+
+        snprintf(path, sizeof(path), PMU_DIR "/%s/type", entry->d_name);
+        if (!read_sysfs(path, buf, sizeof(buf))) {
+            continue;
+        }
+        type = (uint32_t)strtoul(buf, NULL, 10);
+
+        snprintf(path, sizeof(path), PMU_DIR "/%s/cpumask", entry->d_name);
+        cpu = read_sysfs(path, buf, sizeof(buf)) ? atoi(buf) : 0;
+
+        fd = open_imc_event(entry->d_name, type, cpu, "cas_count_read");
+        if (fd != -1) {
+            events->imc_fds[events->nr_imc++] = fd;
+        }
+        fd = open_imc_event(entry->d_name, type, cpu, "cas_count_write");
+        if (fd != -1) {
+            events->imc_fds[events->nr_imc++] = fd;
+        }
+    }
+    closedir(dir);
+}
+
+/* General-purpose counters per logical CPU (CPUID leaf 0xA), at most NR_FP_EVENTS */
+static int gp_counters(void) {
+    int n = DEFAULT_GP_COUNTERS;
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+
+    if (__get_cpuid_max(0, NULL) >= 0xA) {
+        __cpuid(0xA, eax, ebx, ecx, edx);
+        if (((eax >> 8) & 0xff) > 0) {
+            n = (int)((eax >> 8) & 0xff);
+        }
+    }
+#endif
+    return n < NR_FP_EVENTS ? n : NR_FP_EVENTS;
+}
+
+/*
+ * Open the FP_ARITH events on Intel CPUs, in groups no larger than the
+ * general-purpose counters: a group that cannot fit is never scheduled
+ */
+static void open_fp_events(perfmon_roofline_events_t *events) {
+    int i, leader = -1;
+
+    if (!cpu_is_intel()) {
+        return;
+    }
+
+    events->fp_group_size = gp_counters();
+    for (i = 0; i < NR_FP_EVENTS; i++) {
+        if (i % events->fp_group_size == 0) {
+            leader = -1;
+        }
+        events->fp_fds[i] = perfmon_open_event(PERF_TYPE_RAW,
+                                               FP_ARITH_EVENT | ((uint64_t)fp_events[i].umask << 8),
+                                               0, -1, leader, FP_READ_FORMAT);
+        if (events->fp_fds[i] == -1) {
+            break;
+        }
+        if (leader == -1) {
+            leader = events->fp_fds[i];
+        }
+    }
+
+    /* All or nothing: partial weights would undercount */
+    if (i < NR_FP_EVENTS) {
+        for (i = 0; i < NR_FP_EVENTS; i++) {
+            if (events->fp_fds[i] != -1) {
+                close(events->fp_fds[i]);
+                events->fp_fds[i] = -1;
+            }
+        }
+    }
+}
+
+/* Open the optional events */
+perfmon_roofline_events_t *perfmon_roofline_events_open(void) {
+    perfmon_roofline_events_t *events;
+    int i;
+
+    events = (perfmon_roofline_events_t *)calloc(1, sizeof(perfmon_roofline_events_t));
+    if (!events) {
+        perfmon_set_error("Failed to allocate roofline events: %s", strerror(ENOMEM));
+        return NULL;
+    }
+    for (i = 0; i < NR_FP_EVENTS; i++) {
+        events->fp_fds[i] = -1;
+    }
+
+    open_fp_events(events);
+    open_imc_events(events);
+    return events;
+}
+
+/* Start counting */
+bool perfmon_roofline_events_start(perfmon_roofline_events_t *events) {
+    int i;
+
+    if (!events) {
+        perfmon_set_error("Invalid roofline events");
+        return false;
+    }
+
+    if (events->fp_fds[0] != -1) {
+        for (i = 0; i < NR_FP_EVENTS; i += events->fp_group_size) {
+            ioctl(events->fp_fds[i], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(events->fp_fds[i], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+    }
+    for (i = 0; i < events->nr_imc; i++) {
+        ioctl(events->imc_fds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(events->imc_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+    return true;
+}
+
+/*
+ * Disable and read every FP_ARITH group, scaling multiplexed groups by
+ * enabled / running time.  False if a group never ran: its weights are missing.
+ */
+static bool read_fp_events(const perfmon_roofline_events_t *events, uint64_t *flops) {
+    uint64_t buf[3 + NR_FP_EVENTS];
+    double scale, sum = 0.0;
+    bool ok = true;
+    int g, i, n;
+    ssize_t size;
+
+    for (g = 0; g < NR_FP_EVENTS; g += events->fp_group_size) {
+        ioctl(events->fp_fds[g], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    }
+    for (g = 0; g < NR_FP_EVENTS; g += events->fp_group_size) {
+        n = NR_FP_EVENTS - g < events->fp_group_size ? NR_FP_EVENTS - g : events->fp_group_size;
+        size = (ssize_t)((3 + n) * sizeof(uint64_t));
+        if (read(events->fp_fds[g], buf, (size_t)size) != size || buf[2] == 0) {
+            ok = false;
+            continue;
+        }
+        scale = (double)buf[1] / (double)buf[2];
+        for (i = 0; i < n; i++) {
+            sum += (double)buf[3 + i] * scale * fp_events[g + i].weight;
+        }
+    }
+    *flops = (uint64_t)(sum + 0.5);
+    return ok;
+}
+
+/* Stop counting and collect counts */
+bool perfmon_roofline_events_stop(perfmon_roofline_events_t *events,
+                                  perfmon_roofline_counts_t *counts) {
+    uint64_t value;
+    int i;
+
+    if (!events || !counts) {
+        perfmon_set_error("Invalid roofline events or counts");
+        return false;
+    }
+
+    memset(counts, 0, sizeof(perfmon_roofline_counts_t));
+
+    if (events->fp_fds[0] != -1) {
+        counts->have_flops = read_fp_events(events, &counts->flops);
+        if (!counts->have_flops) {
+            counts->flops = 0;
+        }
+    }
+
+    for (i = 0; i < events->nr_imc; i++) {
+        ioctl(events->imc_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        if (read(events->imc_fds[i], &value, sizeof(value)) == (ssize_t)sizeof(value)) {
+            counts->dram_bytes += value * IMC_CAS_BYTES;
+            counts->have_dram = true;
+        }
+    }
+    return true;
+}
+
+/* Close all events */
+void perfmon_roofline_events_close(perfmon_roofline_events_t *events) {
+    int i;
+
+    if (!events) {
+        return;
+    }
+
+    for (i = 0; i < NR_FP_EVENTS; i++) {
+        if (events->fp_fds[i] != -1) {
+            close(events->fp_fds[i]);
+        }
+    }
+    for (i = 0; i < events->nr_imc; i++) {
+        close(events->imc_fds[i]);
+    }
+    free(events);
+}
+
+/* Cache line size, for the LLC-miss traffic estimate */
+static long cache_line_size(void) {
+    long size = sysconf(_SC_LEVEL1_DCACHE_LINESIZE);
+
+    return size > 0 ? size : 64;
+}
+
+/* Value of the user counter named "flops", 0 if not registered */
+static uint64_t user_flops(const perfmon_stats_t *stats) {
+    int i, count = perfmon_user_counter_count();
+
+    for (i = 0; i < count; i++) {
+        if (strcmp(perfmon_user_counter_name(i), "flops") == 0) {
+            return stats->user_counters[i];
+        }
+    }
+    return 0;
+}
+
+/* Place a region on the roofline */
+void perfmon_roofline_analyze(const perfmon_roofline_t *roof, const perfmon_stats_t *stats,
+                              const perfmon_roofline_counts_t *counts,
+                              perfmon_roofline_point_t *point) {
+    double t, ridge;
+
+    if (!roof || !stats || !point) {
+        return;
+    }
+
+    memset(point, 0, sizeof(perfmon_roofline_point_t));
+
+    if (counts && counts->have_flops) {
+        point->flops = (double)counts->flops;
+        point->flops_source = "FP_ARITH events";
+    } else if (user_flops(stats) > 0) {
+        point->flops = (double)user_flops(stats);
+        point->flops_source = "flops user counter";
+    } else {
+        point->flops_source = "unavailable";
+    }
+
+    if (counts && counts->have_dram) {
+        point->bytes = (double)counts->dram_bytes;
+        point->bytes_source = "IMC CAS, socket-wide";
+    } else if (stats->cache_misses > 0) {
+        point->bytes = (double)stats->cache_misses * (double)cache_line_size();
+        point->bytes_source = "LLC misses x line size";
+    } else {
+        point->bytes_source = "unavailable";
+    }
+
+    t = stats->elapsed_time_sec;
+    if (t > 0.0) {
+        point->gflops = point->flops / t / 1e9;
+        point->gbs = point->bytes / t / 1e9;
+    }
+
+    if (point->bytes > 0.0 && point->flops > 0.0) {
+        point->intensity = point->flops / point->bytes;
+        point->attainable_gflops = point->intensity * roof->peak_gbs;
+        if (point->attainable_gflops > roof->peak_gflops) {
+            point->attainable_gflops = roof->peak_gflops;
+        }
+        ridge = roof->peak_gbs > 0.0 ? roof->peak_gflops / roof->peak_gbs : 0.0;
+        point->memory_bound = point->intensity < ridge;
+    } else {
+        point->attainable_gflops = roof->peak_gflops;
+    }
+
+    /* A vectorized region can beat the scalar peak: report it at the roof */
+    if (point->attainable_gflops > 0.0) {
+        point->efficiency = point->gflops / point->attainable_gflops;
+        if (point->efficiency > 1.0) {
+            point->efficiency = 1.0;
+        }
+    }
+}
+
+/*
+ * Print a roofline point.  Efficiency is clamped to 100%: achieved GFLOP/s
+ * above the attainable roof (FP_ARITH counting vector lanes against the
+ * scalar peak kernel) is flagged instead.
+ */
+void perfmon_roofline_print(const perfmon_roofline_t *roof, const perfmon_roofline_point_t *point,
+                            const char *label, int fd) {
+    double ridge;
+
+    if (!roof || !point) {
+        return;
+    }
+
+    ridge = roof->peak_gbs > 0.0 ? roof->peak_gflops / roof->peak_gbs : 0.0;
+
+    dprintf(fd, "\nRoofline%s%s:\n", label ? " for " : "", label ? label : "");
+    dprintf(fd, "%20.0f      FLOPs                     # %s\n", point->flops, point->flops_source);
+    dprintf(fd, "%20.0f      bytes                     # %s\n", point->bytes, point->bytes_source);
+    if (point->intensity > 0.0) {
+        dprintf(fd, "%20.3f      FLOP/byte                 # ridge at %.3f, %s-bound\n",
+                point->intensity, ridge, point->memory_bound ? "memory" : "compute");
+    } else {
+        dprintf(fd, "%20s      FLOP/byte                 # needs both FLOPs and bytes\n", "n/a");
+    }
+    dprintf(fd, "%20.3f      GFLOP/s                   # attainable %.3f (%.1f%% of roof%s)\n",
+            point->gflops, point->attainable_gflops, point->efficiency * 100.0,
+            point->gflops > point->attainable_gflops ? ", above the scalar peak" : "");
+    dprintf(fd, "%20.3f      GB/s                      # peak %.3f\n", point->gbs, roof->peak_gbs);
+    dprintf(fd, "%20.3f      peak GFLOP/s\n", roof->peak_gflops);
+}
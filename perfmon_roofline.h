@@ -0,0 +1,116 @@
+/*
+ * libperfmon - Roofline Estimation
+ *
+ * Places a region on the machine's roofline: arithmetic intensity (FLOP per
+ * byte of memory traffic), achieved GFLOP/s and GB/s, and the attainable
+ * performance min(peak GFLOP/s, intensity * peak GB/s).
+ *
+ *   perfmon_roofline_t roof;
+ *   perfmon_roofline_calibrate(&roof);              // once, ~0.5 s
+ *
+ *   perfmon_roofline_events_t *ev = perfmon_roofline_events_open();
+ *   perfmon_start(ctx);
+ *   perfmon_roofline_events_start(ev);
+ *   kernel();
+ *   perfmon_roofline_events_stop(ev, &counts);
+ *   perfmon_stop(ctx, &stats);
+ *
+ *   perfmon_roofline_analyze(&roof, &stats, &counts, &point);
+ *   perfmon_roofline_print(&roof, &point, "kernel", STDOUT_FILENO);
+ *
+ * FLOPs come from the Intel FP_ARITH_INST_RETIRED events when the PMU has
+ * them, otherwise from a user counter named "flops" maintained by the
+ * application.  The five events are opened in groups that fit the core's
+ * general-purpose counters; multiplexed groups are scaled, and a group that
+ * never ran leaves the FLOPs unavailable.  Memory traffic comes from the
+ * uncore IMC CAS counters when they can be opened (socket-wide, usually needs
+ * CAP_PERFMON), otherwise it is estimated as LLC misses x cache line size.
+ *
+ * The peak comes from a scalar multiply-add kernel, while FP_ARITH counts
+ * every lane of a vector op, so a vectorized region can run above the roof;
+ * its efficiency is then clamped to 100%.
+ */
+
+#ifndef PERFMON_ROOFLINE_H
+#define PERFMON_ROOFLINE_H
+
+#include "perfmon.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Single-core machine roofline */
+typedef struct {
+    double peak_gflops;     /* double-precision FLOP rate of the bundled kernel */
+    double peak_gbs;        /* STREAM triad bandwidth */
+} perfmon_roofline_t;
+
+/*
+ * Measure peak GFLOP/s and GB/s on the calling thread
+ * Returns: true on success, false on failure
+ */
+bool perfmon_roofline_calibrate(perfmon_roofline_t *roof);
+
+/* FP-op and memory-traffic counts of one region */
+typedef struct {
+    uint64_t flops;         /* weighted FP_ARITH count */
+    uint64_t dram_bytes;    /* IMC CAS reads + writes x 64 */
+    bool have_flops;
+    bool have_dram;
+} perfmon_roofline_counts_t;
+
+/* Optional FP_ARITH and IMC events (opaque handle) */
+typedef struct perfmon_roofline_events perfmon_roofline_events_t;
+
+/*
+ * Open whatever FP-op and IMC events this machine offers; the handle is
+ * valid (and counts nothing) when neither is available
+ * Returns: handle on success, NULL on allocation failure
+ */
+perfmon_roofline_events_t *perfmon_roofline_events_open(void);
+
+/*
+ * Start / stop counting; stop fills counts
+ */
+bool perfmon_roofline_events_start(perfmon_roofline_events_t *events);
+bool perfmon_roofline_events_stop(perfmon_roofline_events_t *events,
+                                  perfmon_roofline_counts_t *counts);
+
+/*
+ * Close all events
+ */
+void perfmon_roofline_events_close(perfmon_roofline_events_t *events);
+
+/* One region on the roofline */
+typedef struct {
+    double flops;
+    double bytes;
+    double intensity;           /* FLOP per byte (0 when bytes unknown) */
+    double gflops;              /* achieved */
+    double gbs;                 /* achieved */
+    double attainable_gflops;   /* roofline at this intensity */
+    double efficiency;          /* gflops / attainable_gflops, at most 1 */
+    bool memory_bound;          /* intensity below the ridge point */
+    const char *flops_source;
+    const char *bytes_source;
+} perfmon_roofline_point_t;
+
+/*
+ * Place a region on the roofline; counts may be NULL
+ */
+void perfmon_roofline_analyze(const perfmon_roofline_t *roof, const perfmon_stats_t *stats,
+                              const perfmon_roofline_counts_t *counts,
+                              perfmon_roofline_point_t *point);
+
+/*
+ * Print a roofline point
+ */
+void perfmon_roofline_print(const perfmon_roofline_t *roof, const perfmon_roofline_point_t *point,
+                            const char *label, int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PERFMON_ROOFLINE_H */
@@ -26,6 +26,20 @@
 #include "miscadmin.h"
 #include "utils/memutils.h"
 #include "utils/perfmon.h"
+#include "utils/perfmon_advisor.h"
+
+#if PERFMON_LEVEL_ENABLED(PERFMON_LEVEL_NODE)
+/* Qihan: user counter ids for per-tuple metrics */
+static int	perfmon_outer_id = -1;
+static int	perfmon_inner_id = -1;
+static int	perfmon_emitted_id = -1;
+
+/* Qihan: bottleneck rules, created on first use and kept for the backend */
+static perfmon_advisor_t *perfmon_advisor = NULL;
+
+/* Qihan: the host block is logged once per backend, later lines carry its hash */
+static bool perfmon_host_logged = false;
+#endif
 
 /* ----------------------------------------------------------------
  *		ExecNestLoop(node)
@@ -120,6 +134,10 @@ ExecNestLoop(PlanState *pstate)
 			ENL1_printf("saving new outer tuple information");
 			econtext->ecxt_outertuple = outerTupleSlot;
 			node->nl_NeedNewOuter = false;
+#if PERFMON_LEVEL_ENABLED(PERFMON_LEVEL_NODE)
+			/* Qihan: count outer tuples (one inner rescan each) */
+			perfmon_user_counter_add(node->perfmon_ctx, perfmon_outer_id, 1);
+#endif
 			node->nl_MatchedOuter = false;
 
 			/*
@@ -159,6 +177,11 @@ ExecNestLoop(PlanState *pstate)
 
 		innerTupleSlot = ExecProcNode(innerPlan);
 		econtext->ecxt_innertuple = innerTupleSlot;
+#if PERFMON_LEVEL_ENABLED(PERFMON_LEVEL_NODE)
+		/* Qihan: count inner tuples (one probe per fetch) */
+		if (!TupIsNull(innerTupleSlot))
+			perfmon_user_counter_add(node->perfmon_ctx, perfmon_inner_id, 1);
+#endif
 
 		if (TupIsNull(innerTupleSlot))
 		{
@@ -189,6 +212,10 @@ ExecNestLoop(PlanState *pstate)
 					 */
 					ENL1_printf("qualification succeeded, projecting tuple");
 
+#if PERFMON_LEVEL_ENABLED(PERFMON_LEVEL_NODE)
+					/* Qihan: count emitted tuples */
+					perfmon_user_counter_add(node->perfmon_ctx, perfmon_emitted_id, 1);
+#endif
 					return ExecProject(node->js.ps.ps_ProjInfo);
 				}
 				else
@@ -238,6 +265,10 @@ ExecNestLoop(PlanState *pstate)
 				 */
 				ENL1_printf("qualification succeeded, projecting tuple");
 
+#if PERFMON_LEVEL_ENABLED(PERFMON_LEVEL_NODE)
+				/* Qihan: count emitted tuples */
+				perfmon_user_counter_add(node->perfmon_ctx, perfmon_emitted_id, 1);
+#endif
 				return ExecProject(node->js.ps.ps_ProjInfo);
 			}
 			else
@@ -263,8 +294,11 @@ NestLoopState *
 ExecInitNestLoop(NestLoop *node, EState *estate, int eflags)
 {
 	NestLoopState *nlstate;
+#if PERFMON_LEVEL_ENABLED(PERFMON_LEVEL_NODE)
 	/* Qihan: performance monitoring */
 	perfmon_context_t *perfmon_ctx;
+	perfmon_options_t perfmon_opts;
+#endif
 
 	/* check for unsupported flags */
 	Assert(!(eflags & (EXEC_FLAG_BACKWARD | EXEC_FLAG_MARK)));
@@ -272,12 +306,37 @@ ExecInitNestLoop(NestLoop *node, EState *estate, int eflags)
 	NL1_printf("ExecInitNestLoop: %s\n",
 			   "initializing node");
 
+#if PERFMON_LEVEL_ENABLED(PERFMON_LEVEL_NODE)
 	/* Qihan: 初始化性能监控 */
-	perfmon_ctx = perfmon_init();
+	perfmon_outer_id = perfmon_user_counter_register("outer_tuples");
+	perfmon_inner_id = perfmon_user_counter_register("inner_tuples");
+	perfmon_emitted_id = perfmon_user_counter_register("emitted_tuples");
+	/* Qihan: subtract the library's own start/stop cost (small nodes) */
+	perfmon_options_init(&perfmon_opts);
+	perfmon_opts.subtract_bias = true;
+	perfmon_opts.energy = true;
+	perfmon_opts.os_counters = true;
+	perfmon_opts.numa = true;
+	perfmon_ctx = perfmon_init_with_options(&perfmon_opts);
 	if (perfmon_ctx && perfmon_start(perfmon_ctx)) {
 		elog(LOG, "[PERFMON] NestLoop[node_id=%d]: Started monitoring",
 			 node->join.plan.plan_node_id);
+		if (!perfmon_host_logged) {
+			perfmon_host_t host;
+
+			perfmon_host_info(&host);
+			elog(LOG, "[PERFMON] host=%016lx: cpu=\"%s\", microcode=%s, "
+					  "l1d=%uK, l2=%uK, l3=%uK, line=%uB, cpus=%d, smt=%s, numa_nodes=%d, "
+					  "governor=%s, paranoid=%d, kernel=%s, hypervisor=%s",
+				 host.hash, host.cpu_model, host.microcode,
+				 host.l1d_kb, host.l2_kb, host.l3_kb, host.cache_line_size,
+				 host.online_cpus, host.smt_active ? "on" : "off", host.numa_nodes,
+				 host.governor[0] ? host.governor : "none", host.perf_event_paranoid,
+				 host.kernel, host.hypervisor[0] ? host.hypervisor : "none");
+			perfmon_host_logged = true;
+		}
 	}
+#endif
 
 	/*
 	 * create state structure
@@ -355,8 +414,10 @@ ExecInitNestLoop(NestLoop *node, EState *estate, int eflags)
 	nlstate->nl_NeedNewOuter = true;
 	nlstate->nl_MatchedOuter = false;
 
+#if PERFMON_LEVEL_ENABLED(PERFMON_LEVEL_NODE)
 	/* Qihan:保存perfmon context到nlstate，以便在ExecEndNestLoop中使用 */
 	nlstate->perfmon_ctx = perfmon_ctx;
+#endif
 
 	NL1_printf("ExecInitNestLoop: %s\n",
 			   "node initialized");
@@ -373,12 +434,22 @@ ExecInitNestLoop(NestLoop *node, EState *estate, int eflags)
 void
 ExecEndNestLoop(NestLoopState *node)
 {
+#if PERFMON_LEVEL_ENABLED(PERFMON_LEVEL_NODE)
 	/* Qihan: performance monitoring statistics */
 	perfmon_stats_t stats;
+	perfmon_normalized_t per_tuple;
+	perfmon_normalized_t per_probe;
+	uint64		outer_tuples;
+	uint64		inner_tuples;
+	perfmon_finding_t findings[4];
+	int			nfindings;
+	int			i;
+#endif
 
 	NL1_printf("ExecEndNestLoop: %s\n",
 			   "ending node processing");
 
+#if PERFMON_LEVEL_ENABLED(PERFMON_LEVEL_NODE)
 	/* Qihan: 停止性能监控并输出统计 */
 	if (node->perfmon_ctx) {
 		if (perfmon_stop(node->perfmon_ctx, &stats)) {
@@ -386,17 +457,83 @@ ExecEndNestLoop(NestLoopState *node)
 					  "branches=%lu, branch_miss=%.2f%%, "
 					  "cache_refs=%lu, cache_miss=%.2f%%, "
 					  "page_faults=%lu, context_switches=%lu, "
-					  "time=%.6fs",
+					  "time=%.6fs, ghz=%.2f, turbo=%.2f%s, host=%016lx",
 				 node->js.ps.plan->plan_node_id,
 				 stats.cycles, stats.instructions, stats.insn_per_cycle,
 				 stats.branches, stats.branch_miss_rate,
 				 stats.cache_references, stats.cache_miss_rate,
 				 stats.page_faults, stats.context_switches,
-				 stats.elapsed_time_sec);
+				 stats.elapsed_time_sec, stats.effective_ghz, stats.turbo_ratio,
+				 stats.throttled ? " (throttled)" : "", stats.host_hash);
+
+			outer_tuples = perfmon_user_counter_get(&stats, perfmon_outer_id);
+			inner_tuples = perfmon_user_counter_get(&stats, perfmon_inner_id);
+			perfmon_normalize(&stats, outer_tuples + inner_tuples, &per_tuple);
+			perfmon_normalize(&stats, inner_tuples, &per_probe);
+			elog(LOG, "[PERFMON] NestLoop[node_id=%d]: outer_tuples=%lu, inner_tuples=%lu, "
+					  "emitted_tuples=%lu, cycles/tuple=%.1f, insn/tuple=%.1f, "
+					  "llc_miss/probe=%.3f, branch_miss/tuple=%.3f",
+				 node->js.ps.plan->plan_node_id,
+				 outer_tuples, inner_tuples,
+				 perfmon_user_counter_get(&stats, perfmon_emitted_id),
+				 per_tuple.cycles_per_unit, per_tuple.insn_per_unit,
+				 per_probe.cache_misses_per_unit, per_tuple.branch_misses_per_unit);
+
+			/* Qihan: RAPL energy is CPU-wide, charged to the node by wall time */
+			if (stats.energy_joules[PERFMON_ENERGY_PKG] > 0.0)
+				elog(LOG, "[PERFMON] NestLoop[node_id=%d]: energy_pkg=%.3fJ, energy_cores=%.3fJ, "
+						  "energy_ram=%.3fJ, power=%.2fW, mJ/tuple=%.4f",
+					 node->js.ps.plan->plan_node_id,
+					 stats.energy_joules[PERFMON_ENERGY_PKG],
+					 stats.energy_joules[PERFMON_ENERGY_CORES],
+					 stats.energy_joules[PERFMON_ENERGY_RAM],
+					 stats.elapsed_time_sec > 0.0 ?
+					 stats.energy_joules[PERFMON_ENERGY_PKG] / stats.elapsed_time_sec : 0.0,
+					 outer_tuples + inner_tuples > 0 ?
+					 stats.energy_joules[PERFMON_ENERGY_PKG] * 1e3 / (outer_tuples + inner_tuples) : 0.0);
+
+			/* Qihan: spill I/O and run-queue delay, invisible to the PMU */
+			elog(LOG, "[PERFMON] NestLoop[node_id=%d]: read_bytes=%lu, write_bytes=%lu, "
+					  "syscr=%lu, syscw=%lu, run_delay=%.3fms, "
+					  "voluntary_cs=%lu, involuntary_cs=%lu, process_max_rss=%luKB",
+				 node->js.ps.plan->plan_node_id,
+				 stats.io_read_bytes, stats.io_write_bytes,
+				 stats.io_syscr, stats.io_syscw, (double) stats.run_delay_ns / 1e6,
+				 stats.voluntary_switches, stats.involuntary_switches, stats.process_max_rss_kb);
+
+			/* Qihan: system-wide stall time, set PERFMON_PSI=100 to sample it */
+			if (stats.psi_cpu_some + stats.psi_memory_some + stats.psi_io_some > 0.0)
+				elog(LOG, "[PERFMON] NestLoop[node_id=%d]: psi_cpu=%.1f%%, "
+						  "psi_memory=%.1f%%/%.1f%%, psi_io=%.1f%%/%.1f%%",
+					 node->js.ps.plan->plan_node_id,
+					 stats.psi_cpu_some, stats.psi_memory_some, stats.psi_memory_full,
+					 stats.psi_io_some, stats.psi_io_full);
+
+			/* Qihan: where the backend ran and how much of its memory was remote */
+			elog(LOG, "[PERFMON] NestLoop[node_id=%d]: cpu=%d->%d, numa_node=%d->%d, "
+					  "node_loads=%lu, remote=%.2f%%",
+				 node->js.ps.plan->plan_node_id,
+				 stats.start_cpu, stats.stop_cpu, stats.start_node, stats.stop_node,
+				 stats.node_loads, stats.remote_load_rate);
+
+			/* Qihan: ranked bottleneck findings */
+			if (!perfmon_advisor) {
+				perfmon_advisor = perfmon_advisor_create_default();
+				if (!perfmon_advisor)
+					elog(LOG, "[PERFMON] advisor unavailable: %s", perfmon_get_error());
+			}
+			nfindings = perfmon_advisor_evaluate(perfmon_advisor, &stats,
+												 findings, lengthof(findings));
+			for (i = 0; i < nfindings; i++) {
+				elog(LOG, "[PERFMON] NestLoop[node_id=%d]: finding %d: %s (score=%.2f): %s",
+					 node->js.ps.plan->plan_node_id, i + 1,
+					 findings[i].rule, findings[i].score, findings[i].message);
+			}
 		}
 		perfmon_cleanup(node->perfmon_ctx);
 		node->perfmon_ctx = NULL;
 	}
+#endif
 
 	/*
 	 * Free the exprcontext
@@ -174,6 +174,20 @@
 #include "utils/sharedtuplestore.h"
 /* Qihan: performance monitoring */
 #include "utils/perfmon.h"
+#include "utils/perfmon_advisor.h"
+
+#if PERFMON_LEVEL_ENABLED(PERFMON_LEVEL_NODE)
+/* Qihan: user counter ids for per-tuple metrics */
+static int	perfmon_outer_id = -1;
+static int	perfmon_inner_id = -1;
+static int	perfmon_emitted_id = -1;
+
+/* Qihan: bottleneck rules, created on first use and kept for the backend */
+static perfmon_advisor_t *perfmon_advisor = NULL;
+
+/* Qihan: the host block is logged once per backend, later lines carry its hash */
+static bool perfmon_host_logged = false;
+#endif
 
 
 /*
@@ -347,6 +361,11 @@ ExecHashJoinImpl(PlanState *pstate, bool parallel)
 				 */
 				hashNode->hashtable = hashtable;
 				(void) MultiExecProcNode((PlanState *) hashNode);
+#if PERFMON_LEVEL_ENABLED(PERFMON_LEVEL_NODE)
+				/* Qihan: count inner (build) tuples */
+				perfmon_user_counter_add(node->perfmon_ctx, perfmon_inner_id,
+										 (uint64) hashtable->totalTuples);
+#endif
 
 				/*
 				 * If the inner relation is completely empty, and we're not
@@ -507,6 +526,14 @@ ExecHashJoinImpl(PlanState *pstate, bool parallel)
 					continue;
 				}
 
+#if PERFMON_LEVEL_ENABLED(PERFMON_LEVEL_NODE)
+				/*
+				 * Qihan: count outer (probe) tuples.  Tuples postponed to a
+				 * later batch above are counted when that batch reloads them.
+				 */
+				perfmon_user_counter_add(node->perfmon_ctx, perfmon_outer_id, 1);
+#endif
+
 				/* OK, let's scan the bucket for matches */
 				node->hj_JoinState = HJ_SCAN_BUCKET;
 
@@ -684,7 +711,17 @@ ExecHashJoin(PlanState *pstate)
 	 * On sufficiently smart compilers this should be inlined with the
 	 * parallel-aware branches removed.
 	 */
+#if PERFMON_LEVEL_ENABLED(PERFMON_LEVEL_NODE)
+	TupleTableSlot *slot = ExecHashJoinImpl(pstate, false);
+
+	/* Qihan: count emitted tuples */
+	if (!TupIsNull(slot))
+		perfmon_user_counter_add(((HashJoinState *) pstate)->perfmon_ctx,
+								 perfmon_emitted_id, 1);
+	return slot;
+#else
 	return ExecHashJoinImpl(pstate, false);
+#endif
 }
 
 /* ----------------------------------------------------------------
@@ -700,7 +737,17 @@ ExecParallelHashJoin(PlanState *pstate)
 	 * On sufficiently smart compilers this should be inlined with the
 	 * parallel-oblivious branches removed.
 	 */
+#if PERFMON_LEVEL_ENABLED(PERFMON_LEVEL_NODE)
+	TupleTableSlot *slot = ExecHashJoinImpl(pstate, true);
+
+	/* Qihan: count emitted tuples */
+	if (!TupIsNull(slot))
+		perfmon_user_counter_add(((HashJoinState *) pstate)->perfmon_ctx,
+								 perfmon_emitted_id, 1);
+	return slot;
+#else
 	return ExecHashJoinImpl(pstate, true);
+#endif
 }
 
 /* ----------------------------------------------------------------
@@ -718,18 +765,46 @@ ExecInitHashJoin(HashJoin *node, EState *estate, int eflags)
 	TupleDesc	outerDesc,
 				innerDesc;
 	const TupleTableSlotOps *ops;
+#if PERFMON_LEVEL_ENABLED(PERFMON_LEVEL_NODE)
 	/* Qihan: performance monitoring */
 	perfmon_context_t *perfmon_ctx;
+	perfmon_options_t perfmon_opts;
+#endif
 
 	/* check for unsupported flags */
 	Assert(!(eflags & (EXEC_FLAG_BACKWARD | EXEC_FLAG_MARK)));
 
+#if PERFMON_LEVEL_ENABLED(PERFMON_LEVEL_NODE)
 	/* Qihan: 初始化性能监控 */
-	perfmon_ctx = perfmon_init();
+	perfmon_outer_id = perfmon_user_counter_register("outer_tuples");
+	perfmon_inner_id = perfmon_user_counter_register("inner_tuples");
+	perfmon_emitted_id = perfmon_user_counter_register("emitted_tuples");
+	/* Qihan: subtract the library's own start/stop cost (small nodes) */
+	perfmon_options_init(&perfmon_opts);
+	perfmon_opts.subtract_bias = true;
+	perfmon_opts.energy = true;
+	perfmon_opts.os_counters = true;
+	perfmon_opts.numa = true;
+	perfmon_ctx = perfmon_init_with_options(&perfmon_opts);
 	if (perfmon_ctx && perfmon_start(perfmon_ctx)) {
 		elog(LOG, "[PERFMON] HashJoin[node_id=%d]: Started monitoring",
 			 node->join.plan.plan_node_id);
+		if (!perfmon_host_logged) {
+			perfmon_host_t host;
+
+			perfmon_host_info(&host);
+			elog(LOG, "[PERFMON] host=%016lx: cpu=\"%s\", microcode=%s, "
+					  "l1d=%uK, l2=%uK, l3=%uK, line=%uB, cpus=%d, smt=%s, numa_nodes=%d, "
+					  "governor=%s, paranoid=%d, kernel=%s, hypervisor=%s",
+				 host.hash, host.cpu_model, host.microcode,
+				 host.l1d_kb, host.l2_kb, host.l3_kb, host.cache_line_size,
+				 host.online_cpus, host.smt_active ? "on" : "off", host.numa_nodes,
+				 host.governor[0] ? host.governor : "none", host.perf_event_paranoid,
+				 host.kernel, host.hypervisor[0] ? host.hypervisor : "none");
+			perfmon_host_logged = true;
+		}
 	}
+#endif
 
 	/*
 	 * create state structure
@@ -857,8 +932,10 @@ ExecInitHashJoin(HashJoin *node, EState *estate, int eflags)
 	hjstate->hj_JoinState = HJ_BUILD_HASHTABLE;
 	hjstate->hj_MatchedOuter = false;
 	hjstate->hj_OuterNotEmpty = false;
+#if PERFMON_LEVEL_ENABLED(PERFMON_LEVEL_NODE)
 	/*Qihan:保存perfmon context到hjstate，以便在ExecEndHashJoin中使用 */
 	hjstate->perfmon_ctx = perfmon_ctx;
+#endif
 
 	return hjstate;
 }
@@ -873,9 +950,19 @@ void
 ExecEndHashJoin(HashJoinState *node)
 {
 
+#if PERFMON_LEVEL_ENABLED(PERFMON_LEVEL_NODE)
 	/* Qihan: performance monitoring statistics */
-    perfmon_stats_t stats;
+	perfmon_stats_t stats;
+	perfmon_normalized_t per_tuple;
+	perfmon_normalized_t per_probe;
+	uint64		outer_tuples;
+	uint64		inner_tuples;
+	perfmon_finding_t findings[4];
+	int			nfindings;
+	int			i;
+#endif
 
+#if PERFMON_LEVEL_ENABLED(PERFMON_LEVEL_NODE)
 	/* Qihan: 停止性能监控并输出统计 */
 	if (node->perfmon_ctx) {
 		if (perfmon_stop(node->perfmon_ctx, &stats)) {
@@ -883,17 +970,83 @@ ExecEndHashJoin(HashJoinState *node)
 					  "branches=%lu, branch_miss=%.2f%%, "
 					  "cache_refs=%lu, cache_miss=%.2f%%, "
 					  "page_faults=%lu, context_switches=%lu, "
-					  "time=%.6fs",
+					  "time=%.6fs, ghz=%.2f, turbo=%.2f%s, host=%016lx",
 				 node->js.ps.plan->plan_node_id,
 				 stats.cycles, stats.instructions, stats.insn_per_cycle,
 				 stats.branches, stats.branch_miss_rate,
 				 stats.cache_references, stats.cache_miss_rate,
 				 stats.page_faults, stats.context_switches,
-				 stats.elapsed_time_sec);
+				 stats.elapsed_time_sec, stats.effective_ghz, stats.turbo_ratio,
+				 stats.throttled ? " (throttled)" : "", stats.host_hash);
+
+			outer_tuples = perfmon_user_counter_get(&stats, perfmon_outer_id);
+			inner_tuples = perfmon_user_counter_get(&stats, perfmon_inner_id);
+			perfmon_normalize(&stats, outer_tuples + inner_tuples, &per_tuple);
+			perfmon_normalize(&stats, outer_tuples, &per_probe);
+			elog(LOG, "[PERFMON] HashJoin[node_id=%d]: outer_tuples=%lu, inner_tuples=%lu, "
+					  "emitted_tuples=%lu, cycles/tuple=%.1f, insn/tuple=%.1f, "
+					  "llc_miss/probe=%.3f, branch_miss/tuple=%.3f",
+				 node->js.ps.plan->plan_node_id,
+				 outer_tuples, inner_tuples,
+				 perfmon_user_counter_get(&stats, perfmon_emitted_id),
+				 per_tuple.cycles_per_unit, per_tuple.insn_per_unit,
+				 per_probe.cache_misses_per_unit, per_tuple.branch_misses_per_unit);
+
+			/* Qihan: RAPL energy is CPU-wide, charged to the node by wall time */
+			if (stats.energy_joules[PERFMON_ENERGY_PKG] > 0.0)
+				elog(LOG, "[PERFMON] HashJoin[node_id=%d]: energy_pkg=%.3fJ, energy_cores=%.3fJ, "
+						  "energy_ram=%.3fJ, power=%.2fW, mJ/tuple=%.4f",
+					 node->js.ps.plan->plan_node_id,
+					 stats.energy_joules[PERFMON_ENERGY_PKG],
+					 stats.energy_joules[PERFMON_ENERGY_CORES],
+					 stats.energy_joules[PERFMON_ENERGY_RAM],
+					 stats.elapsed_time_sec > 0.0 ?
+					 stats.energy_joules[PERFMON_ENERGY_PKG] / stats.elapsed_time_sec : 0.0,
+					 outer_tuples + inner_tuples > 0 ?
+					 stats.energy_joules[PERFMON_ENERGY_PKG] * 1e3 / (outer_tuples + inner_tuples) : 0.0);
+
+			/* Qihan: spill I/O and run-queue delay, invisible to the PMU */
+			elog(LOG, "[PERFMON] HashJoin[node_id=%d]: read_bytes=%lu, write_bytes=%lu, "
+					  "syscr=%lu, syscw=%lu, run_delay=%.3fms, "
+					  "voluntary_cs=%lu, involuntary_cs=%lu, process_max_rss=%luKB",
+				 node->js.ps.plan->plan_node_id,
+				 stats.io_read_bytes, stats.io_write_bytes,
+				 stats.io_syscr, stats.io_syscw, (double) stats.run_delay_ns / 1e6,
+				 stats.voluntary_switches, stats.involuntary_switches, stats.process_max_rss_kb);
+
+			/* Qihan: system-wide stall time, set PERFMON_PSI=100 to sample it */
+			if (stats.psi_cpu_some + stats.psi_memory_some + stats.psi_io_some > 0.0)
+				elog(LOG, "[PERFMON] HashJoin[node_id=%d]: psi_cpu=%.1f%%, "
+						  "psi_memory=%.1f%%/%.1f%%, psi_io=%.1f%%/%.1f%%",
+					 node->js.ps.plan->plan_node_id,
+					 stats.psi_cpu_some, stats.psi_memory_some, stats.psi_memory_full,
+					 stats.psi_io_some, stats.psi_io_full);
+
+			/* Qihan: where the backend ran and how much of its memory was remote */
+			elog(LOG, "[PERFMON] HashJoin[node_id=%d]: cpu=%d->%d, numa_node=%d->%d, "
+					  "node_loads=%lu, remote=%.2f%%",
+				 node->js.ps.plan->plan_node_id,
+				 stats.start_cpu, stats.stop_cpu, stats.start_node, stats.stop_node,
+				 stats.node_loads, stats.remote_load_rate);
+
+			/* Qihan: ranked bottleneck findings */
+			if (!perfmon_advisor) {
+				perfmon_advisor = perfmon_advisor_create_default();
+				if (!perfmon_advisor)
+					elog(LOG, "[PERFMON] advisor unavailable: %s", perfmon_get_error());
+			}
+			nfindings = perfmon_advisor_evaluate(perfmon_advisor, &stats,
+												 findings, lengthof(findings));
+			for (i = 0; i < nfindings; i++) {
+				elog(LOG, "[PERFMON] HashJoin[node_id=%d]: finding %d: %s (score=%.2f): %s",
+					 node->js.ps.plan->plan_node_id, i + 1,
+					 findings[i].rule, findings[i].score, findings[i].message);
+			}
 		}
 		perfmon_cleanup(node->perfmon_ctx);
 		node->perfmon_ctx = NULL;
 	}
+#endif
 
 	/*
 	 * Free hash table
@@ -0,0 +1,370 @@
+/*
+ * Mock backend tests
+ *
+ * Drives the library through the mock backend, whose counters and clock
+ * only move when a script step or perfmon_mock_advance() says so, and
+ * checks every result against the exact expected value:
+ *
+ *   start_stop      one scripted interval per start/stop, steps cycling
+ *   read_running    perfmon_read() of a running region, then its stop
+ *   region_table    calls and sums of recorded regions, metrics of the sum
+ *   derived         IPC, miss rates, GHz and turbo ratio of known counts
+ *   throttled       turbo drop below the process peak, kept by region totals
+ *   bias            scripted calibration subtracted by stop and read
+ *   task_reset      a reset inside a task slice charges nothing, not a wrap
+ *
+ * Runs anywhere, no PMU or perf_event access needed.  Exits with status 1
+ * if any check fails.
+ */
+
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "perfmon.h"
+
+static int nr_checks = 0;
+static int nr_failed = 0;
+
+static void check_u64(const char *test, const char *what, uint64_t got, uint64_t want) {
+    nr_checks++;
+    if (got != want) {
+        nr_failed++;
+        printf("FAIL  %-14s  %-24s  got %" PRIu64 ", want %" PRIu64 "\n",
+               test, what, got, want);
+    }
+}
+
+/* Doubles are compared to 1e-9 relative, the rounding of the divisions */
+static void check_f64(const char *test, const char *what, double got, double want) {
+    nr_checks++;
+    if (fabs(got - want) > 1e-9 * fmax(1.0, fabs(want))) {
+        nr_failed++;
+        printf("FAIL  %-14s  %-24s  got %.12g, want %.12g\n", test, what, got, want);
+    }
+}
+
+/* Mock context running a script (NULL: advanced by hand), subtracting bias if given */
+static perfmon_context_t *open_mock_biased(const perfmon_stats_t *script, int len,
+                                           const perfmon_stats_t *bias) {
+    perfmon_options_t opts;
+    perfmon_context_t *ctx;
+
+    perfmon_options_init(&opts);
+    opts.backend = PERFMON_BACKEND_MOCK;
+    opts.mock_script = script;
+    opts.mock_script_len = len;
+    if (bias) {
+        opts.subtract_bias = true;
+        opts.mock_bias = bias;
+    }
+
+    ctx = perfmon_init_with_options(&opts);
+    if (!ctx) {
+        fprintf(stderr, "Failed to open mock context: %s\n", perfmon_get_error());
+        exit(1);
+    }
+    return ctx;
+}
+
+static perfmon_context_t *open_mock(const perfmon_stats_t *script, int len) {
+    return open_mock_biased(script, len, NULL);
+}
+
+static void test_start_stop(void) {
+    perfmon_stats_t script[2], stats;
+    perfmon_context_t *ctx;
+
+    memset(script, 0, sizeof(script));
+    script[0].cycles = 1000;
+    script[0].instructions = 2500;
+    script[0].page_faults = 3;
+    script[0].elapsed_time_sec = 0.001;
+    script[1].cycles = 10;
+    script[1].instructions = 5;
+    script[1].elapsed_time_sec = 2e-6;
+
+    ctx = open_mock(script, 2);
+    check_u64("start_stop", "backend is mock", strcmp(perfmon_backend_name(ctx), "mock") == 0, 1);
+
+    /* Steps apply in order, then cycle */
+    perfmon_start(ctx);
+    perfmon_stop(ctx, &stats);
+    check_u64("start_stop", "step 0 cycles", stats.cycles, 1000);
+    check_u64("start_stop", "step 0 instructions", stats.instructions, 2500);
+    check_u64("start_stop", "step 0 page_faults", stats.page_faults, 3);
+    check_f64("start_stop", "step 0 elapsed", stats.elapsed_time_sec, 0.001);
+
+    perfmon_start(ctx);
+    perfmon_stop(ctx, &stats);
+    check_u64("start_stop", "step 1 cycles", stats.cycles, 10);
+    check_u64("start_stop", "step 1 instructions", stats.instructions, 5);
+    check_u64("start_stop", "step 1 page_faults", stats.page_faults, 0);
+    check_f64("start_stop", "step 1 elapsed", stats.elapsed_time_sec, 2e-6);
+
+    perfmon_start(ctx);
+    perfmon_stop(ctx, &stats);
+    check_u64("start_stop", "step 0 again cycles", stats.cycles, 1000);
+
+    perfmon_cleanup(ctx);
+}
+
+static void test_read_running(void) {
+    perfmon_stats_t delta, stats;
+    perfmon_context_t *ctx = open_mock(NULL, 0);
+
+    memset(&delta, 0, sizeof(delta));
+    delta.cycles = 300;
+    delta.instructions = 600;
+    delta.branches = 50;
+    delta.elapsed_time_sec = 0.002;
+
+    perfmon_start(ctx);
+    perfmon_mock_advance(ctx, &delta);
+    check_u64("read_running", "read succeeds", perfmon_read(ctx, &stats), 1);
+    check_u64("read_running", "read cycles", stats.cycles, 300);
+    check_u64("read_running", "read instructions", stats.instructions, 600);
+    check_u64("read_running", "read branches", stats.branches, 50);
+    check_f64("read_running", "read elapsed", stats.elapsed_time_sec, 0.002);
+    check_f64("read_running", "read IPC", stats.insn_per_cycle, 2.0);
+
+    /* The read neither stops nor resets the region */
+    perfmon_mock_advance(ctx, &delta);
+    perfmon_stop(ctx, &stats);
+    check_u64("read_running", "stop cycles", stats.cycles, 600);
+    check_u64("read_running", "stop instructions", stats.instructions, 1200);
+    check_f64("read_running", "stop elapsed", stats.elapsed_time_sec, 0.004);
+
+    /* Reading a stopped context is an error */
+    check_u64("read_running", "read after stop fails", perfmon_read(ctx, &stats), 0);
+
+    perfmon_cleanup(ctx);
+}
+
+PERFMON_REGION(test_build);
+PERFMON_REGION(test_probe);
+
+static void test_region_table(void) {
+    perfmon_stats_t script[2], stats;
+    const perfmon_region_stats_t *rs;
+    perfmon_region_table_t *table;
+    perfmon_context_t *ctx;
+    int i;
+
+    memset(script, 0, sizeof(script));
+    script[0].cycles = 4000;
+    script[0].instructions = 2000;
+    script[0].cache_references = 100;
+    script[0].cache_misses = 40;
+    script[0].elapsed_time_sec = 0.004;
+    script[1].cycles = 1000;
+    script[1].instructions = 3000;
+    script[1].cache_references = 100;
+    script[1].cache_misses = 10;
+    script[1].elapsed_time_sec = 0.001;
+
+    ctx = open_mock(script, 2);
+    table = perfmon_region_table_create();
+    if (!table) {
+        fprintf(stderr, "Failed to create region table: %s\n", perfmon_get_error());
+        exit(1);
+    }
+
+    /* Three build calls (steps 0, 1, 0), one probe call (step 1) */
+    for (i = 0; i < 4; i++) {
+        perfmon_start(ctx);
+        perfmon_stop(ctx, &stats);
+        perfmon_region_record(table, i < 3 ? &test_build : &test_probe, &stats);
+    }
+
+    rs = perfmon_region_table_get(table, &test_build);
+    check_u64("region_table", "build found", rs != NULL, 1);
+    if (rs) {
+        check_u64("region_table", "build calls", rs->calls, 3);
+        check_u64("region_table", "build cycles", rs->total.cycles, 9000);
+        check_u64("region_table", "build instructions", rs->total.instructions, 7000);
+        check_u64("region_table", "build cache_misses", rs->total.cache_misses, 90);
+        check_f64("region_table", "build elapsed", rs->total.elapsed_time_sec, 0.009);
+        check_f64("region_table", "build IPC of the sum", rs->total.insn_per_cycle, 7000.0 / 9000.0);
+        check_f64("region_table", "build miss rate", rs->total.cache_miss_rate, 30.0);
+    }
+
+    rs = perfmon_region_table_get(table, &test_probe);
+    check_u64("region_table", "probe found", rs != NULL, 1);
+    if (rs) {
+        check_u64("region_table", "probe calls", rs->calls, 1);
+        check_u64("region_table", "probe cycles", rs->total.cycles, 1000);
+        check_f64("region_table", "probe IPC", rs->total.insn_per_cycle, 3.0);
+    }
+
+    perfmon_region_table_free(table);
+    perfmon_cleanup(ctx);
+}
+
+static void test_derived(void) {
+    perfmon_stats_t script, stats;
+    perfmon_context_t *ctx;
+
+    memset(&script, 0, sizeof(script));
+    script.cycles = 2000000;
+    script.instructions = 3000000;
+    script.branches = 400000;
+    script.branch_misses = 20000;
+    script.cache_references = 50000;
+    script.cache_misses = 5000;
+    script.ref_cycles = 1600000;
+    script.task_clock_ns = 1000000;
+    script.elapsed_time_sec = 0.001;
+
+    ctx = open_mock(&script, 1);
+    perfmon_start(ctx);
+    perfmon_stop(ctx, &stats);
+
+    check_f64("derived", "insn_per_cycle", stats.insn_per_cycle, 1.5);
+    check_f64("derived", "branch_miss_rate", stats.branch_miss_rate, 5.0);
+    check_f64("derived", "cache_miss_rate", stats.cache_miss_rate, 10.0);
+    check_f64("derived", "effective_ghz", stats.effective_ghz, 2.0);
+    check_f64("derived", "turbo_ratio", stats.turbo_ratio, 1.25);
+    check_u64("derived", "not throttled", stats.throttled, 0);
+
+    perfmon_cleanup(ctx);
+}
+
+PERFMON_REGION(test_slow);
+
+static void test_throttled(void) {
+    perfmon_stats_t script[3], stats;
+    const perfmon_region_stats_t *rs;
+    perfmon_region_table_t *table;
+    perfmon_context_t *ctx;
+
+    /* 1.4x turbo, then 1.1x (below 0.95 * 1.4), then 1.35x (within it) */
+    memset(script, 0, sizeof(script));
+    script[0].cycles = 1400000;
+    script[0].ref_cycles = 1000000;
+    script[0].elapsed_time_sec = 0.001;
+    script[1].cycles = 1100000;
+    script[1].ref_cycles = 1000000;
+    script[1].elapsed_time_sec = 0.001;
+    script[2].cycles = 1350000;
+    script[2].ref_cycles = 1000000;
+    script[2].elapsed_time_sec = 0.001;
+
+    ctx = open_mock(script, 3);
+    table = perfmon_region_table_create();
+    if (!table) {
+        fprintf(stderr, "Failed to create region table: %s\n", perfmon_get_error());
+        exit(1);
+    }
+
+    perfmon_start(ctx);
+    perfmon_stop(ctx, &stats);
+    check_u64("throttled", "1.4x not throttled", stats.throttled, 0);
+    check_f64("throttled", "1.4x reference", stats.turbo_reference, 1.4);
+
+    perfmon_start(ctx);
+    perfmon_stop(ctx, &stats);
+    check_u64("throttled", "1.1x throttled", stats.throttled, 1);
+    check_f64("throttled", "1.1x reference", stats.turbo_reference, 1.4);
+
+    /* Deriving the total again keeps the reference of the measurement */
+    perfmon_region_record(table, &test_slow, &stats);
+    rs = perfmon_region_table_get(table, &test_slow);
+    check_u64("throttled", "region total throttled", rs && rs->total.throttled, 1);
+
+    perfmon_start(ctx);
+    perfmon_stop(ctx, &stats);
+    check_u64("throttled", "1.35x not throttled", stats.throttled, 0);
+
+    perfmon_region_table_free(table);
+    perfmon_cleanup(ctx);
+}
+
+static void test_bias(void) {
+    perfmon_stats_t bias, script, delta, stats;
+    perfmon_context_t *ctx;
+
+    memset(&bias, 0, sizeof(bias));
+    bias.cycles = 100;
+    bias.instructions = 40;
+    bias.elapsed_time_sec = 1e-6;
+
+    memset(&script, 0, sizeof(script));
+    script.cycles = 1100;
+    script.instructions = 540;
+    script.elapsed_time_sec = 0.001001;
+
+    /* Calibration uses no script step: the first region measures step 0 */
+    ctx = open_mock_biased(&script, 1, &bias);
+    check_u64("bias", "calibrated", perfmon_get_calibration(ctx, &stats, NULL), 1);
+    check_u64("bias", "bias cycles", stats.cycles, 100);
+    check_u64("bias", "bias instructions", stats.instructions, 40);
+
+    perfmon_start(ctx);
+    perfmon_stop(ctx, &stats);
+    check_u64("bias", "stop cycles", stats.cycles, 1000);
+    check_u64("bias", "stop instructions", stats.instructions, 500);
+    check_f64("bias", "stop elapsed", stats.elapsed_time_sec, 0.001);
+    perfmon_cleanup(ctx);
+
+    memset(&delta, 0, sizeof(delta));
+    delta.cycles = 600;
+    delta.instructions = 240;
+    delta.elapsed_time_sec = 0.002001;
+
+    ctx = open_mock_biased(NULL, 0, &bias);
+    perfmon_start(ctx);
+    perfmon_mock_advance(ctx, &delta);
+    check_u64("bias", "read succeeds", perfmon_read(ctx, &stats), 1);
+    check_u64("bias", "read cycles", stats.cycles, 500);
+    check_u64("bias", "read instructions", stats.instructions, 200);
+    check_f64("bias", "read elapsed", stats.elapsed_time_sec, 0.002);
+    perfmon_stop(ctx, &stats);
+    perfmon_cleanup(ctx);
+}
+
+static void test_task_reset(void) {
+    perfmon_stats_t delta, stats;
+    perfmon_task_t task;
+    perfmon_context_t *ctx = open_mock(NULL, 0);
+
+    memset(&delta, 0, sizeof(delta));
+    delta.cycles = 700;
+    delta.elapsed_time_sec = 0.001;
+
+    perfmon_task_init(&task);
+    perfmon_start(ctx);
+    perfmon_mock_advance(ctx, &delta);
+
+    /* Switched in at 700 cycles, out at 0 after a reset */
+    perfmon_task_switch_in(ctx, &task);
+    perfmon_reset(ctx);
+    perfmon_task_switch_out(ctx, &task);
+    perfmon_task_get_stats(&task, &stats);
+    check_u64("task_reset", "reset slice cycles", stats.cycles, 0);
+
+    perfmon_task_switch_in(ctx, &task);
+    perfmon_mock_advance(ctx, &delta);
+    perfmon_task_switch_out(ctx, &task);
+    perfmon_task_get_stats(&task, &stats);
+    check_u64("task_reset", "next slice cycles", stats.cycles, 700);
+
+    perfmon_stop(ctx, &stats);
+    perfmon_cleanup(ctx);
+}
+
+int main(void) {
+    test_start_stop();
+    test_read_running();
+    test_region_table();
+    test_derived();
+    test_throttled();
+    test_bias();
+    test_task_reset();
+
+    printf("%s: %d of %d checks passed\n", nr_failed ? "FAIL" : "PASS",
+           nr_checks - nr_failed, nr_checks);
+    return nr_failed > 0 ? 1 : 0;
+}
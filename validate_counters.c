@@ -0,0 +1,335 @@
+/*
+ * Counter accuracy validation
+ *
+ * Runs kernels whose counter behavior is known in advance and checks the
+ * measured values against the expectation:
+ *
+ *   fixed_loop     2-instruction loop: exact instructions and branches
+ *   pointer_chase  random cycle over a working set: LLC and dTLB misses
+ *                  per step near 0 when it fits in L1, near 1 far beyond LLC
+ *   random_branch  one unpredictable 50/50 branch per iteration
+ *   page_touch     one write per fresh anonymous page: exact minor faults
+ *
+ * Counters the context does not measure are reported as SKIP.  A FAIL means the
+ * kernel, hypervisor or PMU is making the numbers lie.
+ *
+ * Usage: validate_counters [extra_working_set_kib ...]
+ *   Extra working-set sizes are chased and reported without a check.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "perfmon.h"
+
+#define LOOP_ITERATIONS     10000000ULL
+#define BRANCH_ITERATIONS   4000000UL
+#define CHASE_STEPS         2000000UL
+#define TOUCH_PAGES         4096UL
+#define SMALL_WORKING_SET   (16UL * 1024)
+#define MIN_LARGE_SET       (64UL * 1024 * 1024)
+#define MAX_LARGE_SET       (1024UL * 1024 * 1024)
+
+/* One cache line per pointer-chase node */
+typedef struct chase_node {
+    struct chase_node *next;
+    char pad[64 - sizeof(struct chase_node *)];
+} chase_node_t;
+
+static int nr_failed = 0;
+static int nr_skipped = 0;
+
+/* Context the kernels are measured with; decides what is SKIP */
+static perfmon_context_t *validate_ctx;
+
+/* Check lo <= measured <= hi and print the result */
+static void check(const char *kernel, const char *what, perfmon_counter_type_t type,
+                  double measured, double lo, double hi) {
+    const char *result;
+
+    if (!perfmon_counter_enabled(validate_ctx, type)) {
+        result = "SKIP";
+        nr_skipped++;
+    } else if (measured >= lo && measured <= hi) {
+        result = "PASS";
+    } else {
+        result = "FAIL";
+        nr_failed++;
+    }
+    printf("%-14s  %-30s  %14.4f  [%12.4f, %12.4f]  %s\n", kernel, what, measured, lo, hi, result);
+}
+
+/* Simple xorshift generator so runs are reproducible */
+static uint64_t xorshift(uint64_t *state) {
+    uint64_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+/* Anonymous mapping backed by 4 KiB pages only */
+static void *map_small_pages(size_t size) {
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+    madvise(p, size, MADV_NOHUGEPAGE);
+    return p;
+}
+
+/* n iterations of a decrement and a conditional branch */
+static void fixed_loop(uint64_t n) {
+#if defined(__x86_64__)
+    __asm__ __volatile__("1:\n\tdec %0\n\tjnz 1b" : "+r"(n) : : "cc");
+#elif defined(__aarch64__)
+    __asm__ __volatile__("1:\n\tsubs %0, %0, #1\n\tb.ne 1b" : "+r"(n) : : "cc");
+#else
+    volatile uint64_t i;
+    for (i = 0; i < n; i++) {
+    }
+#endif
+}
+
+static void validate_fixed_loop(perfmon_context_t *ctx) {
+    perfmon_stats_t stats;
+    const double n = (double)LOOP_ITERATIONS;
+
+    perfmon_start(ctx);
+    fixed_loop(LOOP_ITERATIONS);
+    perfmon_stop(ctx, &stats);
+
+#if defined(__x86_64__) || defined(__aarch64__)
+    check("fixed_loop", "instructions / iteration", PERFMON_INSTRUCTIONS,
+          (double)stats.instructions / n, 1.999, 2.001);
+    check("fixed_loop", "branches / iteration", PERFMON_BRANCHES,
+          (double)stats.branches / n, 0.999, 1.001);
+    check("fixed_loop", "branch misses / iteration", PERFMON_BRANCH_MISSES,
+          (double)stats.branch_misses / n, 0.0, 0.001);
+#else
+    printf("%-14s  no fixed-length loop for this architecture  SKIP\n", "fixed_loop");
+    nr_skipped++;
+#endif
+}
+
+/* Build a single random cycle through n nodes (Sattolo's algorithm) */
+static chase_node_t *build_chase(size_t n) {
+    chase_node_t *nodes = (chase_node_t *)map_small_pages(n * sizeof(chase_node_t));
+    size_t *order, i, j, tmp;
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+
+    order = (size_t *)malloc(n * sizeof(size_t));
+    if (!nodes || !order) {
+        free(order);
+        return NULL;
+    }
+
+    for (i = 0; i < n; i++) {
+        order[i] = i;
+    }
+    for (i = n - 1; i > 0; i--) {
+        j = xorshift(&state) % i;
+        tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+    for (i = 0; i < n; i++) {
+        nodes[order[i]].next = &nodes[order[(i + 1) % n]];
+    }
+
+    free(order);
+    return nodes;
+}
+
+/* Chase a working set; returns false if it could not be allocated */
+static bool chase(perfmon_context_t *ctx, size_t working_set, perfmon_stats_t *stats) {
+    size_t n = working_set / sizeof(chase_node_t);
+    chase_node_t *nodes, *p;
+    volatile chase_node_t *sink;
+    size_t i;
+
+    nodes = build_chase(n);
+    if (!nodes) {
+        return false;
+    }
+
+    /* Warm up caches and TLB to steady state */
+    p = nodes;
+    for (i = 0; i < CHASE_STEPS; i++) {
+        p = p->next;
+    }
+
+    perfmon_start(ctx);
+    for (i = 0; i < CHASE_STEPS; i++) {
+        p = p->next;
+    }
+    perfmon_stop(ctx, stats);
+
+    sink = p;
+    (void)sink;
+    munmap(nodes, n * sizeof(chase_node_t));
+    return true;
+}
+
+static void validate_pointer_chase(perfmon_context_t *ctx, int argc, char *argv[]) {
+    perfmon_stats_t stats;
+    long llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    size_t large = llc > 0 ? (size_t)llc * 4 : MIN_LARGE_SET;
+    const double steps = (double)CHASE_STEPS;
+    char label[64];
+    int i;
+
+    /* Far beyond the LLC, within reason for virtualized cache sizes */
+    if (large < MIN_LARGE_SET) {
+        large = MIN_LARGE_SET;
+    } else if (large > MAX_LARGE_SET) {
+        large = MAX_LARGE_SET;
+    }
+
+    if (chase(ctx, SMALL_WORKING_SET, &stats)) {
+        check("pointer_chase", "16 KiB: LLC misses / step", PERFMON_CACHE_MISSES,
+              (double)stats.cache_misses / steps, 0.0, 0.05);
+        check("pointer_chase", "16 KiB: dTLB misses / step", PERFMON_DTLB_LOAD_MISSES,
+              (double)stats.dtlb_load_misses / steps, 0.0, 0.05);
+    }
+
+    if (chase(ctx, large, &stats)) {
+        snprintf(label, sizeof(label), "%zu MiB: LLC misses / step", large >> 20);
+        check("pointer_chase", label, PERFMON_CACHE_MISSES,
+              (double)stats.cache_misses / steps, 0.5, 1.5);
+        snprintf(label, sizeof(label), "%zu MiB: dTLB misses / step", large >> 20);
+        check("pointer_chase", label, PERFMON_DTLB_LOAD_MISSES,
+              (double)stats.dtlb_load_misses / steps, 0.5, 1.5);
+    }
+
+    /* Extra sizes from the command line: report only */
+    for (i = 1; i < argc; i++) {
+        size_t kib = strtoul(argv[i], NULL, 10);
+
+        if (kib == 0 || !chase(ctx, kib * 1024, &stats)) {
+            continue;
+        }
+        printf("%-14s  %zu KiB: %.4f LLC misses/step, %.4f dTLB misses/step, %.1f cycles/step\n",
+               "pointer_chase", kib, (double)stats.cache_misses / steps,
+               (double)stats.dtlb_load_misses / steps, (double)stats.cycles / steps);
+    }
+}
+
+/* One data-dependent branch per element */
+static uint64_t random_branches(const uint8_t *bits, size_t n) {
+    uint64_t taken = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+#if defined(__x86_64__)
+        __asm__ __volatile__("test %1, %1\n\tjz 1f\n\tinc %0\n1:"
+                             : "+r"(taken) : "r"((uint64_t)bits[i]) : "cc");
+#elif defined(__aarch64__)
+        __asm__ __volatile__("cbz %1, 1f\n\tadd %0, %0, #1\n1:"
+                             : "+r"(taken) : "r"((uint64_t)bits[i]));
+#else
+        if (bits[i]) {
+            taken++;
+        }
+#endif
+    }
+    return taken;
+}
+
+static void validate_random_branch(perfmon_context_t *ctx) {
+    perfmon_stats_t stats;
+    uint8_t *bits;
+    uint64_t state = 0x2545f4914f6cdd1dULL;
+    volatile uint64_t sink;
+    size_t i;
+    const double n = (double)BRANCH_ITERATIONS;
+
+    bits = (uint8_t *)malloc(BRANCH_ITERATIONS);
+    if (!bits) {
+        return;
+    }
+    for (i = 0; i < BRANCH_ITERATIONS; i++) {
+        bits[i] = (uint8_t)(xorshift(&state) >> 63);
+    }
+
+    perfmon_start(ctx);
+    sink = random_branches(bits, BRANCH_ITERATIONS);
+    perfmon_stop(ctx, &stats);
+    (void)sink;
+
+    /* The loop branch is predictable; the data branch misses half the time */
+    check("random_branch", "branch misses / iteration", PERFMON_BRANCH_MISSES,
+          (double)stats.branch_misses / n, 0.40, 0.60);
+    check("random_branch", "branches / iteration", PERFMON_BRANCHES,
+          (double)stats.branches / n, 1.9, 2.2);
+
+    free(bits);
+}
+
+static void validate_page_touch(perfmon_context_t *ctx) {
+    perfmon_stats_t stats;
+    long page_size = sysconf(_SC_PAGESIZE);
+    size_t size = TOUCH_PAGES * (size_t)page_size;
+    volatile char *p;
+    size_t i;
+
+    p = (volatile char *)map_small_pages(size);
+    if (!p) {
+        return;
+    }
+
+    perfmon_start(ctx);
+    for (i = 0; i < TOUCH_PAGES; i++) {
+        p[i * (size_t)page_size] = 1;
+    }
+    perfmon_stop(ctx, &stats);
+
+    check("page_touch", "minor faults / page", PERFMON_MINOR_FAULTS,
+          (double)stats.minor_faults / TOUCH_PAGES, 1.0, 1.0 + 16.0 / TOUCH_PAGES);
+    check("page_touch", "major faults", PERFMON_MAJOR_FAULTS,
+          (double)stats.major_faults, 0.0, 0.0);
+
+    munmap((void *)p, size);
+}
+
+int main(int argc, char *argv[]) {
+    perfmon_options_t opts;
+    perfmon_host_t host;
+
+    printf("libperfmon - Counter Accuracy Validation\n");
+    printf("=========================================\n");
+
+    /* Which machine produced the numbers below */
+    perfmon_host_info(&host);
+    fflush(stdout);
+    perfmon_print_host(&host, STDOUT_FILENO);
+    printf("\n");
+
+    /* Remove the start/stop cost so exact counts can be checked */
+    perfmon_options_init(&opts);
+    opts.subtract_bias = true;
+    validate_ctx = perfmon_init_with_options(&opts);
+    if (!validate_ctx) {
+        fprintf(stderr, "Failed to initialize perfmon: %s\n", perfmon_get_error());
+        return 1;
+    }
+
+    printf("%-14s  %-30s  %14s  %-28s  %s\n", "Kernel", "Check", "Measured", "Expected", "Result");
+    printf("%-14s  %-30s  %14s  %-28s  %s\n", "------", "-----", "--------", "--------", "------");
+
+    validate_fixed_loop(validate_ctx);
+    validate_pointer_chase(validate_ctx, argc, argv);
+    validate_random_branch(validate_ctx);
+    validate_page_touch(validate_ctx);
+
+    perfmon_cleanup(validate_ctx);
+
+    printf("\n%d failed, %d skipped (counter unavailable)\n", nr_failed, nr_skipped);
+    return nr_failed > 0 ? 1 : 0;
+}